@@ -1,5 +1,5 @@
 //
-// Temps de chargement de "rhone-alpes.osm.bz2" (GCC 4.5, multi-core)
+// Temps de chargement de "rhone-alpes.osm.bz2" (GCC 4.5, multi-core) par Bz2Reader
 //  maxSize  -DPTHREAD   -UPTHREAD
 //    16 Ko      94s        111s
 //   256 Ko      61s        110s
@@ -7,19 +7,77 @@
 //    16 Ko      68s         66s
 //   256 Ko      60s         67s
 // Avec 512 Ko, le temps "bz2" ne bassie guere, donc on peut rester a 256 Ko.
+// Le temps "bz2" est celui d'un seul flot BZ2_bzRead : Bz2BlockReader
+// decomprime plusieurs blocs bzip2 a la fois, sur plusieurs threads.
+// Ces mesures datent du double tampon recopie a chaque Async_Feed ; il est
+// remplace par un anneau de blocs passes par pointeur (defaultDepth).
 
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "Files.h"
+#include "Workers.h"
 #include "zlib.h"
 #include "bzlib.h"
+#ifdef HAS_ZSTD
+#include "zstd.h"
+#endif
+
+IByteFileReader::IByteFileReader (size_t blockSize, unsigned depth)
+{
+  buffer = NULL;
+  fill = 0;
+  m_mapped = false;
+  m_blockSize = blockSize;
+  m_depth = (depth < 2) ? 2 : depth;
+  m_ring = NULL;
+  m_fills = NULL;
+  m_read = 0;
+  m_eof = false;
+  m_error = NULL;
+#ifdef HAS_PTHREAD
+  pinit = false;
+  m_kill = false;
+  m_held = false;
+#endif
+}
+
+IByteFileReader::~IByteFileReader()
+{
+  kill();
+  delete[] m_ring;
+  delete[] m_fills;
+}
+
+// Bloc i de l'anneau, alloue au premier emploi (un lecteur mappe n'en a pas besoin)
+char *IByteFileReader::Block (unsigned i)
+{
+  if (m_ring == NULL)
+  {
+    m_ring  = new char[m_depth * m_blockSize];
+    m_fills = new size_t[m_depth];
+  }
+  return m_ring + (i % m_depth) * m_blockSize;
+}
 
 void IByteFileReader::Feed (void)
 {
-  fill = Feed (buffer);
+  if (m_mapped)
+    fill = Map (&buffer);
+  else
+  {
+    char *b = Block (0);
+    fill = Feed (b, m_blockSize);
+    buffer = b;
+  }
 }
 
 #ifndef HAS_PTHREAD
@@ -28,6 +86,10 @@ void IByteFileReader::Async_Feed (void)
   Feed();
 }
 
+void IByteFileReader::kill (void)
+{
+}
+
 #else
 // Sommet "C" du thread
 extern "C" void *thread_entry (void *arg)
@@ -41,25 +103,57 @@ extern "C" void *thread_entry (void *arg)
 // consomme les donnees recues, ce thread charge les suivantes
 void IByteFileReader::Async_Feed (void)
 {
+  // Un fichier mappe n'a rien a lire d'avance
+  if (m_mapped)
+  {
+    Feed();
+    return;
+  }
+
   // Create thread and synchonizers (first or previously failed)
-  if (! pinit)
+  if (! pinit && ! m_eof)
   {
-    sem_init (&sem_feed, 0, 0);
+    Block (0);
+    sem_init (&sem_free, 0, m_depth);
     sem_init (&sem_filled, 0, 0);
     pinit = (pthread_create (&pt, NULL, thread_entry, this) == 0);
-    if (!pinit) perror ("pthread_create");
+    if (!pinit)
+    {
+      perror ("pthread_create");
+      sem_destroy (&sem_free);
+      sem_destroy (&sem_filled);
+    }
   }
 
   if (! pinit)
+  {
     Feed();       // Back to synchronous way
-  else
+    return;
+  }
+
+  // Le bloc rendu au precedent appel est maintenant libre
+  if (m_held)
   {
-    // Demander un Feed d'avance
-    sem_post (&sem_feed);
-//  printf ("m Wait\n");
-    sem_wait (&sem_filled);
-//  printf ("m Obtained\n");
+    sem_post (&sem_free);
+    m_held = false;
   }
+
+  if (m_eof)      // Rien apres la fin
+  {
+    fill = 0;
+    return;
+  }
+
+  // Prendre le plus ancien bloc rempli, sans copie
+//printf ("m Wait\n");
+  sem_wait (&sem_filled);
+//printf ("m Obtained\n");
+  buffer = Block (m_read);
+  fill = m_fills[m_read % m_depth];
+  ++m_read;
+  m_held = true;
+  if (fill == 0) m_eof = true;
+  if (m_eof && (m_error != NULL)) throw m_error;
 }
 
 void IByteFileReader::kill (void)
@@ -67,39 +161,44 @@ void IByteFileReader::kill (void)
   if (! pinit) return;
   m_kill = true;
 //printf ("m Kill\n");
-  sem_post (&sem_feed);
-  // Au retour de ceci, *this n'existe plus !
+  sem_post (&sem_free);
+  // Attendre que le thread ait fini son eventuel Feed(b) en cours
+  pthread_join (pt, NULL);
+  sem_destroy (&sem_free);
+  sem_destroy (&sem_filled);
+  pinit = false;
 }
 
-// Le thread de Feed asycnhrone :
-// + fait une lecture en avance, puis attend une demande de
-//   lecture. Fourni alors ce qui a ete lu puis relance la lecture
-//   qui sera demande plus tard
+// Le thread de Feed asynchrone :
+// + remplit les blocs de l'anneau les uns apres les autres, tant qu'il en
+//   trouve de libres, et les publie au fur et a mesure
+// + s'arrete apres avoir publie la fin de fichier (bloc vide)
 void IByteFileReader::entry (void)
 {
-  while (! m_kill)
+  for (unsigned w = 0; ; ++w)
   {
-    // Effectuer la prochaine lecture
-    // + backbuffer aussi pourrait etre dans la pile de ce thread,
-    //   mais il pourrait alors y avoir une limite a sa taille ?
-//  printf ("t Filling\n");
-    size_t backfill = Feed(backbuffer);
-//  printf ("t Filled %u\n", backfill);
-
-    // Attendre une demande de feed
-    // Cela signale que le thread principal attend le buffer donc on peut y toucher
-    sem_wait (&sem_feed);
+    // Attendre qu'un bloc soit libre
+    sem_wait (&sem_free);
+    if (m_kill) break;
 
-    // Publier la lecture deja effectuee
-    memcpy (buffer, backbuffer, backfill);
-    fill = backfill;
+//  printf ("t Filling\n");
+    unsigned const i = w % m_depth;
+    try
+    {
+      m_fills[i] = Feed (Block (i), m_blockSize);
+    }
+    catch (const char *error)
+    {
+      m_error = error;            // Releve par Async_Feed, apres ce bloc vide
+      m_fills[i] = 0;
+    }
+//  printf ("t Filled %u\n", m_fills[i]);
 
-    // Signaler que le tampon est dispo
+    // Publier ce bloc. A partir d'ici ce thread n'y touche plus, tant que
+    // l'appelant ne l'a pas rendu
     sem_post (&sem_filled);
-    // A partir d'ici ce thread ne doit plus toucher le buffer principal, tant que
-    // le thread principal n'est pas revenu en attente de feed
+    if (m_fills[i] == 0) break;
   }
-  // !! Si m_kill, *this n'existe plus. Cela peut-il gener le retour de cette methode ?
 //printf ("t Killed\n");
 }
 #endif
@@ -117,14 +216,15 @@ public:
 
   ~PlainReader ()
   {
+    kill();
     if (fd >= 0) close (fd);
   }
 
-  size_t Feed (char *b)
+  size_t Feed (char *b, size_t size)
   {
 //  printf ("p Filling\n");
     if (fd < 0) return 0;
-    int n = read (fd, b, maxSize);
+    int n = read (fd, b, size);
 //  printf ("p Filled %d\n", n);
     if (n < 0) n = 0;
     return n;
@@ -135,11 +235,117 @@ private:
 };
 
 
+#ifndef WIN32
+// Fichier non comprime, lu par mmap() : les donnees sont passees au parser
+// directement depuis les pages du fichier, sans read() ni memcpy vers buffer.
+// + Expat recopie encore chaque bloc dans son propre tampon (XML_Parse), ce
+//   qui ne fait plus qu'une copie au lieu de trois
+// + MADV_SEQUENTIAL laisse le noyau lire en avance et liberer les pages deja
+//   lues ; les fenetres consommees sont en plus rendues (MADV_DONTNEED) pour
+//   que la RAM du process ne grossisse pas de la taille du fichier
+class MmapReader : public IByteFileReader
+{
+public:
+  MmapReader (const char *filename)
+  {
+    struct stat st;
+    m_base = NULL;
+    m_size = m_pos = m_released = 0;
+
+    int fd = open (filename, O_RDONLY);
+    if (fd < 0)
+    {
+      perror(filename);
+      return;
+    }
+    if ((fstat (fd, &st) == 0) && (st.st_size > 0))
+    {
+      void *p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED)
+        perror (filename);
+      else
+      {
+        m_base = (const char *) p;
+        m_size = st.st_size;
+        madvise (p, m_size, MADV_SEQUENTIAL);
+      }
+    }
+    close (fd);                 // Le mapping reste valide
+    m_mapped = true;
+  }
+
+  ~MmapReader ()
+  {
+    if (m_base != NULL) munmap ((void *) m_base, m_size);
+  }
+
+  const char *Whole (size_t *size)
+  {
+    *size = m_size;
+    return m_base;
+  }
+
+  // Peut-on lire ce fichier par mmap ?
+  static bool Possible (const char *filename)
+  {
+    struct stat st;
+    return (stat (filename, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0);
+  }
+
+private:
+  static const size_t window = 4 * maxSize;
+
+  const char *m_base;
+  size_t m_size, m_pos;
+  size_t m_released;                    // [0, m_released) deja rendu
+
+  size_t Map (const char **b)
+  {
+    // Rendre la fenetre precedente, deja consommee par le parser
+    // + Seulement ce qui ne l'a pas deja ete : sinon chaque appel repasserait
+    //   sur tout le debut du fichier
+    size_t const page = sysconf (_SC_PAGESIZE);
+    size_t const done = (m_pos / page) * page;
+    if (done > m_released)
+    {
+      madvise ((void *) (m_base + m_released), done - m_released, MADV_DONTNEED);
+      m_released = done;
+    }
+
+    size_t n = m_size - m_pos;
+    if (n > window) n = window;
+    *b = m_base + m_pos;
+    m_pos += n;
+
+    // Demander la lecture de la fenetre suivante pendant le parse de celle-ci
+    if (m_pos < m_size)
+    {
+      size_t const ahead = (m_size - m_pos < window) ? m_size - m_pos : window;
+      size_t const from = (m_pos / page) * page;
+      madvise ((void *) (m_base + from), ahead + (m_pos - from), MADV_WILLNEED);
+    }
+    return n;
+  }
+
+  // Non employe (m_mapped), mais requis par IByteFileReader
+  size_t Feed (char *b, size_t size)
+  {
+    const char *p;
+    size_t n = Map (&p);
+    if (n > size) { m_pos -= n - size; n = size; }
+    memcpy (b, p, n);
+    return n;
+  }
+};
+#endif
+
+
 class Bz2Reader : public IByteFileReader
 {
 public:
   Bz2Reader (const char *filename)
   {
+    fb = NULL;
     if ((fp = fopen (filename, "rb")) == NULL)
       perror(filename);
     else
@@ -155,6 +361,7 @@ public:
 
   ~Bz2Reader ()
   {
+    kill();
     if (fb != NULL)
     {
       BZ2_bzReadClose (&bzerror, fb);
@@ -162,11 +369,11 @@ public:
     }
   }
 
-  size_t Feed (char *b)
+  size_t Feed (char *b, size_t size)
   {
 //  printf ("z Filling\n");
     if (fb == NULL) return 0;
-    int n = BZ2_bzRead (&bzerror, fb, b, maxSize);
+    int n = BZ2_bzRead (&bzerror, fb, b, size);
 //  printf ("z Filled %d\n", n);
     if (n < 0) n = 0;
     return n;
@@ -180,14 +387,491 @@ private:
 
 
 
+class GzReader : public IByteFileReader
+{
+public:
+  GzReader (const char *filename)
+  {
+    if ((fz = gzopen (filename, "rb")) == NULL)
+      perror(filename);
+    else
+      gzbuffer (fz, blockSize());
+  }
+
+  ~GzReader ()
+  {
+    kill();
+    if (fz != NULL) gzclose (fz);
+  }
+
+  size_t Feed (char *b, size_t size)
+  {
+    if (fz == NULL) return 0;
+    // gzread enchaine de lui-meme les membres d'un ".gz" concatene
+    int n = gzread (fz, b, size);
+    if (n < 0) n = 0;
+    return n;
+  }
+
+private:
+  gzFile fz;
+};
+
+
+#ifdef HAS_ZSTD
+// Zstandard : decompresse plusieurs fois plus vite que bzip2, pour un taux
+// de compression comparable
+//      http://facebook.github.io/zstd/
+class ZstdReader : public IByteFileReader
+{
+public:
+  ZstdReader (const char *filename)
+  {
+    zs = NULL;
+    if ((fp = fopen (filename, "rb")) == NULL)
+      perror(filename);
+    else if ((zs = ZSTD_createDStream()) == NULL)
+    {
+      perror (filename);
+      fclose (fp);
+      fp = NULL;
+    }
+    else
+      ZSTD_initDStream (zs);
+    in.src  = inbuf;
+    in.size = in.pos = 0;
+    m_end = false;
+    m_last = 0;
+  }
+
+  ~ZstdReader ()
+  {
+    kill();
+    if (zs != NULL) ZSTD_freeDStream (zs);
+    if (fp != NULL) fclose (fp);
+  }
+
+  size_t Feed (char *b, size_t size)
+  {
+    if (zs == NULL) return 0;
+    ZSTD_outBuffer out = { b, size, 0 };
+    while (out.pos < out.size)
+    {
+      if (in.pos == in.size)
+      {
+        if (! m_end)
+        {
+          in.size = fread (inbuf, 1, sizeof(inbuf), fp);
+          in.pos = 0;
+          m_end = (in.size == 0);
+        }
+        // Fin de fichier : fini si la derniere trame est entierement
+        // rendue, sinon la lib en garde encore (appels sans entree)
+        if (m_end && (m_last == 0)) break;
+      }
+      // Les trames successives d'un fichier sont enchainees par la lib
+      size_t const pos = out.pos;
+      size_t const ret = ZSTD_decompressStream (zs, &out, &in);
+      if (ZSTD_isError (ret))
+      {
+        printf ("zstd: %s\n", ZSTD_getErrorName (ret));
+        throw "syntaxError";
+      }
+      m_last = ret;
+      // Plus rien a rendre ni a lire, mais trame inachevee : fichier tronque
+      if (m_end && (out.pos == pos) && (ret != 0))
+      {
+        printf ("zstd: truncated file\n");
+        throw "syntaxError";
+      }
+    }
+    return out.pos;
+  }
+
+private:
+  FILE *fp;
+  ZSTD_DStream *zs;
+  ZSTD_inBuffer in;
+  bool m_end;                           // fread a atteint la fin du fichier
+  size_t m_last;                        // 0 : derniere trame finie et rendue
+  char inbuf[128*1024];
+};
+#endif
+
+
+#ifdef HAS_PTHREAD
+// Decompression d'un ".bz2" par blocs, sur plusieurs threads (a la pbzip2)
+//
+// Un flot bzip2 est "BZh9" suivi de blocs, chacun commencant par le nombre
+// magique 48 bits 0x314159265359 puis le CRC du bloc, et est termine par le
+// magique 0x177245385090 puis le CRC combine des blocs. Les blocs ne sont pas
+// alignes sur des octets, mais sont independants les uns des autres.
+// + On cherche donc les magiques bit a bit, et chaque bloc trouve est recopie
+//   dans un flot bzip2 a lui seul ("BZh9" + bloc + fin de flot, dont le CRC
+//   combine est alors celui du bloc) que libbzip2 sait decomprimer
+// + Un fichier fait de plusieurs flots concatenes (pbzip2) est traite de meme
+// + Le magique peut apparaitre par hasard dans des donnees comprimees : le
+//   bloc ainsi coupe en deux ne passe pas la decompression (CRC), on recolle
+//   alors les deux morceaux, quelle que soit la nature du magique fortuit,
+//   et on recommence
+// + Pendant que Feed() rend les blocs decomprimes d'un lot, les threads
+//   decomprimes le lot suivant
+
+class Bz2BlockReader : public IByteFileReader
+{
+public:
+  // Les blocs decomprimes arrivent par lots entiers : un anneau plus
+  // profond lisse ces rafales vis-a-vis du parser
+  Bz2BlockReader (const char *filename) : IByteFileReader (maxSize, 8)
+  {
+    m_eof = false;
+    m_inBase = 0;
+    m_scanned = 1;
+    m_nextBound = 0;
+    m_outIx = m_outPos = 0;
+    m_running = false;
+    m_ready = &m_jobs[0];
+    m_decoding = &m_jobs[1];
+    m_batch = 2 * m_pool.size() + 1;
+    if ((fp = fopen (filename, "rb")) == NULL)
+      perror(filename);
+    InitTables();
+  }
+
+  ~Bz2BlockReader ()
+  {
+    kill();
+    if (m_running) m_pool.Wait();
+    if (fp != NULL) fclose (fp);
+  }
+
+  size_t Feed (char *b, size_t size)
+  {
+    for (;;)
+    {
+      // Rendre la suite du bloc decomprime courant
+      while (m_outIx < m_ready->count)
+      {
+        std::vector<char> &out = m_ready->out[m_outIx];
+        if (m_outPos < out.size())
+        {
+          size_t n = out.size() - m_outPos;
+          if (n > size) n = size;
+          memcpy (b, &out[m_outPos], n);
+          m_outPos += n;
+          return n;
+        }
+        ++m_outIx;
+        m_outPos = 0;
+      }
+
+      // Lot epuise : passer au suivant
+      if (! NextBatch()) return 0;
+    }
+  }
+
+private:
+  static const uint64_t blockMagic = 0x314159265359ULL;
+  static const uint64_t eosMagic   = 0x177245385090ULL;
+  static const size_t   readSize   = 4*1024*1024;
+  static const uint64_t maxBlockBits = 8*2*1024*1024;   // Bien plus que 900 Ko comprimes
+
+  // Un lot de blocs a decomprimer par le pool
+  class Job : public IJob
+  {
+  public:
+    std::vector< std::vector<char> > in;    // Flot bzip2 d'un seul bloc
+    std::vector< std::vector<char> > out;   // Son contenu decomprime
+    std::vector<bool> ok;
+    unsigned count;
+
+    Job () : count(0) {}
+
+    void Run (unsigned i)
+    {
+      ok[i] = Decompress (in[i], out[i]);
+    }
+  };
+
+  // Debut d'un bloc ou d'une fin de flot, en bits depuis le debut du fichier
+  struct Bound
+  {
+    uint64_t bit;
+    bool     block;     // Bloc, sinon fin de flot
+  };
+
+  FILE *fp;
+  bool m_eof;
+  std::vector<uint8_t> m_in;    // Donnees comprimees lues et pas encore decomprimees
+  uint64_t m_inBase;            // Position de m_in[0] dans le fichier (octets)
+  uint64_t m_scanned;           // Position (octets) jusqu'ou les magiques ont ete cherches
+  std::vector<Bound> m_bounds;  // Limites trouvees
+  unsigned m_nextBound;         // Premier element de m_bounds non encore decomprime
+
+  WorkerPool m_pool;
+  unsigned m_batch;             // Nombre de blocs par lot
+  Job m_jobs[2];
+  Job *m_ready, *m_decoding;
+  std::vector<unsigned> m_used; // Index dans m_bounds des blocs de m_decoding
+  bool m_running;
+  unsigned m_outIx;
+  size_t m_outPos;
+
+  // Pour chaque valeur d'octet, les decalages (bits 0..7 : bloc, 8..15 : fin
+  // de flot) pour lesquels cet octet peut etre le 2eme octet d'un magique
+  uint16_t m_candidates[256];
+
+  void InitTables (void)
+  {
+    memset (m_candidates, 0, sizeof(m_candidates));
+    for (unsigned s = 0; s < 8; ++s)
+    {
+      m_candidates[(blockMagic >> (32 + s)) & 0xFF] |= 1 << s;
+      m_candidates[(eosMagic   >> (32 + s)) & 0xFF] |= 0x100 << s;
+    }
+  }
+
+  // Lire plus de donnees comprimees
+  bool Read (void)
+  {
+    if (m_eof || (fp == NULL)) return false;
+    size_t const old = m_in.size();
+    m_in.resize (old + readSize);
+    size_t const n = fread (&m_in[old], 1, readSize, fp);
+    m_in.resize (old + n);
+    if (n == 0) m_eof = true;
+    return n > 0;
+  }
+
+  // Chercher les magiques dans ce qui a ete lu
+  // + Un magique au bit s de l'octet i contient entierement l'octet i+1,
+  //   qui sert de filtre (m_candidates) avant la comparaison complete
+  void Scan (void)
+  {
+    uint64_t const end = m_inBase + m_in.size();
+    for (; m_scanned + 7 <= end; ++m_scanned)
+    {
+      uint16_t const c = m_candidates[m_in[m_scanned - m_inBase]];
+      if (c == 0) continue;
+
+      const uint8_t *p = &m_in[m_scanned - 1 - m_inBase];
+      uint64_t w = 0;
+      for (unsigned k = 0; k < 8; ++k) w = (w << 8) | p[k];
+      for (unsigned s = 0; s < 8; ++s)
+      {
+        uint64_t const v = (w << s) >> 16;
+        Bound b;
+        b.bit = 8 * (m_scanned - 1) + s;
+        if ((c & (1 << s)) && (v == blockMagic))
+          b.block = true;
+        else if ((c & (0x100 << s)) && (v == eosMagic))
+          b.block = false;
+        else
+          continue;
+        m_bounds.push_back (b);
+      }
+    }
+  }
+
+  // Recopier les bits [begin,end) du fichier dans un flot bzip2 a un seul bloc
+  void MakeStream (uint64_t begin, uint64_t end, std::vector<char> &out)
+  {
+    uint64_t const nbits = end - begin;
+    const uint8_t *src = &m_in[begin/8 - m_inBase];
+    unsigned const shift = begin % 8;
+
+    out.resize (4 + (nbits + 80 + 7) / 8);
+    uint8_t *dst = (uint8_t *) &out[0];
+    memcpy (dst, "BZh9", 4);
+    dst += 4;
+    for (uint64_t k = 0; k < (nbits + 7) / 8; ++k)
+      dst[k] = ShiftedByte (src, k, shift);
+
+    // Fin de flot : magique puis CRC combine, qui est le CRC du bloc (les 32
+    // bits qui suivent son magique)
+    uint32_t crc = 0;
+    for (unsigned k = 6; k < 10; ++k)
+      crc = (crc << 8) | ShiftedByte (src, k, shift);
+    uint64_t pos = nbits;               // Position d'ecriture en bits dans dst
+    dst[pos / 8] &= (uint8_t) (0xFF00 >> (pos % 8));
+    for (int k = 47; k >= 0; --k, ++pos) PutBit (dst, pos, (eosMagic >> k) & 1);
+    for (int k = 31; k >= 0; --k, ++pos) PutBit (dst, pos, (crc >> k) & 1);
+  }
+
+  static inline uint8_t ShiftedByte (const uint8_t *src, uint64_t k, unsigned shift)
+  {
+    return (shift == 0) ? src[k] : (uint8_t) ((src[k] << shift) | (src[k+1] >> (8 - shift)));
+  }
+
+  static inline void PutBit (uint8_t *dst, uint64_t pos, unsigned bit)
+  {
+    if ((pos % 8) == 0) dst[pos / 8] = 0;
+    if (bit) dst[pos / 8] |= 0x80 >> (pos % 8);
+  }
+
+  static bool Decompress (std::vector<char> &in, std::vector<char> &out)
+  {
+    bz_stream z;
+    memset (&z, 0, sizeof(z));
+    if (BZ2_bzDecompressInit (&z, 0, 0) != BZ_OK) return false;
+
+    z.next_in  = &in[0];
+    z.avail_in = in.size();
+    out.resize (1024*1024);
+    size_t done = 0;
+    int ret;
+    do
+    {
+      if (done == out.size()) out.resize (2 * out.size());
+      z.next_out  = &out[done];
+      z.avail_out = out.size() - done;
+      ret = BZ2_bzDecompress (&z);
+      done = out.size() - z.avail_out;
+    }
+    // Entree epuisee sans fin de flot : bloc tronque
+    while ((ret == BZ_OK) && ((z.avail_in > 0) || (z.avail_out == 0)));
+    BZ2_bzDecompressEnd (&z);
+
+    out.resize (done);
+    return ret == BZ_STREAM_END;
+  }
+
+  // Preparer dans m_decoding les blocs suivants et lancer leur decompression
+  void StartBatch (void)
+  {
+    Job &job = *m_decoding;
+    job.in.resize (m_batch);
+    job.out.resize (m_batch);
+    job.ok.resize (m_batch);
+    job.count = 0;
+    m_used.clear();
+
+    unsigned b = m_nextBound;
+    while (job.count < m_batch)
+    {
+      // Un bloc n'est complet que si la limite qui le suit est connue
+      while ((b + 1 >= m_bounds.size()) && Read()) Scan();
+      if (b + 1 >= m_bounds.size()) break;
+
+      if (m_bounds[b].block)
+      {
+        MakeStream (m_bounds[b].bit, m_bounds[b+1].bit, job.in[job.count]);
+        m_used.push_back (b);
+        ++job.count;
+      }
+      ++b;
+    }
+
+    m_pool.Start (&job, job.count);
+    m_running = true;
+  }
+
+  // Attendre le lot en cours de decompression, qui devient le lot a rendre,
+  // et lancer le suivant
+  bool NextBatch (void)
+  {
+    if (! m_running) StartBatch();
+    m_pool.Wait();
+    m_running = false;
+
+    Job *const done = m_decoding;
+    if (done->count == 0)
+    {
+      if ((m_nextBound < m_bounds.size()) && m_bounds[m_nextBound].block)
+        printf ("bzip2: truncated file\n");
+      return false;
+    }
+
+    for (unsigned i = 0; i < done->count; ++i)
+      if (! done->ok[i])
+      {
+        // Recoller ce bloc a ce qui suit la limite suivante, bloc ou fin de
+        // flot (un magique de l'un ou de l'autre peut etre fortuit), a moins
+        // que le morceau soit deja trop grand pour un vrai bloc : le fichier
+        // est alors abime
+        unsigned const b = m_used[i];
+        while ((b + 2 >= m_bounds.size()) && Read()) Scan();
+        if (   (b + 2 >= m_bounds.size())
+            || (m_bounds[b+2].bit - m_bounds[b].bit > maxBlockBits))
+        {
+          printf ("bzip2: corrupted block at bit %llu\n", (unsigned long long) m_bounds[b].bit);
+          done->count = i;
+          m_eof = true;
+          m_bounds.resize (b + 1);
+          break;
+        }
+        m_bounds.erase (m_bounds.begin() + b + 1);
+        done->count = i;
+        break;
+      }
+
+    // Oublier les blocs rendus
+    if (done->count > 0)
+    {
+      m_nextBound = m_used[done->count - 1] + 1;
+      Compact();
+    }
+    else if (m_eof && (m_nextBound + 1 >= m_bounds.size()))
+      return false;
+
+    m_decoding = m_ready;
+    m_ready = done;
+    m_outIx = m_outPos = 0;
+
+    StartBatch();
+    return true;
+  }
+
+  // Liberer les donnees comprimees des blocs deja decomprimes
+  void Compact (void)
+  {
+    if (m_nextBound == 0) return;
+    uint64_t const keep = (m_nextBound < m_bounds.size())
+                        ? m_bounds[m_nextBound].bit / 8 : m_inBase + m_in.size();
+    if (keep - m_inBase < readSize) return;        // Pas encore rentable
+    m_in.erase (m_in.begin(), m_in.begin() + (keep - m_inBase));
+    m_inBase = keep;
+    m_bounds.erase (m_bounds.begin(), m_bounds.begin() + m_nextBound);
+    m_nextBound = 0;
+  }
+};
+#endif
+
+
+// Le format du fichier est reconnu par ses premiers octets, pas par son nom
 IByteFileReader *NewByteFileReader (const char *filename)
 {
-  int n = strlen(filename);     // ! Ne marcherait pas en UTF-8
+  unsigned char magic[4] = { 0, 0, 0, 0 };
+  FILE *fp = fopen (filename, "rb");
+  if (fp != NULL)
+  {
+    if (fread (magic, 1, sizeof(magic), fp)) {}
+    fclose (fp);
+  }
 
-  while ((n >= 0) && (filename[n] != '.')) --n;
+  if ((magic[0] == 'B') && (magic[1] == 'Z') && (magic[2] == 'h'))
+#ifdef HAS_PTHREAD
+    return new Bz2BlockReader (filename);
+#else
+    return new Bz2Reader (filename);
+#endif
 
-  if (! strcmp(filename+n, ".bz2")) return new Bz2Reader (filename);
+  if ((magic[0] == 0x1F) && (magic[1] == 0x8B))
+    return new GzReader (filename);
 
+  if ((magic[0] == 0x28) && (magic[1] == 0xB5) && (magic[2] == 0x2F) && (magic[3] == 0xFD))
+#ifdef HAS_ZSTD
+    return new ZstdReader (filename);
+#else
+  {
+    printf ("%s: zstd support not compiled (-DHAS_ZSTD)\n", filename);
+    return NULL;
+  }
+#endif
+
+#ifndef WIN32
+  if (MmapReader::Possible (filename))
+    return new MmapReader (filename);
+#endif
   return new PlainReader (filename);
 }
-
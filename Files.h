@@ -8,35 +8,79 @@
 class IByteFileReader
 {
 public:
-  // Taille de lecture. Plus c'est grand, plus -DHAS_THREAD est rentable
+  // Taille de lecture par defaut. Plus c'est grand, plus -DHAS_THREAD est rentable
   // Alloue sur le tas et pas la pile, et temporaire, donc peut etre "assez" grand
   static const size_t maxSize = 256*1024;
-  char buffer[maxSize];                 // Tampon de lecture
+  // Nombre de blocs de l'anneau de lecture asynchrone, par defaut
+  static const unsigned defaultDepth = 4;
+
+  const char *buffer;                   // Donnees lues (dans l'anneau, ou fichier mappe)
   size_t fill;                          // Nombre d'octets presents dans buffer
 
-  // Lire au plus maxSize octets
+  // Lire au plus blockSize() octets
   // + Si fill==0 suite a cela, c'est fini
+  // + Un fichier abime leve "syntaxError" (const char *), ici comme dans
+  //   Async_Feed
   void Feed (void);
 
   // Idem que Feed(), mais fait dans un thread dedie : pendant que l'appelant
   // consomme les donnees recues, ce thread charge les suivantes
-  // Si les pthreads sont indospo, alors est idem que Feed
+  // + Le thread remplit d'avance un anneau de depth() blocs, l'appelant
+  //   recoit dans buffer un pointeur sur le plus ancien (pas de copie). Ce
+  //   bloc lui reste acquis jusqu'a l'appel suivant.
+  // + Ainsi une lecture par rafales (decompression) et un parse par rafales
+  //   se recouvrent, tant que l'anneau n'est ni plein ni vide
+  // + Si les pthreads sont indispo, alors est idem que Feed
+  // + Une exception levee par Feed(b) dans le thread est relevee ici, dans
+  //   le thread appelant, a la place de la fin de fichier
+  // + Ne pas melanger des appels a Feed() et Async_Feed()
   void Async_Feed (void);
 
-#ifdef HAS_PTHREAD
-  IByteFileReader() { pinit = false; } 
-  ~IByteFileReader() { kill(); }
+  // Tout le fichier, s'il est en memoire (mappe) : sinon NULL
+  // + Permet de le parcourir par morceaux dans le desordre, sans Feed()
+  virtual const char *Whole (size_t *size) { *size = 0; return NULL; }
+
+  // Chaque lecteur choisit taille et nombre de blocs qui lui conviennent
+  IByteFileReader (size_t blockSize = maxSize, unsigned depth = defaultDepth);
+  virtual ~IByteFileReader();
+
+  inline size_t blockSize (void) const { return m_blockSize; }
+  inline unsigned depth (void) const { return m_depth; }
+
+protected:
+  // Lecture sans copie : une classe derivee dont les donnees sont deja en
+  // memoire (fichier mappe) positionne m_mapped et les designe par Map(),
+  // appele a la place de Feed(b). Aucun thread n'est alors necessaire.
+  bool m_mapped;
+  virtual size_t Map (const char **b) { *b = NULL; return 0; }
+
+  // Arreter le thread de lecture asynchrone
+  // + A appeler par le destructeur des classes derivees, avant de liberer
+  //   ce qu'emploie leur Feed(b)
+  void kill (void);
+
 private:
+  size_t   m_blockSize;
+  unsigned m_depth;
+  char    *m_ring;                      // depth blocs de blockSize octets
+  size_t  *m_fills;                     // Nombre d'octets de chaque bloc
+  unsigned m_read;                      // Prochain bloc a rendre a l'appelant
+  bool     m_eof;
+  const char *m_error;                  // Levee par Feed(b) dans le thread
+
+  char *Block (unsigned i);
+
+#ifdef HAS_PTHREAD
   pthread_t pt;
-  sem_t sem_feed, sem_filled;
-  bool pinit, m_kill;
-  char backbuffer[maxSize];          // Tampon de lecture ping/pong
-  void kill (void);
+  sem_t sem_free, sem_filled;           // Blocs libres / blocs remplis
+  bool pinit, m_kill, m_held;
 public:
   void entry (void);    // private
 #endif
+
 private:
-  virtual size_t Feed (char *b) = 0;
+  // Lire au plus size octets dans b
+  virtual size_t Feed (char *b, size_t size) = 0;
 };
 
 IByteFileReader *NewByteFileReader (const char *filename);
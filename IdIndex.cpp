@@ -0,0 +1,465 @@
+// Index "id XML" -> "index dans un vector" (cf IIdIndex dans OSM.h)
+//
+// Un OSM regional compte 10^7 Node dont les id, croissants dans le fichier,
+// sont disperses sur 10^10 valeurs. Chaque Way y cherche ses Node, chaque
+// Relation ses membres : c'est l'acces le plus frequent du chargement.
+// + std::map : un noeud alloue par id, ~48 octets, et log2(n) sauts
+//   imprevisibles dans la RAM
+// + Hachage : un acces direct, presque toujours dans une seule ligne de cache
+// + Tableau trie : 12 octets par id, et peu d'acces grace a l'interpolation,
+//   les id etant assez uniformement repartis
+// + Tableau direct : un seul acces et 4 octets par id... de la plage, ce qui
+//   ne convient qu'aux id compacts
+
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "OSM.h"
+
+namespace osm {
+
+static const unsigned noIndex = ~0u;
+
+
+//-----------------------------
+// idMap
+
+class MapIdIndex : public IIdIndex
+{
+public:
+  void set (id_t id, unsigned ix)
+  { m_map[id] = ix; }
+
+  bool insert (id_t id, unsigned ix)
+  { return m_map.insert (std::make_pair (id, ix)).second; }
+
+  int find (id_t id) const
+  {
+    std::map<id_t,unsigned>::const_iterator i = m_map.find (id);
+    return (i == m_map.end()) ? -1 : (int) i->second;
+  }
+
+  void erase (id_t id)
+  { m_map.erase (id); }
+
+  size_t size (void) const
+  { return m_map.size(); }
+
+  // Noeud de l'arbre : la paire, 3 pointeurs et la couleur, arrondi par malloc
+  size_t memory (void) const
+  { return m_map.size() * (sizeof (std::pair<id_t,unsigned>) + 4*sizeof (void *) + 8); }
+
+  void renumber (unsigned first, const std::vector<int> &remap)
+  { renumberMap (m_map, first, remap); }
+
+  static void renumberMap (std::map<id_t,unsigned> &map, unsigned first,
+                           const std::vector<int> &remap);
+
+private:
+  std::map<id_t,unsigned> m_map;
+};
+
+void MapIdIndex::renumberMap (std::map<id_t,unsigned> &map, unsigned first,
+                              const std::vector<int> &remap)
+{
+  std::map<id_t,unsigned>::iterator i = map.begin();
+  while (i != map.end())
+  {
+    if (i->second < first)
+      ++i;
+    else if (remap[i->second - first] < 0)
+      map.erase (i++);
+    else
+    {
+      i->second = remap[i->second - first];
+      ++i;
+    }
+  }
+}
+
+
+//-----------------------------
+// idHash
+// + Sondage lineaire, taux de remplissage <= 1/2
+// + Le retrait decale les places suivantes (pas de place "supprimee")
+
+class HashIdIndex : public IIdIndex
+{
+public:
+  HashIdIndex () : m_count (0) { rehash (1024); }
+
+  void set (id_t id, unsigned ix)
+  {
+    if (2 * (m_count + 1) > m_slots.size()) rehash (2 * m_slots.size());
+    size_t i = home (id);
+    while (m_slots[i].ix != noIndex)
+    {
+      if (m_slots[i].id == id)
+      {
+        m_slots[i].ix = ix;
+        return;
+      }
+      i = (i + 1) & m_mask;
+    }
+    m_slots[i].id = id;
+    m_slots[i].ix = ix;
+    ++m_count;
+  }
+
+  bool insert (id_t id, unsigned ix)
+  {
+    if (2 * (m_count + 1) > m_slots.size()) rehash (2 * m_slots.size());
+    size_t i = home (id);
+    for (; m_slots[i].ix != noIndex; i = (i + 1) & m_mask)
+      if (m_slots[i].id == id) return false;
+    m_slots[i].id = id;
+    m_slots[i].ix = ix;
+    ++m_count;
+    return true;
+  }
+
+  int find (id_t id) const
+  {
+    for (size_t i = home (id); m_slots[i].ix != noIndex; i = (i + 1) & m_mask)
+      if (m_slots[i].id == id) return (int) m_slots[i].ix;
+    return -1;
+  }
+
+  void erase (id_t id);
+
+  size_t size (void) const
+  { return m_count; }
+
+  size_t memory (void) const
+  { return m_slots.capacity() * sizeof (Slot); }
+
+  void renumber (unsigned first, const std::vector<int> &remap);
+
+private:
+  struct Slot
+  {
+    id_t     id;
+    unsigned ix;                // noIndex : place libre
+  };
+  std::vector<Slot> m_slots;
+  size_t m_mask;
+  size_t m_count;
+
+  // Des id consecutifs doivent se disperser : multiplication de Fibonacci
+  inline size_t home (id_t id) const
+  {
+    uint64_t const h = (uint64_t) id * 0x9E3779B97F4A7C15ULL;
+    return (size_t) (h ^ (h >> 29)) & m_mask;
+  }
+
+  void rehash (size_t size);
+};
+
+void HashIdIndex::rehash (size_t size)
+{
+  std::vector<Slot> old;
+  old.swap (m_slots);
+  Slot const empty = { 0, noIndex };
+  m_slots.assign (size, empty);
+  m_mask = size - 1;
+  m_count = 0;
+  for (size_t i = 0; i < old.size(); ++i)
+    if (old[i].ix != noIndex) set (old[i].id, old[i].ix);
+}
+
+void HashIdIndex::erase (id_t id)
+{
+  size_t i = home (id);
+  for (; m_slots[i].ix != noIndex; i = (i + 1) & m_mask)
+    if (m_slots[i].id == id) break;
+  if (m_slots[i].ix == noIndex) return;
+
+  // Ramener dans le trou les places suivantes qui peuvent y etre
+  for (size_t j = (i + 1) & m_mask; m_slots[j].ix != noIndex; j = (j + 1) & m_mask)
+  {
+    size_t const k = home (m_slots[j].id);
+    // k n'est pas dans ]i,j] (circulairement) : j peut aller en i
+    if ((i < j) ? ((k <= i) || (k > j)) : ((k <= i) && (k > j)))
+    {
+      m_slots[i] = m_slots[j];
+      i = j;
+    }
+  }
+  m_slots[i].ix = noIndex;
+  --m_count;
+}
+
+void HashIdIndex::renumber (unsigned first, const std::vector<int> &remap)
+{
+  std::vector<Slot> kept;
+  for (size_t i = 0; i < m_slots.size(); ++i)
+  {
+    Slot s = m_slots[i];
+    if (s.ix == noIndex) continue;
+    if (s.ix >= first)
+    {
+      if (remap[s.ix - first] < 0) continue;
+      s.ix = remap[s.ix - first];
+    }
+    kept.push_back (s);
+  }
+
+  Slot const empty = { 0, noIndex };
+  m_slots.assign (m_slots.size(), empty);
+  m_count = 0;
+  for (size_t i = 0; i < kept.size(); ++i)
+    set (kept[i].id, kept[i].ix);
+}
+
+
+//-----------------------------
+// idSorted
+
+class SortedIdIndex : public IIdIndex
+{
+public:
+  SortedIdIndex () : m_count (0) {}
+
+  void set (id_t id, unsigned ix)
+  {
+    if (m_ids.empty() || (id > m_ids.back()))
+    {
+      m_ids.push_back (id);
+      m_ixs.push_back (ix);
+      ++m_count;
+      return;
+    }
+    long const pos = search (id);
+    if (pos >= 0)
+    {
+      if (m_ixs[pos] == noIndex) ++m_count;
+      m_ixs[pos] = ix;
+    }
+    else
+      m_other[id] = ix;         // En desordre
+  }
+
+  // Un id croissant (le cas courant) est ajoute sans recherche
+  bool insert (id_t id, unsigned ix)
+  {
+    if (! m_ids.empty() && (id <= m_ids.back()) && (find (id) >= 0))
+      return false;
+    set (id, ix);
+    return true;
+  }
+
+  int find (id_t id) const
+  {
+    long const pos = search (id);
+    if (pos >= 0)
+      return (m_ixs[pos] == noIndex) ? -1 : (int) m_ixs[pos];
+    if (m_other.empty()) return -1;
+    std::map<id_t,unsigned>::const_iterator i = m_other.find (id);
+    return (i == m_other.end()) ? -1 : (int) i->second;
+  }
+
+  void erase (id_t id)
+  {
+    long const pos = search (id);
+    if (pos >= 0)
+    {
+      if (m_ixs[pos] != noIndex) --m_count;
+      m_ixs[pos] = noIndex;     // La place reste, pour garder m_ids trie
+    }
+    else
+      m_other.erase (id);
+  }
+
+  size_t size (void) const
+  { return m_count + m_other.size(); }
+
+  size_t memory (void) const
+  {
+    return m_ids.capacity() * sizeof (id_t) + m_ixs.capacity() * sizeof (unsigned) +
+           m_other.size() * (sizeof (std::pair<id_t,unsigned>) + 4*sizeof (void *) + 8);
+  }
+
+  void renumber (unsigned first, const std::vector<int> &remap);
+  void findSorted (const id_t *ids, int *out, size_t n) const;
+
+private:
+  std::vector<id_t>     m_ids;  // Croissants
+  std::vector<unsigned> m_ixs;  // noIndex : retire
+  size_t m_count;               // Places de m_ixs valides
+  std::map<id_t,unsigned> m_other;
+
+  struct IdOf
+  {
+    inline id_t operator() (id_t id) const { return id; }
+  };
+  long search (id_t id) const;
+};
+
+// Position de id dans m_ids, ou -1
+long SortedIdIndex::search (id_t id) const
+{
+  if (m_ids.empty()) return -1;
+  return interpolationSearch (&m_ids[0], m_ids.size(), id, IdOf());
+}
+
+// Fusion : chaque id est cherche a partir de la position du precedent, par
+// pas doubles puis dichotomie (quelques acces voisins si les id sont denses)
+void SortedIdIndex::findSorted (const id_t *ids, int *out, size_t n) const
+{
+  size_t const size = m_ids.size();
+  size_t pos = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    id_t const id = ids[i];
+    if ((pos < size) && (m_ids[pos] < id))
+    {
+      size_t step = 1;
+      while ((pos + step < size) && (m_ids[pos + step] < id)) step *= 2;
+      size_t const end = (pos + step < size) ? pos + step + 1 : size;
+      pos = std::lower_bound (m_ids.begin() + pos + step/2, m_ids.begin() + end, id)
+            - m_ids.begin();
+    }
+
+    if ((pos < size) && (m_ids[pos] == id))
+      out[i] = (m_ixs[pos] == noIndex) ? -1 : (int) m_ixs[pos];
+    else if (m_other.empty())
+      out[i] = -1;
+    else
+    {
+      std::map<id_t,unsigned>::const_iterator j = m_other.find (id);
+      out[i] = (j == m_other.end()) ? -1 : (int) j->second;
+    }
+  }
+}
+
+void SortedIdIndex::renumber (unsigned first, const std::vector<int> &remap)
+{
+  for (size_t i = 0; i < m_ixs.size(); ++i)
+    if ((m_ixs[i] != noIndex) && (m_ixs[i] >= first))
+    {
+      int const ix = remap[m_ixs[i] - first];
+      if (ix < 0) --m_count;
+      m_ixs[i] = (ix < 0) ? noIndex : (unsigned) ix;
+    }
+  MapIdIndex::renumberMap (m_other, first, remap);
+}
+
+
+//-----------------------------
+// idDense
+// + La plage commence au premier id ajoute, et ne s'etend que tant qu'elle
+//   reste a moins de 8 places par id present (ou 64K places)
+
+class DenseIdIndex : public IIdIndex
+{
+public:
+  DenseIdIndex () : m_base (0), m_count (0) {}
+
+  void set (id_t id, unsigned ix)
+  {
+    if (m_table.empty() && (m_count == 0)) m_base = id;
+    if ((id >= m_base) && (id - m_base >= m_table.size()))
+      grow (id - m_base + 1);
+    if ((id >= m_base) && (id - m_base < m_table.size()))
+    {
+      unsigned &slot = m_table[id - m_base];
+      if (slot == noIndex) ++m_count;
+      slot = ix;
+    }
+    else
+      m_other[id] = ix;
+  }
+
+  int find (id_t id) const
+  {
+    if ((id >= m_base) && (id - m_base < m_table.size()))
+    {
+      unsigned const ix = m_table[id - m_base];
+      return (ix == noIndex) ? -1 : (int) ix;
+    }
+    if (m_other.empty()) return -1;
+    std::map<id_t,unsigned>::const_iterator i = m_other.find (id);
+    return (i == m_other.end()) ? -1 : (int) i->second;
+  }
+
+  void erase (id_t id)
+  {
+    if ((id >= m_base) && (id - m_base < m_table.size()))
+    {
+      if (m_table[id - m_base] != noIndex) --m_count;
+      m_table[id - m_base] = noIndex;
+    }
+    else
+      m_other.erase (id);
+  }
+
+  size_t size (void) const
+  { return m_count + m_other.size(); }
+
+  size_t memory (void) const
+  {
+    return m_table.capacity() * sizeof (unsigned) +
+           m_other.size() * (sizeof (std::pair<id_t,unsigned>) + 4*sizeof (void *) + 8);
+  }
+
+  void renumber (unsigned first, const std::vector<int> &remap);
+
+private:
+  id_t m_base;
+  std::vector<unsigned> m_table;  // noIndex : absent
+  size_t m_count;                 // Places de m_table valides
+  std::map<id_t,unsigned> m_other;
+
+  void grow (uint64_t need);
+};
+
+void DenseIdIndex::grow (uint64_t need)
+{
+  uint64_t const limit = 8 * (uint64_t) m_count + (1u << 16);
+  if (need > limit) return;
+
+  uint64_t size = 2 * (uint64_t) m_table.size();
+  if (size < need) size = need;
+  if (size > limit) size = limit;
+  m_table.resize ((size_t) size, noIndex);
+
+  // Les id de m_other maintenant dans la plage y sont ramenes
+  std::map<id_t,unsigned>::iterator i = m_other.lower_bound (m_base);
+  while ((i != m_other.end()) && (i->first - m_base < m_table.size()))
+  {
+    m_table[i->first - m_base] = i->second;
+    ++m_count;
+    m_other.erase (i++);
+  }
+}
+
+void DenseIdIndex::renumber (unsigned first, const std::vector<int> &remap)
+{
+  for (size_t i = 0; i < m_table.size(); ++i)
+    if ((m_table[i] != noIndex) && (m_table[i] >= first))
+    {
+      int const ix = remap[m_table[i] - first];
+      if (ix < 0) --m_count;
+      m_table[i] = (ix < 0) ? noIndex : (unsigned) ix;
+    }
+  MapIdIndex::renumberMap (m_other, first, remap);
+}
+
+
+//-----------------------------
+
+IIdIndex *NewIdIndex (idIndexKind kind)
+{
+  switch (kind)
+  {
+    case idMap    : return new MapIdIndex;
+    case idHash   : return new HashIdIndex;
+    case idSorted : return new SortedIdIndex;
+    case idDense  : return new DenseIdIndex;
+  }
+  throw "ProgramError";
+}
+
+}  // namespace osm
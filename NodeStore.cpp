@@ -0,0 +1,304 @@
+// Positions des Node dans un fichier mappe (cf INodeStore dans OSM.h)
+//
+// Un Node en RAM coute au moins 32 octets plus son entree d'index, pour
+// souvent ne servir qu'a donner sa position a un Way. Le README note que
+// Maperitive meurt a 10M Node : un pays ou le planet ne tiennent pas en RAM.
+// Ici la position est ecrite dans un fichier mappe par mmap(MAP_SHARED) :
+// le noyau en garde en RAM ce qu'il peut, le reste est sur le disque.
+// + Le fichier grossit par doublement (ftruncate puis nouveau mmap)
+// + Sans mmap (WIN32), les donnees restent en RAM et ne sont pas conservees
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "OSM.h"
+
+namespace osm {
+
+// Fichier mappe en lecture/ecriture, agrandi a la demande
+class MappedFile
+{
+public:
+  char *base;
+  size_t size;
+
+  // random : acces au hasard, sans lecture en avance
+  MappedFile (bool random = false) : base (NULL), size (0), m_random (random), m_fd (-1) {}
+
+  ~MappedFile ()
+  {
+#ifndef WIN32
+    if (base != NULL) munmap (base, size);
+    if (m_fd >= 0) close (m_fd);
+#else
+    free (base);
+#endif
+  }
+
+  bool Open (const char *filename)
+  {
+#ifndef WIN32
+    if (filename != NULL)
+      m_fd = open (filename, O_RDWR | O_CREAT, 0644);
+    else
+    {
+      // Fichier sans nom, detruit a sa fermeture
+      FILE *tmp = tmpfile();
+      if (tmp != NULL)
+      {
+        m_fd = dup (fileno (tmp));
+        fclose (tmp);
+      }
+    }
+    if (m_fd < 0)
+    {
+      if (filename != NULL) perror (filename);
+      return false;
+    }
+    struct stat st;
+    if ((fstat (m_fd, &st) == 0) && (st.st_size > 0))
+      return Map (st.st_size);
+#endif
+    return true;
+  }
+
+  // Au moins need octets, les nouveaux a zero
+  bool Grow (size_t need)
+  {
+    if (need <= size) return true;
+    size_t n = 2 * size;
+    if (n < need) n = need;
+    if (n < minSize) n = minSize;
+    n = (n + minSize - 1) / minSize * minSize;
+#ifndef WIN32
+    if (ftruncate (m_fd, n) != 0)
+    {
+      perror ("ftruncate");
+      return false;
+    }
+    return Map (n);
+#else
+    char *p = (char *) realloc (base, n);
+    if (p == NULL) return false;
+    memset (p + size, 0, n - size);
+    base = p;
+    size = n;
+    return true;
+#endif
+  }
+
+private:
+  static const size_t minSize = 1u << 20;
+  bool m_random;
+  int m_fd;
+
+#ifndef WIN32
+  bool Map (size_t n)
+  {
+    if (base != NULL) munmap (base, size);
+    void *p = mmap (NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (p == MAP_FAILED)
+    {
+      perror ("mmap");
+      base = NULL;
+      size = 0;
+      return false;
+    }
+    base = (char *) p;
+    size = n;
+    if (m_random) madvise (p, n, MADV_RANDOM);
+    return true;
+  }
+#endif
+};
+
+
+//-----------------------------
+// storeDense
+// + La latitude est rangee avec son bit de signe inverse : jamais nulle
+//   (|lat| <= 90 degres), un LatLon nul est donc une place libre
+
+class DenseNodeStore : public INodeStore
+{
+public:
+  DenseNodeStore () : m_file (true) {}
+
+  bool Open (const char *filename)
+  { return m_file.Open (filename); }
+
+  void set (id_t id, const LatLon &pos)
+  {
+    uint64_t const n = (uint64_t) id;
+    if ((n >= maxId) || (n >= ((size_t) -1) / sizeof (LatLon) - 1) ||
+        ! m_file.Grow ((size_t) (n + 1) * sizeof (LatLon)))
+    {
+      m_other[id] = pos;
+      return;
+    }
+    LatLon &slot = ((LatLon *) m_file.base)[n];
+    slot.lat = pos.lat ^ signBit;
+    slot.lon = pos.lon;
+  }
+
+  bool get (id_t id, LatLon &pos) const
+  {
+    uint64_t const n = (uint64_t) id;
+    if (n < m_file.size / sizeof (LatLon))
+    {
+      const LatLon &slot = ((const LatLon *) m_file.base)[n];
+      if (slot.lat == 0) return false;
+      pos.lat = slot.lat ^ signBit;
+      pos.lon = slot.lon;
+      return true;
+    }
+    std::map<id_t,LatLon>::const_iterator i = m_other.find (id);
+    if (i == m_other.end()) return false;
+    pos = i->second;
+    return true;
+  }
+
+private:
+  static const uint64_t maxId = (uint64_t) 1 << 40;
+  static const latlon_t signBit = (latlon_t) 0x80000000;
+
+  MappedFile m_file;
+  std::map<id_t,LatLon> m_other;
+};
+
+
+//-----------------------------
+// storeSparse
+// + Le premier enregistrement est l'en-tete : magic, nombre de Node
+// + Un id deja present est mis a jour en place
+
+class SparseNodeStore : public INodeStore
+{
+public:
+  SparseNodeStore () : m_count (0) {}
+
+  bool Open (const char *filename)
+  {
+    if (! m_file.Open (filename) || ! m_file.Grow (sizeof (Record))) return false;
+    Record *head = (Record *) m_file.base;
+    if (head->id != magic)
+    {
+      head->id = magic;
+      setCount (0);
+    }
+    m_count = count();
+    return true;
+  }
+
+  void set (id_t id, const LatLon &pos)
+  {
+    Record *const r = records();
+    if ((m_count == 0) || (id > r[m_count - 1].id))
+    {
+      if (m_file.Grow ((m_count + 2) * sizeof (Record)))
+      {
+        Record &rec = records()[m_count];
+        rec.id  = id;
+        rec.pos = pos;
+        setCount (++m_count);
+        return;
+      }
+    }
+    else
+    {
+      long const k = search (id);
+      if (k >= 0)
+      {
+        r[k].pos = pos;
+        return;
+      }
+    }
+    m_other[id] = pos;          // En desordre
+  }
+
+  bool get (id_t id, LatLon &pos) const
+  {
+    long const k = search (id);
+    if (k >= 0)
+    {
+      pos = records()[k].pos;
+      return true;
+    }
+    if (m_other.empty()) return false;
+    std::map<id_t,LatLon>::const_iterator i = m_other.find (id);
+    if (i == m_other.end()) return false;
+    pos = i->second;
+    return true;
+  }
+
+private:
+  struct Record
+  {
+    id_t   id;
+    LatLon pos;
+  };
+  static const id_t magic = (id_t) 0x4F534D4E53544F31ULL; // "OSMNSTO1"
+
+  MappedFile m_file;
+  size_t m_count;
+  std::map<id_t,LatLon> m_other;
+
+  inline Record *records (void) const
+  { return (Record *) m_file.base + 1; }
+
+  // Le nombre est dans la place de la position de l'en-tete
+  inline size_t count (void) const
+  {
+    uint64_t n;
+    memcpy (&n, &((Record *) m_file.base)->pos, sizeof (n));
+    return (size_t) n;
+  }
+  inline void setCount (uint64_t n)
+  { memcpy (&((Record *) m_file.base)->pos, &n, sizeof (n)); }
+
+  struct IdOf
+  {
+    inline id_t operator() (const Record &r) const { return r.id; }
+  };
+  long search (id_t id) const;
+};
+
+// Position de id, ou -1
+long SparseNodeStore::search (id_t id) const
+{
+  return interpolationSearch (records(), m_count, id, IdOf());
+}
+
+
+//-----------------------------
+
+INodeStore *NewNodeStore (nodeStoreKind kind, const char *filename)
+{
+  switch (kind)
+  {
+    case storeDense :
+    {
+      DenseNodeStore *s = new DenseNodeStore;
+      if (s->Open (filename)) return s;
+      delete s;
+      return NULL;
+    }
+    case storeSparse :
+    {
+      SparseNodeStore *s = new SparseNodeStore;
+      if (s->Open (filename)) return s;
+      delete s;
+      return NULL;
+    }
+  }
+  throw "ProgramError";
+}
+
+}  // namespace osm
@@ -1,11 +1,18 @@
 #include <stdio.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 #include <string.h>             // Works for UTF-8 (strdup, strcpy, etc)
 //#include <assert.h>
+#include <algorithm>
 
 #include "OSM.h"
 
 #include "Files.h"
+#include "Decode.h"
+#include "Workers.h"
 
 // On peut ne pas verifier la syntaxe, ce qui permet de gagner du temps d'exec
 // dans une lecture de fichier. Par contre s'il contient des erreurs, le donnees
@@ -22,202 +29,1195 @@ namespace osm {
 
 //-----------------------------
 // Donnees globales a tous les objets OSM
-//
-// TODO: A mettre static dans la classe OSMData ?
-
-Tags nilTags;   // Always empty
 
-#if 0
-char *commonTagStr[(int) tagCommonCount] =
+const char *const commonTagStr[(int) tagCommonCount] =
 {
   "",                           // tagNil = 0,
+  "name",                       // tagName,
+  "ref",                        // tagRef,
+  "type",                       // tagType,
+  "layer",                      // tagLayer,
+  "level",                      // tagLevel,
+  "area",                       // tagArea,
+  "oneway",                     // tagOneway,
+  "bridge",                     // tagBridge,
+  "tunnel",                     // tagTunnel,
+  "lanes",                      // tagLanes,
+  "maxspeed",                   // tagMaxspeed,
+  "surface",                    // tagSurface,
+  "access",                     // tagAccess,
+  "width",                      // tagWidth,
+  "height",                     // tagHeight,
+  "building:levels",            // tagBuildingLevels,
+  "ele",                        // tagEle,
+  "admin_level",                // tagAdminLevel,
+  "population",                 // tagPopulation,
+  "operator",                   // tagOperator,
+  "source",                     // tagSource,
+  "note",                       // tagNote,
+  "wikipedia",                  // tagWikipedia,
+  "wikidata",                   // tagWikidata,
+  "addr:housenumber",           // tagAddrHousenumber,
+  "addr:street",                // tagAddrStreet,
+  "addr:postcode",              // tagAddrPostcode,
+  "addr:city",                  // tagAddrCity,
+  "aerialway",                  // tagAerialway,
+  "aeroway",                    // tagAeroway,
+  "amenity",                    // tagAmenity,
+  "barrier",                    // tagBarrier,
+  "boundary",                   // tagBoundary,
+  "building",                   // tagBuilding,
+  "craft",                      // tagCraft,
+  "emergency",                  // tagEmergency,
   "highway",                    // tagHighway,
+  "historic",                   // tagHistoric,
+  "landuse",                    // tagLanduse,
+  "leisure",                    // tagLeisure,
+  "man_made",                   // tagManMade,
+  "military",                   // tagMilitary,
+  "natural",                    // tagNatural,
+  "office",                     // tagOffice,
+  "place",                      // tagPlace,
+  "power",                      // tagPower,
+  "public_transport",           // tagPublicTransport,
+  "railway",                    // tagRailway,
+  "route",                      // tagRoute,
+  "shop",                       // tagShop,
+  "sport",                      // tagSport,
+  "tourism",                    // tagTourism,
+  "water",                      // tagWater,
+  "waterway",                   // tagWaterway,
+  "yes",                        // tagYes,
+  "no",                         // tagNo,
   "motorway",                   // tagMotorway,
-  "motorway-link",              // tagMotorwayLink,
+  "motorway_link",              // tagMotorwayLink,
   "trunk",                      // tagTrunk,
-  "trunk-link",                 // tagTrunkLink,
+  "trunk_link",                 // tagTrunkLink,
   "primary",                    // tagPrimary,
-  "primary-link",               // tagPrimaryLink,
-  "traffic-calming",            // tagTrafficCalming,
+  "primary_link",               // tagPrimaryLink,
+  "secondary",                  // tagSecondary,
+  "secondary_link",             // tagSecondaryLink,
+  "tertiary",                   // tagTertiary,
+  "tertiary_link",              // tagTertiaryLink,
+  "unclassified",               // tagUnclassified,
+  "residential",                // tagResidential,
+  "living_street",              // tagLivingStreet,
   "service",                    // tagService,
-  "boundary",                   // tagBoundary,
+  "track",                      // tagTrack,
+  "pedestrian",                 // tagPedestrian,
+  "footway",                    // tagFootway,
+  "cycleway",                   // tagCycleway,
+  "path",                       // tagPath,
+  "steps",                      // tagSteps,
+  "traffic_calming",            // tagTrafficCalming,
+  "rail",                       // tagRail,
+  "light_rail",                 // tagLightRail,
+  "subway",                     // tagSubway,
+  "tram",                       // tagTram,
+  "abandoned",                  // tagAbandoned,
+  "river",                      // tagRiver,
+  "stream",                     // tagStream,
+  "canal",                      // tagCanal,
+  "ditch",                      // tagDitch,
+  "drain",                      // tagDrain,
+  "riverbank",                  // tagRiverbank,
+  "coastline",                  // tagCoastline,
+  "wood",                       // tagWood,
+  "forest",                     // tagForest,
+  "scrub",                      // tagScrub,
+  "grassland",                  // tagGrassland,
+  "tree",                       // tagTree,
+  "farmland",                   // tagFarmland,
+  "meadow",                     // tagMeadow,
+  "grass",                      // tagGrass,
+  "industrial",                 // tagIndustrial,
+  "commercial",                 // tagCommercial,
+  "retail",                     // tagRetail,
+  "cemetery",                   // tagCemetery,
+  "park",                       // tagPark,
+  "garden",                     // tagGarden,
+  "pitch",                      // tagPitch,
+  "parking",                    // tagParking,
+  "school",                     // tagSchool,
+  "place_of_worship",           // tagPlaceOfWorship,
+  "restaurant",                 // tagRestaurant,
+  "house",                      // tagHouse,
+  "apartments",                 // tagApartments,
+  "garage",                     // tagGarage,
   "administrative",             // tagAdministrative,
   "civil",                      // tagCivil,
   "political",                  // tagPolitical,
   "maritime",                   // tagMaritime,
+  "country",                    // tagCountry,
+  "state",                      // tagState,
+  "city",                       // tagCity,
+  "town",                       // tagTown,
+  "village",                    // tagVillage,
+  "hamlet",                     // tagHamlet,
+  "suburb",                     // tagSuburb,
+  "locality",                   // tagLocality,
+  "aerodrome",                  // tagAerodrome,
+  "multipolygon",               // tagMultipolygon,
+  "asphalt",                    // tagAsphalt,
+  "unpaved",                    // tagUnpaved,
 };
-#endif
 
 // Liste des chaines decouvertes
-// Associe une map et un vector pour memoriser les chaines vues dans les tags "key=value"
-// afin de ce memoriser chaque chaine qu'une seule fois (partage)
+// Memorise une seule fois chaque chaine vue dans les tags "key=value"
+// (partage), et lui associe son atome
 //
 // + Avec ceci au lieu de strdup() systematiques, la RAM du process lors
 //   du chargement de "rhone-alpes.osm" (2.4Go) economise 320Mo.
 //   (1.092Go au lieu de 1.413Go)
 //   Le temps de chargement passe de 61s a 65s
-//
-// TODO: Allouer des blocs de RAM et inserer les chaines dedans plutot que strdup() ou new string ?
-
+// + C'etait alors une std::map, et un strdup() par chaine. C'est maintenant
+//   une table de hachage ouverte (sondage lineaire) vers les atomes, et les
+//   chaines sont copiees les unes a la suite des autres dans des blocs
+// + Les commonTag y sont places a la construction, sans copie : ce sont les
+//   atomes 0 a tagCommonCount-1
 class StringStock
 {
 public:
-  inline const char *FindOrAdd (const char *str)
+  StringStock ();
+  ~StringStock ();
+
+  atom_t FindOrAdd (const char *str);
+
+  // tagNil si absent
+  atom_t Find (const char *str) const;
+
+  // Ajouter des chaines sans les copier (cf mapAtoms)
+  bool Map (const char *strings, unsigned count);
+
+  inline unsigned Count (void) const
+  { return mStrings.size(); }
+
+  inline const char *Str (atom_t atom) const
+  { return mStrings[atom]; }
+
+  // Octets occupes (environ)
+  inline size_t Memory (void) const
   {
-     const char *n;
-     map_t::const_iterator i = mMap.find(str);
-     if (i == mMap.end())
-     {
-       n = strdup (str);                // TODO: comment tracer free ?
-       mVector.push_back (n);
-       mMap[n] = mVector.size()-1;
-     }
-     else
-       n = (*i).first;
-     return n;
+    return mBlocks.size() * blockSize + mStrings.capacity() * sizeof (const char *) +
+           mHashes.capacity() * sizeof (uint32_t) + mSlots.capacity() * sizeof (atom_t);
   }
 
 private:
-  struct less_str : public std::binary_function<char *, char *, bool>
+  static const atom_t  emptySlot = ~(atom_t) 0;
+  static const size_t  blockSize = 64 * 1024;
+
+  // FNV-1a, et la longueur de str au passage
+  static inline uint32_t Hash (const char *str, size_t &len)
   {
-    bool operator() (const char * x, const char * y) const
-    { return strcmp (x, y) < 0; }
-  };
+    uint32_t h = 2166136261u;
+    const char *p = str;
+    for (; *p; ++p) h = (h ^ (unsigned char) *p) * 16777619u;
+    len = p - str;
+    return h;
+  }
 
-  typedef std::map<const char *, int, less_str> map_t;
-  std::vector<const char *> mVector;
-  map_t mMap;
+  // Case de mSlots ou est str, ou la case libre ou la mettre
+  inline uint32_t Slot (const char *str, uint32_t hash) const
+  {
+    uint32_t const mask = mSlots.size() - 1;
+    for (uint32_t s = hash & mask; ; s = (s + 1) & mask)
+    {
+      atom_t const a = mSlots[s];
+      if ((a == emptySlot) ||
+          ((mHashes[a] == hash) && ! strcmp (mStrings[a], str)))
+        return s;
+    }
+  }
+
+  atom_t Add (uint32_t slot, const char *str, uint32_t hash);
+  const char *Copy (const char *str, size_t len);
+  void Grow (void);
+
+  std::vector<const char *> mStrings;   // Chaine de chaque atome
+  std::vector<uint32_t> mHashes;        // Hash de chaque atome (cf Grow)
+  std::vector<atom_t> mSlots;           // Taille puissance de 2, moitie vide au plus
+  std::vector<char *> mBlocks;          // Rendus par le destructeur
+  char *mFree;                          // Reste du dernier bloc
+  size_t mLeft;
 };
 
-static StringStock globalStringStock;
+const atom_t StringStock::emptySlot;
+const size_t StringStock::blockSize;
+
+StringStock::StringStock ()
+  : mSlots (1024, emptySlot), mFree(NULL), mLeft(0)
+{
+  mStrings.reserve (tagCommonCount);
+  mHashes.reserve (tagCommonCount);
+  for (unsigned i = 0; i < (unsigned) tagCommonCount; ++i)
+  {
+    size_t len;
+    uint32_t const h = Hash (commonTagStr[i], len);
+    Add (Slot (commonTagStr[i], h), commonTagStr[i], h);
+  }
+}
+
+StringStock::~StringStock ()
+{
+  for (size_t i = 0; i < mBlocks.size(); ++i)
+    free (mBlocks[i]);
+}
+
+atom_t StringStock::FindOrAdd (const char *str)
+{
+  size_t len;
+  uint32_t const h = Hash (str, len);
+  uint32_t const s = Slot (str, h);
+  if (mSlots[s] != emptySlot) return mSlots[s];
+  return Add (s, Copy (str, len), h);
+}
+
+atom_t StringStock::Find (const char *str) const
+{
+  size_t len;
+  uint32_t const h = Hash (str, len);
+  atom_t const a = mSlots[Slot (str, h)];
+  return (a == emptySlot) ? (atom_t) tagNil : a;
+}
+
+atom_t StringStock::Add (uint32_t slot, const char *str, uint32_t hash)
+{
+  atom_t const a = mStrings.size();
+  mStrings.push_back (str);
+  mHashes.push_back (hash);
+  mSlots[slot] = a;
+  if (2 * mStrings.size() > mSlots.size()) Grow();
+  return a;
+}
+
+const char *StringStock::Copy (const char *str, size_t len)
+{
+  if (len + 1 > mLeft)
+  {
+    // Le reste du bloc courant est perdu
+    mLeft = (len + 1 > blockSize) ? len + 1 : blockSize;
+    mFree = (char *) malloc (mLeft);
+    if (mFree == NULL) throw "ProgramError";
+    mBlocks.push_back (mFree);
+  }
+  char *const n = mFree;
+  memcpy (n, str, len + 1);
+  mFree += len + 1;
+  mLeft -= len + 1;
+  return n;
+}
+
+bool StringStock::Map (const char *strings, unsigned count)
+{
+  if (mStrings.size() != (unsigned) tagCommonCount) return false;
+  mStrings.reserve (mStrings.size() + count);
+  mHashes.reserve (mHashes.size() + count);
+  for (unsigned i = 0; i < count; ++i)
+  {
+    size_t len;
+    uint32_t const h = Hash (strings, len);
+    Add (Slot (strings, h), strings, h);
+    strings += len + 1;
+  }
+  return true;
+}
+
+void StringStock::Grow (void)
+{
+  mSlots.assign (2 * mSlots.size(), emptySlot);
+  uint32_t const mask = mSlots.size() - 1;
+  for (atom_t a = 0; a < mStrings.size(); ++a)
+  {
+    uint32_t s = mHashes[a] & mask;
+    while (mSlots[s] != emptySlot) s = (s + 1) & mask;
+    mSlots[s] = a;
+  }
+}
+
+// Les seuls commonTag, jamais modifies : lus par plusieurs threads
+static const StringStock commonStock;
+
+atom_t findCommonTag (const char *str)
+{
+  return commonStock.Find (str);
+}
+
+
+//-----------------------------
+// TagArena
+
+TagArena::TagArena ()
+  : m_strings (new StringStock), m_mapped (NULL), m_mappedSize (0)
+{
+}
+
+TagArena::~TagArena ()
+{
+  delete m_strings;
+  if (m_mapped == NULL) return;
+#ifndef WIN32
+  munmap ((void *) m_mapped, m_mappedSize);
+#else
+  free ((void *) m_mapped);
+#endif
+}
+
+atom_t TagArena::addAtom (const char *str)
+{
+  return m_strings->FindOrAdd (str);
+}
+
+atom_t TagArena::findAtom (const char *str) const
+{
+  return m_strings->Find (str);
+}
+
+const char *TagArena::atomString (atom_t atom) const
+{
+  return m_strings->Str (atom);
+}
+
+unsigned TagArena::atomCount (void) const
+{
+  return m_strings->Count();
+}
+
+bool TagArena::mapAtoms (const char *strings, unsigned count)
+{
+  return m_strings->Map (strings, count);
+}
+
+void TagArena::adopt (const char *base, size_t size)
+{
+  if (m_mapped != NULL) throw "ProgramError";
+  m_mapped = base;
+  m_mappedSize = size;
+}
+
+size_t TagArena::memory (void) const
+{
+  return pairs.memory() + m_strings->Memory();
+}
+
+
+//-----------------------------
+// Tags
+
+const char *Tags::get (const char *key) const
+{
+  if (m_count == 0) return NULL;
+  atom_t const v = findTag (m_arena->findAtom (key));
+  return (v == tagNil) ? NULL : str (v);
+}
+
+const char *Tags::name (void) const
+{
+  atom_t const v = findTag (tagName);
+  return (v == tagNil) ? NULL : str (v);
+}
+
+int Tags::layer (void) const
+{
+  // la valeur de layer est censee entre dans [-5,5], on en verifie pas
+  atom_t const v = findTag (tagLayer);
+  return (v == tagNil) ? 0 : (char) atoi (str (v));
+}
+
+// + Des places sont parfois notees highway=footway en plus de area=yes,
+//   on prend donc building en premier
+Tags::Kind Tags::kind (void) const
+{
+  if (m_count == 0) return unknown;
+//if (findTag (tagArea)     != tagNil) return area;
+  if (findTag (tagBuilding) != tagNil) return building;
+  if (findTag (tagHighway)  != tagNil) return highway;
+  if (findTag (tagRailway)  != tagNil) return railway;
+  if (findTag (tagWaterway) != tagNil) return waterway;
+  return unknown;
+}
+
+// Nombre en tete de str, suivi d'une unite eventuelle. false si pas de nombre
+static bool decodeNumber (const char *str, double &num, const char *&unit)
+{
+  char *end;
+  num = strtod (str, &end);
+  if ((end == str) || (num < 0.0)) return false;
+  while (*end == ' ') ++end;
+  unit = end;
+  return true;
+}
+
+static uint8_t clampByte (double num, unsigned max)
+{
+  return (num + 0.5 >= max) ? max : (uint8_t) (num + 0.5);
+}
+
+// Decoder value si key est un tag de TagValues
+// + Une valeur non comprise laisse le tag "absent" (0)
+void decodeValue (TagValues &values, atom_t key, const char *value)
+{
+  double num;
+  const char *unit;
+  switch (key)
+  {
+    case tagHeight :            // "12", "12.5 m", "40'", "40 ft"
+      if (! decodeNumber (value, num, unit)) break;
+      if ((*unit == '\'') || ! strncmp (unit, "ft", 2)) num *= 0.3048;
+      num *= 10.0;
+      values.height = (num + 0.5 >= 65535.0) ? 65535 : (uint16_t) (num + 0.5);
+      break;
+
+    case tagBuildingLevels :
+      if (decodeNumber (value, num, unit)) values.levels = clampByte (num, 254);
+      break;
+
+    case tagMaxspeed :          // "50", "30 mph", "none"
+      if (! strcmp (value, "none"))
+        values.maxspeed = TagValues::maxspeedNone;
+      else if (decodeNumber (value, num, unit))
+      {
+        if (! strncmp (unit, "mph", 3)) num *= 1.609344;
+        values.maxspeed = clampByte (num, 254);
+      }
+      break;
+
+    case tagLanes :             // "2", "2;3" ...
+      if (decodeNumber (value, num, unit)) values.lanes = clampByte (num, 254);
+      break;
+
+    case tagOneway :
+      if (! strcmp (value, "yes") || ! strcmp (value, "true") || ! strcmp (value, "1"))
+        values.oneway = 1;
+      else if (! strcmp (value, "-1") || ! strcmp (value, "reverse"))
+        values.oneway = -1;
+      break;
+
+    case tagArea :
+      if (! strcmp (value, "yes")) values.area = 1;
+      else if (! strcmp (value, "no")) values.area = -1;
+      break;
+  }
+}
 
 
 
 // NB: Les exceptions passent-elles a travers ceci ?
+// + T est OSMData, ou OSMData::ClipScan
 
+template<class T>
 static void XMLCALL C_startElementHandler
     (void *userData,
      const XML_Char *name,
      const XML_Char **atts)
 {
-  ((OSMData *) userData)->startElementHandler (name, atts);
+  ((T *) userData)->startElementHandler (name, atts);
 }
 
+template<class T>
 static void XMLCALL C_endElementHandler
     (void *userData,
      const XML_Char *name)
 {
-  ((OSMData *) userData)->endElementHandler (name);
+  ((T *) userData)->endElementHandler (name);
 }
 
 
 
-OSMData::OSMData()
+OSMDataCommon::OSMDataCommon()
+{
+  m_xmlParser = xmlExpat;
+  m_clipMode = clipNodes;
+  m_zoom = maxZoom;
+  m_refMode = refsImmediate;
+  m_wayStorage = waysPlain;
+  m_filebound.close();
+}
+
+template<class Cfg>
+BasicOSMData<Cfg>::BasicOSMData()
+  : m_nodes (m_tagArena)
 {
   m_parser  = NULL;
+  m_clipping = false;
+  m_keepNodes = m_keepWays = m_keepRelations = NULL;
+  m_npending = 0;
+  m_zooming = false;
+  m_deferring = false;
+  m_nodeStore = NULL;
+  m_nodeTags.first = m_nodeTags.count = 0;
+  m_indexPending = false;
+  m_idnodes     = NewIdIndex (idSorted);
+  m_idways      = NewIdIndex (idSorted);
+  m_idrelations = NewIdIndex (idSorted);
 
   // Optimiser les petits fichiers ... ce qui n'est pas la vocation ici
   m_nodes.reserve (10000);
   m_ways.reserve (2000);
   m_relations.reserve (1000);
-  m_filebound.close();
 }
 
-OSMData::~OSMData()
+template<class Cfg>
+BasicOSMData<Cfg>::~BasicOSMData()
 {
   if (m_parser != NULL) XML_ParserFree(m_parser);
+  delete m_idnodes;
+  delete m_idways;
+  delete m_idrelations;
 }
 
-void OSMData::LoadText (const char *filename)
+template<class Cfg>
+void BasicOSMData<Cfg>::SetIdIndex (idIndexKind kind)
+{
+  if (m_idnodes->size() + m_idways->size() + m_idrelations->size() != 0)
+    throw "ProgramError";
+  delete m_idnodes;
+  delete m_idways;
+  delete m_idrelations;
+  m_idnodes     = NewIdIndex (kind);
+  m_idways      = NewIdIndex (kind);
+  m_idrelations = NewIdIndex (kind);
+}
+
+template<class Cfg>
+void BasicOSMData<Cfg>::LoadText (const char *filename)
 {
   LatLonBox clip;
   clip.open();                  // Pas de restriction
   LoadText (filename, clip);
 }
 
-void OSMData::LoadText (const char *filename, LatLonBox &clip)
+template<class Cfg>
+void BasicOSMData<Cfg>::LoadText (const char *filename, LatLonBox &clip)
+{
+  ReserveFor (fileSize (filename), xmlBytesPerNode);
+  if (clip.isOpen())
+  {
+    StartLoad();
+    ParseText (filename, *this);
+    EndLoad();
+    return;
+  }
+
+  if (m_clipMode == clipNodes)
+  {
+    m_clip = clip;
+    m_clipping = true;
+    StartLoad();
+    try
+    {
+      ParseText (filename, *this);
+    }
+    catch (...)
+    {
+      m_clipping = false;
+      throw;
+    }
+    m_clipping = false;
+    EndLoad();
+    return;
+  }
+
+  // clipCompleteWays : noter ce qu'il faut garder, puis le charger
+  ClipScan scan (clip);
+  ParseText (filename, scan);
+
+  StartLoad();
+  m_keepNodes     = &scan.nodes;
+  m_keepWays      = &scan.ways;
+  m_keepRelations = &scan.relations;
+  try
+  {
+    ParseText (filename, *this);
+  }
+  catch (...)
+  {
+    m_keepNodes = m_keepWays = m_keepRelations = NULL;
+    throw;
+  }
+  m_keepNodes = m_keepWays = m_keepRelations = NULL;
+  EndLoad();
+}
+
+// Lire un fichier XML, dont les elements sont passes a sink
+template<class Cfg>
+template<class T>
+void BasicOSMData<Cfg>::ParseText (const char *filename, T &sink)
 {
   IByteFileReader *f = NewByteFileReader (filename);
   if (f == NULL) throw "nofile";
 
+  try
+  {
+    switch (m_xmlParser)
+    {
+      case xmlExpat    : ParseExpat (f, sink); break;
+      case xmlNative   : ParseNativeXml (f, sink); break;
+      case xmlParallel :
+        // Les morceaux sont des Batch, ajoutes a OSMData seulement
+        if ((void *) &sink == (void *) this)
+          LoadParallelXml (f);
+        else
+          ParseNativeXml (f, sink);
+        break;
+    }
+  }
+  catch (...)
+  {
+    delete f;
+    throw;
+  }
+  delete f;
+}
+
+template<class Cfg>
+template<class T>
+void BasicOSMData<Cfg>::ParseExpat (IByteFileReader *f, T &sink)
+{
+  if (m_parser != NULL) XML_ParserFree (m_parser);
   m_parser = XML_ParserCreate (NULL);   // NB: Defaut OSM encoding is UTF-8
 
-  XML_SetUserData (m_parser, this);
-  XML_SetElementHandler (m_parser, C_startElementHandler, C_endElementHandler);
+  XML_SetUserData (m_parser, &sink);
+  XML_SetElementHandler (m_parser, C_startElementHandler<T>, C_endElementHandler<T>);
+
+  for (;;)
+  {
+    XML_Status status;
+
+    // Obtenir un bloc a parser
+    f->Async_Feed();
+
+    try
+    {
+      status = XML_Parse(m_parser, f->buffer, f->fill, f->fill == 0);
+    }
+    catch (...)
+    {
+      printf ("EXC line %d  node=%d way=%d relations=%d\n",
+            (int) XML_GetCurrentLineNumber (m_parser),
+            m_nodes.size(), m_ways.size(), m_relations.size());
+      throw;
+    }
+    if (! status)               // Parse error
+      throw "syntaxError";
+
+    if (f->fill == 0) break;    // EOF
+  }
+
+  XML_ParserFree (m_parser);
+  m_parser = NULL;
+}
 
+// Initialisations communes a LoadText et LoadPBF
+template<class Cfg>
+void BasicOSMData<Cfg>::StartLoad (void)
+{
   // Les compteurs de ne pas rinces : ce LoadText est en fait un Append,
   // possible car l'espace des ID est commun a tous les OSM
+  if (m_indexPending) BuildIndexes();
+  m_curtags = NULL;
   m_inway = false;
   m_inrel = false;
+  m_npending = 0;
   m_badrefwn = 0;
   m_badrefr  = 0;
   m_loadbound.close();  // So that extend() works
+  m_zooming = (m_zoom < maxZoom);
+  m_firstNode     = m_nodes.size();
+  m_firstWay      = m_ways.size();
+  m_firstRelation = m_relations.size();
+  m_deferring = (m_refMode == refsDeferred) && ! m_clipping && ! m_zooming;
+  m_refNodes.clear();
+  m_refWays.clear();
+  m_refMembers.clear();
+  m_refRelations.clear();
+}
 
-  for (;;)
+// Dimensionner les tables des blocs de m_nodes, m_ways et m_relations
+// d'apres la taille des fichiers a lire (cf BlockColumn::reserve)
+// + Ce n'est qu'une table de pointeurs (un par bloc) : trop grande, elle ne
+//   coute que quelques Ko ; bytesPerNode est donc pris bas (fichier
+//   comprime, extrait sans Way)
+// + Plusieurs fichiers lus ensemble : un seul appel, pour leur total
+template<class Cfg>
+void BasicOSMData<Cfg>::ReserveFor (size_t bytes, unsigned bytesPerNode)
+{
+  size_t const n = bytes / bytesPerNode;
+  m_nodes.reserve (m_nodes.size() + n);
+  m_ways.reserve (m_ways.size() + n / 8);
+  m_relations.reserve (m_relations.size() + n / 256);
+}
+
+// Taille de filename, 0 s'il n'existe pas (l'ouverture le dira)
+template<class Cfg>
+size_t BasicOSMData<Cfg>::fileSize (const char *filename)
+{
+  struct stat st;
+  return (stat (filename, &st) == 0) ? st.st_size : 0;
+}
+
+// Fin commune a LoadText et LoadPBF
+template<class Cfg>
+void BasicOSMData<Cfg>::EndLoad (void)
+{
+  if (m_deferring) ResolveRefs();
+  if (m_zooming) DropUnusedNodes();
+  if (m_wayStorage == waysDelta) EncodeWays();
+}
+
+// Filtrage m_zoom : retirer les Node de ce chargement qui n'ont ni tag ni
+// reference, et renumeroter les references vers les autres
+template<class Cfg>
+void BasicOSMData<Cfg>::DropUnusedNodes (void)
+{
+  m_zooming = false;
+
+  unsigned const first = m_firstNode;
+  std::vector<int> remap (m_nodes.size() - first, -1);
+
+  // Les references de ce chargement sont contigues (cf RowTable)
+  int * const ix = m_wayNodes.data (m_firstWay);
+  unsigned const nix = m_wayNodes.data (m_wayNodes.size()) - ix;
+  typename Relation::Member * const m = m_members.data (m_firstRelation);
+  unsigned const nm = m_members.data (m_members.size()) - m;
+
+  for (unsigned i = 0; i < nix; ++i)
+    if ((unsigned) ix[i] >= first) remap[ix[i] - first] = 0;
+  for (unsigned i = 0; i < nm; ++i)
+    if ((m[i].elt == eltNode) && ((unsigned) m[i].ix >= first))
+      remap[m[i].ix - first] = 0;
+
+  unsigned kept = first;
+  for (unsigned i = 0; i < remap.size(); ++i)
   {
-    XML_Status status;
+    if ((remap[i] < 0) && m_nodes.tags (first + i).isEmpty()) continue;
+    remap[i] = kept++;
+  }
+  if (kept == m_nodes.size()) return;
+
+  m_nodes.renumber (first, remap);
+
+  for (unsigned i = 0; i < nix; ++i)
+    if ((unsigned) ix[i] >= first) ix[i] = remap[ix[i] - first];
+  for (unsigned i = 0; i < nm; ++i)
+    if ((m[i].elt == eltNode) && ((unsigned) m[i].ix >= first))
+      m[i].ix = remap[m[i].ix - first];
+
+  m_idnodes->renumber (first, remap);
+}
+
+// Coder en delta les Way qui ne le sont pas encore (cf waysDelta), et
+// rendre la RAM de leurs index a plat
+template<class Cfg>
+void BasicOSMData<Cfg>::EncodeWays (void)
+{
+  unsigned const first = m_wayDeltas.size();
+  for (unsigned w = first; w < m_ways.size(); ++w)
+  {
+    m_wayDeltas.addRow();
+    WayNodes::encode (m_wayNodes[w], m_wayDeltas);
+  }
+  m_wayDeltas.shrink();
+
+  m_wayNodes.truncate (first);
+  for (unsigned w = first; w < m_ways.size(); ++w)
+    m_wayNodes.addRow();
+  m_wayNodes.shrink();
+}
+
+// Resolution differee des references (cf refMode)
+// + Chaque morceau de la liste des id est trie, cherche dans l'index dans
+//   l'ordre croissant, et les index trouves sont remis a leur place
+class ResolveJob : public IJob
+{
+public:
+  const IIdIndex *index;
+  const id_t *ids;
+  int *out;
+  size_t count;
+  unsigned chunks;
+
+  void Run (unsigned c)
+  {
+    size_t const begin = count * c / chunks;
+    size_t const n = count * (c + 1) / chunks - begin;
+    std::vector<std::pair<id_t,size_t> > refs (n);
+    for (size_t i = 0; i < n; ++i)
+      refs[i] = std::make_pair (ids[begin + i], begin + i);
+    std::sort (refs.begin(), refs.end());
+
+    std::vector<id_t> sorted (n);
+    std::vector<int> found (n);
+    for (size_t i = 0; i < n; ++i)
+      sorted[i] = refs[i].first;
+    if (n > 0) index->findSorted (&sorted[0], &found[0], n);
+    for (size_t i = 0; i < n; ++i)
+      out[refs[i].second] = found[i];
+  }
+};
+
+static void resolveIds (WorkerPool &pool, const IIdIndex *index,
+                        const std::vector<id_t> &ids, std::vector<int> &out)
+{
+  out.resize (ids.size());
+  if (ids.empty()) return;
+
+  // Des morceaux d'au moins 64K references, 4 par thread au plus
+  ResolveJob job;
+  job.index  = index;
+  job.ids    = &ids[0];
+  job.out    = &out[0];
+  job.count  = ids.size();
+  job.chunks = std::min<size_t> (4 * (pool.size() + 1), ids.size() / 65536 + 1);
+  pool.Run (&job, job.chunks);
+}
+
+template<class Cfg>
+void BasicOSMData<Cfg>::ResolveRefs (void)
+{
+  m_deferring = false;
+  WorkerPool pool;
+  std::vector<int> found;
+
+  // nd des Way : les lignes de ce chargement, encore vides, sont refaites
+  resolveIds (pool, m_idnodes, m_refNodes, found);
+  m_wayNodes.truncate (m_firstWay);
+  m_wayNodes.reserve (m_ways.size(), m_wayNodes.items() + m_refNodes.size());
+  for (unsigned w = 0; w < m_refWays.size(); ++w)
+  {
+    unsigned const end = (w + 1 < m_refWays.size()) ? m_refWays[w + 1] : m_refNodes.size();
+    m_wayNodes.addRow();
+    for (unsigned r = m_refWays[w]; r < end; ++r)
+    {
+      int const n = (found[r] >= 0) ? found[r] : storedNodeIx (m_refNodes[r]);
+      if (n < 0)
+        ++m_badrefwn;
+      else
+        m_wayNodes.push_back (n);
+    }
+  }
+  std::vector<id_t>().swap (m_refNodes);
+  std::vector<unsigned>().swap (m_refWays);
+
+  // member des Relation, par type d'element
+  std::vector<int> member (m_refMembers.size(), -1);
+  std::vector<id_t> ids;
+  std::vector<unsigned> where;
+  IIdIndex * const index[3] = { m_idnodes, m_idways, m_idrelations };
+  for (unsigned t = eltNode; t <= eltRelation; ++t)
+  {
+    ids.clear();
+    where.clear();
+    for (unsigned r = 0; r < m_refMembers.size(); ++r)
+      if (m_refMembers[r].elt == (eltType) t)
+      {
+        ids.push_back (m_refMembers[r].id);
+        where.push_back (r);
+      }
+    resolveIds (pool, index[t], ids, found);
+    for (unsigned i = 0; i < where.size(); ++i)
+      member[where[i]] = ((found[i] < 0) && (t == eltNode)) ? storedNodeIx (ids[i]) : found[i];
+  }
+  m_members.truncate (m_firstRelation);
+  for (unsigned k = 0; k < m_refRelations.size(); ++k)
+  {
+    unsigned const end = (k + 1 < m_refRelations.size()) ? m_refRelations[k + 1] : m_refMembers.size();
+    m_members.addRow();
+    for (unsigned r = m_refRelations[k]; r < end; ++r)
+      if (member[r] < 0)
+        ++m_badrefr;
+      else
+      {
+        typename Relation::Member m;
+        m.elt = m_refMembers[r].elt;
+        m.ix  = member[r];
+        m_members.push_back (m);
+      }
+  }
+  std::vector<Ref>().swap (m_refMembers);
+  std::vector<unsigned>().swap (m_refRelations);
+}
+
+// Ajouter un lot d'elements decodes hors de OSMData (cf LoadPBF)
+// + Les lots doivent etre fournis dans l'ordre du fichier, pour que les
+//   references (par ID) des Way et Relation designent des elements deja connus
+template<class Cfg>
+void BasicOSMData<Cfg>::Merge (const Batch &b)
+{
+  if (b.error != NULL) throw b.error;
+  if (b.isChange) throw "syntaxError";          // Cf ApplyChange
+  if (b.hasBound) m_filebound = b.bound;
+
+  for (unsigned i = 0; i < b.nodes.size(); ++i)
+  {
+    const Batch::Elt &e = b.nodes[i];
+    newNode (e.id, e.pos);
+    for (unsigned t = e.tags; t < e.tags + 2*e.ntags; t += 2)
+      addTag (b.str(b.kv[t]), b.str(b.kv[t+1]));
+    endNode ();
+  }
+
+  for (unsigned i = 0; i < b.ways.size(); ++i)
+  {
+    const Batch::Elt &e = b.ways[i];
+    newWay (e.id);
+    for (unsigned r = e.refs; r < e.refs + e.nrefs; ++r)
+      newND (b.refs[r]);
+    for (unsigned t = e.tags; t < e.tags + 2*e.ntags; t += 2)
+      addTag (b.str(b.kv[t]), b.str(b.kv[t+1]));
+    endWay ();
+  }
+
+  for (unsigned i = 0; i < b.relations.size(); ++i)
+  {
+    const Batch::Elt &e = b.relations[i];
+    newRelation (e.id);
+    for (unsigned r = e.refs; r < e.refs + e.nrefs; ++r)
+      newMember (b.members[r].id, b.members[r].elt, b.str(b.members[r].role));
+    for (unsigned t = e.tags; t < e.tags + 2*e.ntags; t += 2)
+      addTag (b.str(b.kv[t]), b.str(b.kv[t+1]));
+    endRelation ();
+  }
+}
+
+// Appliquer un osmChange (cf OSM.h)
+// + Le fichier est lu dans un Batch, puis applique par type d'element
+// + Les lignes changees sont notees (index -> contenu), et remplacees
+//   ensemble a la fin
+template<class Cfg>
+void BasicOSMData<Cfg>::ApplyChange (const char *filename)
+{
+  Batch b;
+  ParseText (filename, b);
+  if (b.error != NULL) throw b.error;
+
+  if (m_indexPending) BuildIndexes();
+  m_badrefwn = 0;
+  m_badrefr  = 0;
+  std::vector<unsigned> freeNodes, freeWays, freeRelations;   // Pour les suivants
+
+  // Les Node
+  std::map<unsigned,TagRun> nodeTags;
+  for (unsigned i = 0; i < b.nodes.size(); ++i)
+  {
+    const Batch::Elt &e = b.nodes[i];
+    int ix = m_idnodes->find (e.id);
+    if (e.action == changeDelete)
+    {
+      if (ix < 0) continue;
+      m_idnodes->erase (e.id);
+      m_nodes.setId (ix, 0);
+      nodeTags[ix] = TagRun();
+      freeNodes.push_back (ix);
+      continue;
+    }
+
+    TagRun const run = Cfg::nodeTagged ? changeTags (b, e) : TagRun();
+    if (m_nodeStore != NULL)    // Cf newNode : seul un Node tagge ou designe est en RAM
+    {
+      m_nodeStore->set (e.id, e.pos);
+      if ((ix < 0) && (run.count == 0)) continue;
+    }
+    if (ix < 0)
+    {
+      if (m_freeNodes.empty())
+      {
+        ix = m_nodes.size();
+        m_nodes.push_back (e.id, e.pos);
+      }
+      else
+      {
+        ix = m_freeNodes.back();
+        m_freeNodes.pop_back();
+      }
+      m_idnodes->set (e.id, ix);
+    }
+    m_nodes.pos[ix] = e.pos;
+    m_nodes.setId (ix, e.id);
+    if ((run.count != 0) || ! m_nodes.tags (ix).isEmpty())
+      nodeTags[ix] = run;
+    m_loadbound.extend (e.pos);
+  }
+  m_nodes.replaceTags (nodeTags);
+
+  // Les Way, dont les Node sont maintenant a jour
+  std::map<unsigned,std::vector<int> > wayRows;
+  std::map<unsigned,std::vector<unsigned char> > wayCodes;   // Cf waysDelta
+  for (unsigned i = 0; i < b.ways.size(); ++i)
+  {
+    const Batch::Elt &e = b.ways[i];
+    int w = m_idways->find (e.id);
+    std::vector<int> row;
+    if (e.action == changeDelete)
+    {
+      if (w < 0) continue;
+      m_idways->erase (e.id);
+      m_ways[w].Init();
+      freeWays.push_back (w);
+    }
+    else
+    {
+      if (w < 0)
+      {
+        w = newSlot (m_ways, m_wayNodes, m_freeWays);
+        m_idways->set (e.id, w);
+      }
+      m_ways[w].Init();
+      m_ways[w].setId (e.id);
+      m_ways[w].mTags = changeTags (b, e);
+      for (unsigned r = e.refs; r < e.refs + e.nrefs; ++r)
+      {
+        int const ix = storedNodeIx (b.refs[r]);
+        if (ix < 0)
+          ++m_badrefwn;
+        else
+          row.push_back (ix);
+      }
+    }
 
-    // Obtenir un bloc a parser
-    f->Async_Feed();
+    if ((unsigned) w < m_wayDeltas.size())
+    {
+      std::vector<unsigned char> &code = wayCodes[w];
+      code.clear();
+      WayNodes::encode (Span<int> (row.empty() ? NULL : &row[0], row.size()), code);
+    }
+    else
+      wayRows[w].swap (row);
+  }
 
-    try
+  // Les Relation : toutes ont leur place avant que leurs membres (dont
+  // d'autres Relation de ce fichier) soient cherches
+  std::map<unsigned,std::vector<typename Relation::Member> > memberRows;
+  for (unsigned i = 0; i < b.relations.size(); ++i)
+  {
+    const Batch::Elt &e = b.relations[i];
+    int r = m_idrelations->find (e.id);
+    if (e.action == changeDelete)
     {
-      status = XML_Parse(m_parser, f->buffer, f->fill, f->fill == 0);
+      if (r < 0) continue;
+      m_idrelations->erase (e.id);
+      m_relations[r].Init();
+      memberRows[r].clear();
+      freeRelations.push_back (r);
+      continue;
     }
-    catch (...)
+    if (r < 0)
     {
-      printf ("EXC line %d  node=%d way=%d relations=%d\n",
-            (int) XML_GetCurrentLineNumber (m_parser),
-            m_nodes.size(), m_ways.size(), m_relations.size());
-      delete f;
-      throw;
+      r = newSlot (m_relations, m_members, m_freeRelations);
+      m_idrelations->set (e.id, r);
     }
-    if (! status)
-    {                           // Parse error
-      delete f;
-      throw "syntaxError";
+    m_relations[r].Init();
+    m_relations[r].setId (e.id);
+    m_relations[r].mTags = changeTags (b, e);
+  }
+
+  for (unsigned i = 0; i < b.relations.size(); ++i)
+  {
+    const Batch::Elt &e = b.relations[i];
+    if (e.action == changeDelete) continue;
+    std::vector<typename Relation::Member> &row = memberRows[findRelationIx (e.id)];
+    row.clear();
+    for (unsigned r = e.refs; r < e.refs + e.nrefs; ++r)
+    {
+      typename Relation::Member m;
+      m.elt = b.members[r].elt;
+      m.ix  = (m.elt == eltNode) ? storedNodeIx (b.members[r].id) : findIx (m.elt, b.members[r].id);
+      if (m.ix < 0)
+        ++m_badrefr;
+      else
+        row.push_back (m);
     }
+  }
 
-    if (f->fill == 0) break;    // EOF
+  // Remplacer les lignes changees, en une passe par RowTable
+  m_wayNodes.replace (wayRows);
+  m_wayDeltas.replace (wayCodes);
+  m_members.replace (memberRows);
+  if ((m_wayStorage == waysDelta) && (m_wayDeltas.size() < m_ways.size()))
+    EncodeWays();
+
+  m_freeNodes.insert (m_freeNodes.end(), freeNodes.begin(), freeNodes.end());
+  m_freeWays.insert (m_freeWays.end(), freeWays.begin(), freeWays.end());
+  m_freeRelations.insert (m_freeRelations.end(), freeRelations.begin(), freeRelations.end());
+}
+
+// Tags d'un element de b, ajoutes a m_tagArena
+template<class Cfg>
+TagRun BasicOSMData<Cfg>::changeTags (const Batch &b, const Batch::Elt &e)
+{
+  TagRun run = TagRun();
+  m_curtags = &run;
+  for (unsigned t = e.tags; t < e.tags + 2*e.ntags; t += 2)
+    storeTag (b.str(b.kv[t]), b.str(b.kv[t+1]));
+  m_curtags = NULL;
+  return run;
+}
+
+// Place pour un element cree par ApplyChange : une place libre, sinon en fin
+template<class Cfg>
+template<class E, class T>
+unsigned BasicOSMData<Cfg>::newSlot (BlockColumn<E> &elts, RowTable<T> &rows,
+                                     std::vector<unsigned> &free)
+{
+  if (! free.empty())
+  {
+    unsigned const ix = free.back();
+    free.pop_back();
+    return ix;
   }
+  elts.resize (elts.size() + 1);
+  rows.addRow();
+  return elts.size() - 1;
+}
 
-  delete f;
+// + Sans id (Config::id_type void), ils restent vides
+template<class Cfg>
+void BasicOSMData<Cfg>::BuildIndexes (void)
+{
+  m_indexPending = false;
+  if (IdColumn<typename Cfg::id_type>::bytes == 0) return;
+  for (unsigned i = 0; i < m_nodes.size(); ++i)
+    m_idnodes->set (m_nodes.id (i), i);
+  for (unsigned i = 0; i < m_ways.size(); ++i)
+    m_idways->set (m_ways[i].id(), i);
+  for (unsigned i = 0; i < m_relations.size(); ++i)
+    m_idrelations->set (m_relations[i].id(), i);
 }
 
-int OSMData::findNodeIx (id_t id)
+template<class Cfg>
+int BasicOSMData<Cfg>::findNodeIx (id_t id)
 {
-  std::map<id_t,unsigned>::const_iterator i = m_idnodes.find(id);
-  if (i == m_idnodes.end()) return -1;
-  return i->second;
+  if (m_indexPending) BuildIndexes();
+  return m_idnodes->find (id);
 
 //for (unsigned i = 0; i < m_nodes.size(); ++i)
 //  if (m_nodes[i].id == id) return i;
 //return -1;
 }
 
-int OSMData::findWayIx (id_t id)
+template<class Cfg>
+int BasicOSMData<Cfg>::findWayIx (id_t id)
 {
-  std::map<id_t,unsigned>::const_iterator i = m_idways.find(id);
-  if (i == m_idways.end()) return -1;
-  return i->second;
+  if (m_indexPending) BuildIndexes();
+  return m_idways->find (id);
 
 //for (unsigned i = 0; i < m_ways.size(); ++i)
 //  if (m_ways[i].id == id) return i;
 //return -1;
 }
 
-int OSMData::findRelationIx (id_t id)
+template<class Cfg>
+int BasicOSMData<Cfg>::findRelationIx (id_t id)
 {
-  std::map<id_t,unsigned>::const_iterator i = m_idrelations.find(id);
-  if (i == m_idrelations.end()) return -1;
-  return i->second;
+  if (m_indexPending) BuildIndexes();
+  return m_idrelations->find (id);
 
 //for (unsigned i = 0; i < m_ways.size(); ++i)
 //  if (m_relations[i].id == id) return i;
 //return -1;
 }
 
-int OSMData::findIx (eltType elt, id_t id)
+template<class Cfg>
+int BasicOSMData<Cfg>::findIx (eltType elt, id_t id)
 {
   switch (elt)
   {
@@ -241,12 +1241,8 @@ static const XML_Char *value (const XML_Char **atts, const XML_Char *name)
 
 static inline id_t idvalue (const XML_Char *str)
 {
-#ifndef OSM_ID32
-  // strtoull() occupe 15% du temps de lecture de "rhone-alpes.osm"
-  return strtoull (str, NULL, 10);
-#else
-  return strtoul (str, NULL, 10);
-#endif
+  // strtoull() occupait 15% du temps de lecture de "rhone-alpes.osm"
+  return (id_t) decodeId (str);
 }
 
 // Verifier un nom d'element XML : si le fichier OSM est bien fait, on peut
@@ -270,29 +1266,52 @@ static inline enum eltType eltvalue (const XML_Char *str)
   throw "syntaxError";  // on ne peut pas laisser faire
 }
 
-void OSMData::startElementHandler (const XML_Char *name, const XML_Char **atts)
+template<class T>
+void OSMDataCommon::startElement (T &t, const XML_Char *name, const XML_Char **atts)
 {
   // Les differents element XML d'un OSM sont :
   //   osm, bounds, node, way, relation, nd, member, tag
+  // et ceux d'un osmChange (cf ApplyChange) : osmChange, create, modify, delete
   // On peut donc, presque, se contenter de tester le 1er chr ce qui va mieux
   // qu'un strcmp
   // Mesure sur rhone-alpes.osm (2.4G) GCC 4.5.0 MinGW en "-O2 -DNDEBUG -g" :
   //    strcmp = 80.0s,  switch = 78.7s  + newND fixe = 78.1s
   switch (name[0])
   {
-    case 'o' :  // XML "osm" element : ignored
+    case 'o' :  // XML "osm" or "osmChange" element
+    {
+      // Un seul par fichier : le strcmp ne coute rien. Un element "create",
+      // "delete" ou "modify" hors d'un osmChange est ignore (setAction)
+      if (! strcmp (name, "osmChange"))
+        t.startChange();
+      else
+        checkSyntax (!strcmp (name, "osm"));
+    }
+    break;
+
+    case 'c' :  // XML "create" element (osmChange)
+    {
+      checkSyntax (!strcmp (name, "create"));
+      t.setAction (changeCreate);
+    }
+    break;
+
+    case 'd' :  // XML "delete" element (osmChange)
     {
-      checkSyntax (!strcmp (name, "osm"));
+      checkSyntax (!strcmp (name, "delete"));
+      t.setAction (changeDelete);
     }
     break;
 
     case 'b' :  // XML "bounds" element
     {
       checkSyntax (!strcmp (name, "bounds"));
-      m_filebound.min.lat = fixedlatlon (value (atts, "minlat"));
-      m_filebound.max.lat = fixedlatlon (value (atts, "maxlat"));
-      m_filebound.min.lon = fixedlatlon (value (atts, "minlon"));
-      m_filebound.max.lon = fixedlatlon (value (atts, "maxlon"));
+      LatLonBox box;
+      box.min.lat = fixedlatlon (value (atts, "minlat"));
+      box.max.lat = fixedlatlon (value (atts, "maxlat"));
+      box.min.lon = fixedlatlon (value (atts, "minlon"));
+      box.max.lon = fixedlatlon (value (atts, "maxlon"));
+      t.setFileBound (box);
     }
     break;
 
@@ -301,7 +1320,10 @@ void OSMData::startElementHandler (const XML_Char *name, const XML_Char **atts)
       if (name[1] == 'o')
       {
         checkSyntax (!strcmp (name, "node"));
-        newNode (atts);
+        LatLon pos;
+        pos.lat = fixedlatlon (value (atts, "lat"));
+        pos.lon = fixedlatlon (value (atts, "lon"));
+        t.newNode (idvalue (value (atts, "id")), pos);
       }
       else
       {
@@ -309,9 +1331,9 @@ void OSMData::startElementHandler (const XML_Char *name, const XML_Char **atts)
 #if 1
         // Pas la peine de chercher, "ref" est toujours atts[0] ?
         checkSyntax (! strcmp (atts[0], "ref"));
-        newND (idvalue(atts[1]));
+        t.newND (idvalue(atts[1]));
 #else
-        newND (idvalue(value(atts, "ref")));
+        t.newND (idvalue(value(atts, "ref")));
 #endif
       }
     }
@@ -320,23 +1342,29 @@ void OSMData::startElementHandler (const XML_Char *name, const XML_Char **atts)
     case 'w' :  // XML "way" element
     {
       checkSyntax (!strcmp (name, "way"));
-      newWay (atts);
+      t.newWay (idvalue (value (atts, "id")));
     }
     break;
 
     case 'r' :  // XML "relation" element
     {
       checkSyntax (!strcmp (name, "relation"));
-      newRelation (atts);
+      t.newRelation (idvalue (value (atts, "id")));
     }
     break;
 
-    case 'm' :  // XML "member" element
+    case 'm' :  // XML "member" or "modify" (osmChange) element
     {
+      if (name[1] == 'o')
+      {
+        checkSyntax (!strcmp (name, "modify"));
+        t.setAction (changeModify);
+        break;
+      }
       checkSyntax (!strcmp (name, "member"));
-      newMember (idvalue(value(atts, "ref")),
-                 eltvalue(value(atts, "type")),
-                 value(atts, "role"));
+      t.newMember (idvalue(value(atts, "ref")),
+                   eltvalue(value(atts, "type")),
+                   value(atts, "role"));
     }
     break;
 
@@ -344,13 +1372,14 @@ void OSMData::startElementHandler (const XML_Char *name, const XML_Char **atts)
     {
       checkSyntax (!strcmp (name, "tag"));
       // Pas la peine de chercher, c'est toujours 0="k" et 2="v" ... ?
-      addTag (value(atts, "k"), value(atts, "v"));
+      t.addTag (value(atts, "k"), value(atts, "v"));
     }
     break;
   }
 }
 
-void OSMData::endElementHandler (const XML_Char *name)
+template<class T>
+void OSMDataCommon::endElement (T &t, const XML_Char *name)
 {
   switch (name[0])
   {
@@ -358,183 +1387,781 @@ void OSMData::endElementHandler (const XML_Char *name)
       if (name[1] == 'o')
       {
         checkSyntax (!strcmp (name, "node"));
-        endNode ();
+        t.endNode ();
       }
     break;
 
     case 'w' :  // XML "way/" element
       checkSyntax (!strcmp (name, "way"));
-      endWay ();
+      t.endWay ();
+    break;
+
+    case 'r' :  // XML "relation/" element
+      checkSyntax (!strcmp (name, "relation"));
+      t.endRelation ();
     break;
   }
 }
 
+template<class Cfg>
+void BasicOSMData<Cfg>::startElementHandler (const XML_Char *name, const XML_Char **atts)
+{
+  startElement (*this, name, atts);
+}
+
+template<class Cfg>
+void BasicOSMData<Cfg>::endElementHandler (const XML_Char *name)
+{
+  endElement (*this, name);
+}
+
+void OSMDataCommon::ClipScan::startElementHandler (const XML_Char *name, const XML_Char **atts)
+{
+  startElement (*this, name, atts);
+}
+
+void OSMDataCommon::ClipScan::endElementHandler (const XML_Char *name)
+{
+  endElement (*this, name);
+}
+
+void OSMDataCommon::Batch::startElementHandler (const XML_Char *name, const XML_Char **atts)
+{
+  startElement (*this, name, atts);
+}
+
+void OSMDataCommon::Batch::endElementHandler (const XML_Char *name)
+{
+  endElement (*this, name);
+}
+
 
-inline void OSMData::newNode (const XML_Char **atts)
+template<class Cfg>
+inline void BasicOSMData<Cfg>::newNode (id_t id, const LatLon &pos)
 {
-  unsigned const cur = m_nodes.size();
+  // Filtrage : un Node ignore n'a pas d'index, les references vers lui
+  // seront donc ignorees aussi
+  if ((m_keepNodes != NULL) ? ! m_keepNodes->test (id)
+                            : m_clipping && ! m_clip.contains (pos))
+  {
+    m_curtags = NULL;           // Ses tags aussi
+    return;
+  }
+
+  // Les tags d'un Node attendent dans m_nodeTags, jusqu'a endNode
+  m_curtags = Cfg::nodeTagged ? &m_nodeTags : NULL;
+  m_loadbound.extend (pos);     // Meme si ce node n'est pas reference
+
+  // Node hors de la RAM : il n'entre dans m_nodes que s'il a des tags (cf
+  // endNode) ou s'il est designe (cf storedNodeIx)
+  if (m_nodeStore != NULL)
+  {
+    m_nodeStore->set (id, pos);
+    m_curpos = pos;
+    m_curid  = id;
+    return;
+  }
+
 // Ceci a l'air bien pour la RAM ... mais est catastrophique en temps car
 // on fait alors enormement de copies, sur un gros OSM
 //if (cur+10 > m_nodes.capacity()) m_nodes.reserve (cur + 1000);
-  m_nodes.resize (cur + 1);
-  Node &p = m_nodes.back();
-  p.Init();
-  const id_t id = idvalue (value (atts, "id"));
-#ifdef OSM_ID_STORED
-  p.mID = id;
-#endif
-  m_idnodes[id] = cur;
-  p.set (value (atts, "lat"), value (atts, "lon"));
-  m_loadbound.extend (p.pos);   // Meme si ce node n'est pas reference
-  m_curelt = &p;                // Si Node supporte les tags
-//m_curelt = NULL;              // Node ne peut pas avoir de tag
+  if (! m_idnodes->insert (id, m_nodes.size()))
+  {
+    m_curtags = NULL;           // Deja charge (extraits voisins) : ignore
+    return;
+  }
+  m_nodes.push_back (id, pos);
 }
 
-inline void OSMData::endNode (void)
+template<class Cfg>
+inline void BasicOSMData<Cfg>::endNode (void)
 {
-  m_curelt = NULL;
+  // Filtrage m_zoom : un Node ne garde ses tags que s'il est visible
+  if (m_zooming && (m_curtags != NULL))
+  {
+    if (pendingZoom() <= m_zoom) flushTags();
+    m_npending = 0;
+  }
+
+  if (m_nodeTags.count != 0)
+  {
+    if (m_nodeStore == NULL)
+      m_nodes.setLastTags (m_nodeTags);
+    else if (m_idnodes->insert (m_curid, m_nodes.size()))
+    {                           // Node de m_nodeStore, garde pour ses tags
+      m_nodes.push_back (m_curid, m_curpos);
+      m_nodes.setLastTags (m_nodeTags);
+    }
+    else                        // Deja charge : ses tags sont en fin de m_tagArena
+      m_tagArena.pairs.resize (m_nodeTags.first);
+    m_nodeTags.count = 0;
+  }
+  m_curtags = NULL;
+}
+
+// Index du Node id, lu dans m_nodeStore s'il n'est pas encore dans m_nodes
+// (-1 s'il n'est pas connu)
+// + Le Node est alors mis en RAM pour de bon, avec son entree d'index : les
+//   Way designent des index de m_nodes (cf OSMData::m_nodeStore)
+template<class Cfg>
+int BasicOSMData<Cfg>::storedNodeIx (id_t id)
+{
+  int ix = m_idnodes->find (id);
+  if ((ix >= 0) || (m_nodeStore == NULL)) return ix;
+
+  LatLon pos;
+  if (! m_nodeStore->get (id, pos)) return -1;
+  ix = m_nodes.size();
+  m_nodes.push_back (id, pos);
+  m_idnodes->set (id, ix);
+  return ix;
 }
 
-inline void OSMData::newWay (const XML_Char **atts)
+template<class Cfg>
+inline void BasicOSMData<Cfg>::newWay (id_t id)
 {
+  if ((m_keepWays != NULL) && ! m_keepWays->test (id))
+  {
+    m_curtags = NULL;
+    m_inway = false;            // Ses nd aussi
+    return;
+  }
+
   unsigned const cur = m_ways.size();
+  if (! m_idways->insert (id, cur))
+  {
+    m_curtags = NULL;           // Deja charge (extraits voisins) : ignore
+    m_inway = false;
+    return;
+  }
   m_ways.resize (cur + 1);
   Way &p = m_ways.back();
   p.Init();
-  const id_t id = idvalue (value (atts, "id"));
-#ifdef OSM_ID_STORED
-  p.mID = id;
-#endif
-  m_idways[id] = cur;
-  m_curelt = &p;
+  p.setId (id);
+  m_wayNodes.addRow();
+  m_curtags = &p.mTags;
+  m_curid = id;
   m_inway = true;
+  if (m_deferring) m_refWays.push_back (m_refNodes.size());
 }
 
-inline void OSMData::newND (id_t id)
+template<class Cfg>
+inline void BasicOSMData<Cfg>::newND (id_t id)
 {
   if (! m_inway) return;          // Possible en saturation, et en cas de OSM faux
-  int idx = findNodeIx (id);      // Les node sont avant les way dans un OSM ?
+  if (m_deferring)
+  {
+    m_refNodes.push_back (id);
+    return;
+  }
+  int idx = storedNodeIx (id);    // Les node sont avant les way dans un OSM ?
   if (idx < 0)                    // Seuls les Node existant sont enregistres dans les Way
     ++m_badrefwn;
   else
-    m_ways.back().nodesIx.push_back (idx);
+    m_wayNodes.push_back (idx);
 }
 
-inline void OSMData::endWay (void)
+template<class Cfg>
+inline void BasicOSMData<Cfg>::endWay (void)
 {
-  m_curelt = NULL;
+  // Filtrage clipNodes : un Way sans Node dans le pave est oublie
+  // Filtrage m_zoom : un Way invisible a ce zoom aussi. Un Way sans classe
+  // (membre de Relation ?) est garde
+  if ((m_clipping || m_zooming) && m_inway)
+  {
+    bool keep = ! m_wayNodes[m_ways.size() - 1].empty();
+    if (keep && m_zooming)
+    {
+      zoom_t const z = pendingZoom();
+      keep = ((z <= m_zoom) || (z > maxZoom)) && simplify();
+    }
+    if (keep)
+      flushTags();
+    else
+      dropLast (m_ways, m_wayNodes, m_idways);
+  }
+  m_curtags = NULL;
   m_inway  = false;
 }
 
 
-inline void OSMData::newRelation (const XML_Char **atts)
+template<class Cfg>
+inline void BasicOSMData<Cfg>::newRelation (id_t id)
 {
+  if ((m_keepRelations != NULL) && ! m_keepRelations->test (id))
+  {
+    m_curtags = NULL;
+    m_inrel = false;
+    return;
+  }
+
   unsigned const cur = m_relations.size();
+  if (! m_idrelations->insert (id, cur))
+  {
+    m_curtags = NULL;
+    m_inrel = false;
+    return;
+  }
   m_relations.resize (cur + 1);
   Relation &p = m_relations.back();
   p.Init();
-  const id_t id = idvalue (value (atts, "id"));
-#ifdef OSM_ID_STORED
-  p.mID = id;
-#endif
-  m_idrelations[id] = cur;
-  m_curelt = &p;
+  p.setId (id);
+  m_members.addRow();
+  m_curtags = &p.mTags;
+  m_curid = id;
   m_inrel = true;
+  if (m_deferring) m_refRelations.push_back (m_refMembers.size());
 }
 
-inline void OSMData::newMember (id_t id, enum eltType elt, const XML_Char *role)
+template<class Cfg>
+inline void BasicOSMData<Cfg>::newMember (id_t id, enum eltType elt, const XML_Char *role)
 {
   if (! m_inrel) return;          // Possible en saturation, et en cas de OSM faux
-  Relation::Member m;
+  if (m_deferring)
+  {
+    Ref r;
+    r.id  = id;
+    r.elt = elt;
+    m_refMembers.push_back (r);
+    return;
+  }
+  typename Relation::Member m;
   m.elt = elt;
-  m.ix  = findIx (elt, id);  // Pas de reference en avant dans un OSM ?
+  m.ix  = (elt == eltNode) ? storedNodeIx (id) : findIx (elt, id);
   if (m.ix < 0)
     ++m_badrefr;                // Seuls les references existants sont memorises
   else
-    m_relations.back().eltIx.push_back (m);
+    m_members.push_back (m);
 }
 
-inline void OSMData::endRelation (void)
+template<class Cfg>
+inline void BasicOSMData<Cfg>::endRelation (void)
 {
-  m_curelt = NULL;
+  if ((m_clipping || m_zooming) && m_inrel)
+  {
+    bool keep = ! m_members[m_relations.size() - 1].empty();
+    if (keep && m_zooming)
+    {
+      zoom_t const z = pendingZoom();
+      keep = (z <= m_zoom) || (z > maxZoom);
+    }
+    if (keep)
+      flushTags();
+    else
+      dropLast (m_relations, m_members, m_idrelations);
+  }
+  m_curtags = NULL;
   m_inrel  = false;
 }
 
-inline void OSMData::addTag (const XML_Char *key, const XML_Char *value)
+// Oublier le dernier Way ou Relation, filtre apres coup, et ses references
+template<class Cfg>
+template<class E, class T>
+void BasicOSMData<Cfg>::dropLast (BlockColumn<E> &elts, RowTable<T> &rows, IIdIndex *ids)
 {
-  if (m_curelt == NULL) return;
-//if (m_curelt->tagCapable()) return;
+  E &p = elts.back();
+  if (p.mTags.count != 0)       // En fin de m_tagArena
+    m_tagArena.pairs.resize (p.mTags.first);
+  ids->erase (m_curid);
+  elts.pop_back();
+  rows.truncate (elts.size());
+  m_npending = 0;
+}
 
-  // S'il n'y a pas encore de Tags, il est temps d'en allouer
-  if (m_curelt->mTags == &nilTags)
-    m_curelt->mTags = new Tags;
+// Fusion de la table annexe et de tags, a partir du premier Node change
+template<class Cfg>
+void BasicOSMData<Cfg>::NodeTable::replaceTags (const std::map<unsigned,TagRun> &tags)
+{
+  if (tags.empty()) return;
+  unsigned const first = std::lower_bound (m_tagged.begin(), m_tagged.end(),
+                                           tags.begin()->first) - m_tagged.begin();
+  std::vector<unsigned> tagged;
+  std::vector<TagRun> runs;
+  tagged.reserve (m_tagged.size() - first + tags.size());
+  runs.reserve (m_tagged.size() - first + tags.size());
+
+  typename std::map<unsigned,TagRun>::const_iterator i = tags.begin();
+  unsigned t = first;
+  while ((t < m_tagged.size()) || (i != tags.end()))
+  {
+    if ((i == tags.end()) || ((t < m_tagged.size()) && (m_tagged[t] < i->first)))
+    {
+      tagged.push_back (m_tagged[t]);
+      runs.push_back (m_tags[t++]);
+      continue;
+    }
+    if ((t < m_tagged.size()) && (m_tagged[t] == i->first)) ++t;     // Remplace
+    if (i->second.count != 0)
+    {
+      tagged.push_back (i->first);
+      runs.push_back (i->second);
+    }
+    ++i;
+  }
 
-  Tags * const tags = m_curelt->mTags;
+  m_tagged.resize (first + tagged.size());
+  m_tags.resize (first + runs.size());
+  std::copy (tagged.begin(), tagged.end(), m_tagged.begin() + first);
+  std::copy (runs.begin(), runs.end(), m_tags.begin() + first);
+}
 
-  (tags->count)++;     // Stats pour aider la conception
+// Retirer ou deplacer des Node (cf EndLoad)
+// + Les paires d'un Node retire restent dans m_tagArena (EndLoad ne retire
+//   que des Node sans tag)
+template<class Cfg>
+void BasicOSMData<Cfg>::NodeTable::renumber (unsigned first, const std::vector<int> &remap)
+{
+  unsigned kept = first;
+  for (unsigned i = 0; i < remap.size(); ++i)
+    if (remap[i] >= 0)
+    {
+      kept = remap[i] + 1;
+      if ((unsigned) remap[i] == first + i) continue;
+      pos[remap[i]] = pos[first + i];
+      m_ids.move (first + i, remap[i]);
+    }
+  pos.resize (kept);
+  pos.shrink();                             // Rendre la RAM
+  m_ids.resize (kept);
 
-  // Tags usuel
-  if (! strcmp (key, "name"))
-    // Il n'y a pas de raison qu'un nom d'Element soit partage ? strdup suffit
-    // plutot que globalStringStock ?
-    tags->name = strdup (value);
-  else if (! strcmp (key, "layer"))
-    // la valeur de layer est censee entre dans [-5,5], on en verifie pas
-    tags->layer = atoi (value);
-  else
-  { // discovered tags
-    tagPair pair;
-    pair.key.pntr   = globalStringStock.FindOrAdd ((const char *) key);
-    pair.value.pntr = globalStringStock.FindOrAdd ((const char *) value);
-    tags->pairs.push_back(pair);
+  unsigned t = std::lower_bound (m_tagged.begin(), m_tagged.end(), first) - m_tagged.begin();
+  unsigned n = t;
+  for (; t < m_tagged.size(); ++t)
+  {
+    int const ix = remap[m_tagged[t] - first];
+    if (ix < 0) continue;
+    m_tagged[n] = ix;
+    m_tags[n++] = m_tags[t];
+  }
+  m_tagged.resize (n);
+  m_tags.resize (n);
+}
+
+template<class Cfg>
+inline void BasicOSMData<Cfg>::addTag (const XML_Char *key, const XML_Char *value)
+{
+  if (m_curtags == NULL) return;
 
-    // pre-decodage
-    // + Des places sont parfois notees highway=footway en plus de area=yes,
-    //   on prend donc ce cas en premier
-    // TODO : A generaliser/communaliser dans globalStringStock avec commonTagStr
-//  if      (! strcmp (key, "area"))     tags->kind = Tags::area;
-         if (! strcmp (key, "building")) tags->kind = Tags::building;
-    else if (! strcmp (key, "highway"))  tags->kind = Tags::highway;
-    else if (! strcmp (key, "railway"))  tags->kind = Tags::railway;
-    else if (! strcmp (key, "waterway")) tags->kind = Tags::waterway;
+  // Filtrage clipNodes : on ne sait qu'a la fin d'un Way ou Relation s'il
+  // est garde, ses tags attendent jusque la (ni atome, ni paire dans m_tagArena)
+  // Filtrage m_zoom : idem, et pour les tags d'un Node
+  if ((m_clipping && (m_inway || m_inrel)) || m_zooming)
+  {
+    if (m_pendingTags.size() < 2*m_npending + 2)
+      m_pendingTags.resize (2*m_npending + 2);
+    m_pendingTags[2*m_npending].assign (key);
+    m_pendingTags[2*m_npending + 1].assign (value);
+    ++m_npending;
+    return;
   }
+  storeTag (key, value);
 }
 
-// "[-]NNN.NNNNNNN"
-// Bien plus rapide que passer par atof(). Sur rhone-alpes.osm GCC 4.5.0 -O2 :
-//    atof = 75s   fixedlatlon = 67s
-int OSMData::fixedlatlon (const char *str)
+template<class Cfg>
+inline void BasicOSMData<Cfg>::flushTags (void)
+{
+  for (unsigned i = 0; i < m_npending; ++i)
+    storeTag (m_pendingTags[2*i].c_str(), m_pendingTags[2*i + 1].c_str());
+  m_npending = 0;
+}
+
+// Ajouter une paire aux tags de l'element en cours, en fin de m_tagArena
+// + Les paires d'un element restent triees par key (insertion)
+// + Les tags de TagValues y sont decodes au passage
+template<class Cfg>
+inline void BasicOSMData<Cfg>::storeTag (const XML_Char *key, const XML_Char *value)
+{
+  TagRun &run = *m_curtags;
+  if (run.count == 0)
+  {
+    run.first = m_tagArena.pairs.size();
+    run.values = TagValues();
+  }
+
+  tagPair pair;
+  pair.key   = m_tagArena.addAtom ((const char *) key);
+  pair.value = m_tagArena.addAtom ((const char *) value);
+  m_tagArena.pairs.push_back (pair);
+  if (pair.key < (atom_t) tagCommonCount)
+    decodeValue (run.values, pair.key, (const char *) value);
+
+  tagPair * const pairs = &m_tagArena.pairs[run.first];
+  unsigned i = run.count++;
+  for (; (i > 0) && (pairs[i-1].key > pair.key); --i)
+    pairs[i] = pairs[i-1];
+  pairs[i] = pair;
+}
+
+
+//-----------------------------
+// Chargement a un zoom donne (m_zoom)
+
+// Zoom a partir duquel une classe d'elements est visible, a la maniere des
+// feuilles de style du rendu de openstreetmap.org
+// + value NULL : toute valeur de key (apres les valeurs particulieres)
+struct ZoomClass
+{
+  commonTag key;
+  commonTag value;              // tagNil : toute valeur
+  zoom_t zoom;
+};
+
+static const ZoomClass zoomClasses[] =
 {
-  bool const negative = (*str == '-');
-  int lsb = 10000000;
-  int val = 0;
-  char c;
+  { tagHighway,      tagMotorway,        5 },
+  { tagHighway,      tagTrunk,           5 },
+  { tagHighway,      tagMotorwayLink,    10 },
+  { tagHighway,      tagTrunkLink,       10 },
+  { tagHighway,      tagPrimary,         7 },
+  { tagHighway,      tagPrimaryLink,     11 },
+  { tagHighway,      tagSecondary,       9 },
+  { tagHighway,      tagTertiary,        10 },
+  { tagHighway,      tagUnclassified,    12 },
+  { tagHighway,      tagResidential,     12 },
+  { tagHighway,      tagLivingStreet,    13 },
+  { tagHighway,      tagService,         14 },
+  { tagHighway,      tagTrack,           14 },
+  { tagHighway,      tagNil,             15 },  // footway, path, steps, ...
+  { tagRailway,      tagRail,            8 },
+  { tagRailway,      tagNil,             12 },
+  { tagWaterway,     tagRiver,           8 },
+  { tagWaterway,     tagCanal,           10 },
+  { tagWaterway,     tagNil,             13 },
+  { tagNatural,      tagCoastline,       0 },
+  { tagNatural,      tagWater,           8 },
+  { tagNatural,      tagWood,            10 },
+  { tagNatural,      tagNil,             12 },
+  { tagLanduse,      tagNil,             10 },
+  { tagLeisure,      tagNil,             13 },
+  { tagBoundary,     tagAdministrative,  4 },
+  { tagBoundary,     tagNil,             8 },
+  { tagPlace,        tagCountry,         2 },
+  { tagPlace,        tagState,           4 },
+  { tagPlace,        tagCity,            5 },
+  { tagPlace,        tagTown,            8 },
+  { tagPlace,        tagVillage,         11 },
+  { tagPlace,        tagNil,             13 },
+  { tagAeroway,      tagAerodrome,       10 },
+  { tagAeroway,      tagNil,             13 },
+  { tagBuilding,     tagNil,             14 },
+  { tagAmenity,      tagNil,             15 },
+  { tagShop,         tagNil,             16 },
+  { tagTourism,      tagNil,             15 },
+  { tagHistoric,     tagNil,             15 },
+  { tagManMade,      tagNil,             15 },
+  { tagPower,        tagNil,             14 },
+  { tagBarrier,      tagNil,             16 },
+};
+
+// + Les chaines des zoomClasses sont des commonTag : une key qui n'est pas un
+//   commonTag n'a pas de classe
+zoom_t OSMDataCommon::minZoom (const char *key, const char *value)
+{
+  atom_t const k = findCommonTag (key);
+  if (k == tagNil) return maxZoom + 1;
+  atom_t const v = findCommonTag (value);
 
-  if (negative) ++str;
+  for (unsigned i = 0; i < sizeof(zoomClasses)/sizeof(zoomClasses[0]); ++i)
+  {
+    const ZoomClass &c = zoomClasses[i];
+    if (k != (atom_t) c.key) continue;
+    if ((c.value == tagNil) || (v == (atom_t) c.value)) return c.zoom;
+  }
+  return maxZoom + 1;
+}
 
-  // Partie entiere
-  while (((c = *str++) != '\0') && (c != '.'))
+// Zoom de visibilite de l'element en cours, d'apres ses tags en attente
+template<class Cfg>
+zoom_t BasicOSMData<Cfg>::pendingZoom (void) const
+{
+  zoom_t zoom = maxZoom + 1;
+  for (unsigned i = 0; i < m_npending; ++i)
   {
-    checkSyntax ((c >= '0') && (c <= '9'));
-    val = val*10 + (int) (c - '0');
+    zoom_t const z = minZoom (m_pendingTags[2*i].c_str(), m_pendingTags[2*i + 1].c_str());
+    if (z < zoom) zoom = z;
   }
+  return zoom;
+}
 
-  // Partie fractionnaire
-  // + Un peu plus rapide a executer que de traiter les deux dans la meme boucle
-  //   (mais plus long a coder) ... on gagne 0.5s sur rhones-alpes.osm (66s)
-  if (c == '.')
+// Simplifier la geometrie du dernier Way (Douglas-Peucker) au pixel pres a
+// m_zoom
+// + Retourne false pour une aire (boucle) qui n'a plus de surface
+template<class Cfg>
+bool BasicOSMData<Cfg>::simplify (void)
+{
+  unsigned const w = m_ways.size() - 1;
+  int * const ix = m_wayNodes.data (w);
+  unsigned const n = m_wayNodes[w].size();
+  if (n < 3) return true;
+
+  // Un pixel d'une tuile 256x256 (Mercator), en LSB de latitude. Les ecarts
+  // de longitude sont ramenes a la latitude du Way
+  double const coslat = cos (degree (m_nodes.pos[ix[0]].lat) * M_PI / 180.0);
+  double const tol = 360.0 / latlon_lsb / (256.0 * (double) (1u << m_zoom)) * coslat;
+
+  m_dpKeep.assign (n, false);
+  m_dpKeep[0] = m_dpKeep[n-1] = true;
+  m_dpStack.clear();
+  m_dpStack.push_back (0);
+  m_dpStack.push_back (n-1);
+  unsigned kept = 2;
+  while (! m_dpStack.empty())
   {
-    while (((c = *str++) != '\0'))
+    unsigned const b = m_dpStack.back(); m_dpStack.pop_back();
+    unsigned const a = m_dpStack.back(); m_dpStack.pop_back();
+    const LatLon &pa = m_nodes.pos[ix[a]];
+    const LatLon &pb = m_nodes.pos[ix[b]];
+    double const dx = ((double) pb.lon - pa.lon) * coslat;
+    double const dy =  (double) pb.lat - pa.lat;
+    double const len2 = dx*dx + dy*dy;
+
+    // Le Node le plus eloigne du segment [a,b] (de a si a == b : boucle)
+    double dmax = tol*tol * ((len2 > 0) ? len2 : 1);
+    unsigned imax = 0;
+    for (unsigned i = a+1; i < b; ++i)
     {
-      checkSyntax ((c >= '0') && (c <= '9'));
-      val = val*10 + (int) (c - '0');
-      lsb /= 10;
+      const LatLon &p = m_nodes.pos[ix[i]];
+      double const px = ((double) p.lon - pa.lon) * coslat;
+      double const py =  (double) p.lat - pa.lat;
+      double const cross = px*dy - py*dx;
+      double const d2 = (len2 > 0) ? cross*cross : px*px + py*py;
+      if (d2 > dmax) { dmax = d2; imax = i; }
     }
+    if (imax == 0) continue;
+
+    m_dpKeep[imax] = true;
+    ++kept;
+    m_dpStack.push_back (a);
+    m_dpStack.push_back (imax);
+    m_dpStack.push_back (imax);
+    m_dpStack.push_back (b);
   }
 
-  val *= lsb;
-  return (negative) ? -val : val;
+  if ((ix[0] == ix[n-1]) && (kept < 4)) return false;
+  if (kept == n) return true;
+
+  // Compacter sur place, la derniere ligne de m_wayNodes raccourcit
+  unsigned k = 0;
+  for (unsigned i = 0; i < n; ++i)
+    if (m_dpKeep[i]) ix[k++] = ix[i];
+  m_wayNodes.shrinkLast (kept);
+  return true;
 }
 
-}  // namespace osm
 
+//-----------------------------
+// IdBitmap
+
+IdBitmap::~IdBitmap ()
+{
+  for (unsigned i = 0; i < m_direct.size(); ++i)
+    delete[] m_direct[i];
+  for (std::map<uint64_t, uint32_t *>::iterator i = m_far.begin(); i != m_far.end(); ++i)
+    delete[] i->second;
+}
+
+uint32_t *IdBitmap::newPage (uint64_t n)
+{
+  uint32_t *p = new uint32_t[(pageMask + 1) / 32];
+  memset (p, 0, (pageMask + 1) / 8);
+  if (n < maxDirect)
+  {
+    if (n >= m_direct.size()) m_direct.resize (n + 1, NULL);
+    m_direct[n] = p;
+  }
+  else
+    m_far[n] = p;
+  return p;
+}
+
+size_t IdBitmap::size (void) const
+{
+  size_t pages = m_far.size();
+  for (unsigned i = 0; i < m_direct.size(); ++i)
+    if (m_direct[i] != NULL) ++pages;
+  return pages * ((pageMask + 1) / 8) + m_direct.capacity() * sizeof(uint32_t *);
+}
+
+
+//-----------------------------
+// Premiere lecture de clipCompleteWays
+// + Les Node precedent les Way, et les Way les Relation : quand un Way est
+//   lu, on sait deja lesquels de ses Node sont dans le pave
+
+inline void OSMDataCommon::ClipScan::newNode (id_t id, const LatLon &pos)
+{
+  if (m_clip.contains (pos))
+  {
+    m_inBox.set (id);
+    nodes.set (id);
+  }
+}
+
+inline void OSMDataCommon::ClipScan::newWay (id_t id)
+{
+  m_id = id;
+  m_refs.clear();
+  m_touch = false;
+  m_inway = true;
+}
+
+inline void OSMDataCommon::ClipScan::newND (id_t id)
+{
+  if (! m_inway) return;
+  m_refs.push_back (id);
+  if (m_inBox.test (id)) m_touch = true;
+}
+
+inline void OSMDataCommon::ClipScan::endWay (void)
+{
+  // Un Way qui touche le pave est garde entier
+  if (m_inway && m_touch)
+  {
+    ways.set (m_id);
+    for (unsigned i = 0; i < m_refs.size(); ++i)
+      nodes.set (m_refs[i]);
+  }
+  m_inway = false;
+}
+
+inline void OSMDataCommon::ClipScan::newRelation (id_t id)
+{
+  m_id = id;
+  m_touch = false;
+  m_inrel = true;
+}
+
+inline void OSMDataCommon::ClipScan::newMember (id_t id, enum eltType elt, const XML_Char *)
+{
+  if (! m_inrel) return;
+  switch (elt)
+  {
+    case eltNode     : if (m_inBox.test (id))    m_touch = true; break;
+    case eltWay      : if (ways.test (id))       m_touch = true; break;
+    case eltRelation : if (relations.test (id))  m_touch = true; break;
+  }
+}
+
+inline void OSMDataCommon::ClipScan::endRelation (void)
+{
+  if (m_inrel && m_touch)
+    relations.set (m_id);
+  m_inrel = false;
+}
+
+
+//-----------------------------
+// Remplissage d'un Batch, avec les memes regles que OSMData
+
+void OSMDataCommon::Batch::setFileBound (const LatLonBox &box)
+{
+  hasBound = true;
+  bound = box;
+}
+
+void OSMDataCommon::Batch::newNode (id_t id, const LatLon &pos)
+{
+  Elt e;
+  e.id = id;
+  e.pos = pos;
+  e.action = m_action;
+  e.tags = kv.size();
+  e.ntags = 0;
+  e.refs = e.nrefs = 0;
+  nodes.push_back (e);
+  m_cur = &nodes;
+}
+
+void OSMDataCommon::Batch::endNode (void)
+{
+  m_cur = NULL;
+}
+
+void OSMDataCommon::Batch::newWay (id_t id)
+{
+  Elt e;
+  e.id = id;
+  e.pos.lat = e.pos.lon = 0;
+  e.action = m_action;
+  e.tags = kv.size();
+  e.ntags = 0;
+  e.refs = refs.size();
+  e.nrefs = 0;
+  ways.push_back (e);
+  m_cur = &ways;
+  m_inway = true;
+}
+
+void OSMDataCommon::Batch::newND (id_t id)
+{
+  if (! m_inway) return;
+  refs.push_back (id);
+  ++ways.back().nrefs;
+}
+
+void OSMDataCommon::Batch::endWay (void)
+{
+  m_cur = NULL;
+  m_inway = false;
+}
+
+void OSMDataCommon::Batch::newRelation (id_t id)
+{
+  Elt e;
+  e.id = id;
+  e.pos.lat = e.pos.lon = 0;
+  e.action = m_action;
+  e.tags = kv.size();
+  e.ntags = 0;
+  e.refs = members.size();
+  e.nrefs = 0;
+  relations.push_back (e);
+  m_cur = &relations;
+  m_inrel = true;
+}
+
+void OSMDataCommon::Batch::newMember (id_t id, enum eltType elt, const XML_Char *role)
+{
+  if (! m_inrel) return;
+  Member m;
+  m.id = id;
+  m.elt = elt;
+  m.role = addString (role, strlen (role));
+  members.push_back (m);
+  ++relations.back().nrefs;
+}
+
+void OSMDataCommon::Batch::endRelation (void)
+{
+  m_cur = NULL;
+  m_inrel = false;
+}
+
+void OSMDataCommon::Batch::addTag (const XML_Char *key, const XML_Char *value)
+{
+  if (m_cur == NULL) return;
+  Elt &e = m_cur->back();
+  kv.push_back (addString (key, strlen (key)));
+  kv.push_back (addString (value, strlen (value)));
+  ++e.ntags;
+}
+
+
+// "[-]NNN.NNNNNNN"
+// + Le decodage scalaire d'origine est scalarLatLon(), cf Decode.h
+int OSMDataCommon::fixedlatlon (const char *str)
+{
+  return decodeLatLon (str);
+}
+
+
+//-----------------------------
+// Instances de BasicOSMData (cf OSM_FOR_EACH_CONFIG)
+// + ParseNativeXml et LoadParallelXml sont dans OSMXml.cpp, LoadPBF dans
+//   OSMPbf.cpp
+
+#define INSTANTIATE(Cfg)  template class BasicOSMData<Cfg>;
+OSM_FOR_EACH_CONFIG (INSTANTIATE)
+#undef INSTANTIATE
+
+}  // namespace osm
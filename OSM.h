@@ -2,7 +2,7 @@
 /// @brief Open Street Map  geo data tools
 ///
 /// TODO:
-/// + Support a PBF reader
+/// + PBF : les blocs "lzma"/"zstd" ne sont pas supportes (seulement "raw" et "zlib")
 
 #ifndef _H_OSM
 #define _H_OSM
@@ -11,12 +11,20 @@
 #include <math.h>
 #include <vector>
 #include <map>
+#include <string>
+#include <algorithm>
+#include <iterator>
 
 // private only
 #include "expat.h"
 
 //-------------------------------------------------------------------------------
 // A) Liste de quelques choix d'organisation de la representation d'un OSM
+//
+// Ces choix sont des politiques de compilation (cf FullConfig, LeanConfig,
+// IdlessConfig) : OSMData est un BasicOSMData<FullConfig>, et des BasicOSMData
+// d'autres configurations peuvent coexister dans un meme programme, etre
+// choisies a l'execution et comparees sur le meme fichier (cf "testosm -L")
 
 // Choix : les id XML contiennent au moins [0..2^63-1] car un id=""
 //         est un unsignedLong XML d'apres le schema OSM XML
@@ -28,8 +36,8 @@
 // Est-il rentable de limiter a 32 ? Cf temps de LoadText("rhone-alpes.osm") (2.4Go) :
 //   32b = 75.2s  64b = 77.3s  (GCC 4.5 -O2 / core-i5)
 // Ce choix influe donc essentiellement sur la RAM, assez peu sur le CPU
-#define OSM_ID32                // Limit IDs to 32 bits
-#undef  OSM_ID32                // IDs use 64bits (OSM/XML spec)
+// => Les id lus, et les index id -> element, restent sur 64 bits (id_t).
+//    Config::id_type est la taille de l'id memorise par chaque element
 
 // Choix : un element OSM (Node,Way,Relation) en memoire doit-il memoriser son
 //         propre id XML ?
@@ -43,8 +51,7 @@
 // It is unclear if ID's are "planet.osm wide" or if two OSM files may use the
 // same ID value for differents elements. Seems true for OSM files comming
 // directly from the "server".
-#undef  OSM_ID_STORED           // ID's are forgotten
-#define OSM_ID_STORED           // Every Element stores it's ID
+// => Config::id_type void : les id sont oublies (id() vaut 0)
 
 // Choix : un Node peut toujours etre tagge, mais cela occupe beaucoup de
 //         RAM pour rien, car la grande majorite des Node d'un OSM n'a pas
@@ -53,10 +60,11 @@
 //         tag, et d'enregistrer dans les Way directement la latlon des
 //         Node qu'il reference
 // Supporter deux types de Node, PoorNode et RichNode est plus difficile a gerer
+// => Config::nodeTagged false : un Node n'est qu'une position, les tags des
+//    Node lus sont ignores
 
-#undef  OSM_NODE_TAGGED         // All nodes are stored
-#define OSM_NODE_TAGGED         // Only tagged nodes are stored
 
+class IByteFileReader;
 
 //-------------------------------------------------------------------------------
 // B) namespace osm : definition des types OSM en memoire
@@ -89,8 +97,8 @@ inline double canonicalDeg (double g)
 struct LatLon
 {
   latlon_t lat, lon;
-  inline double degLat(void) { return degree (lat); }
-  inline double degLon(void) { return degree (lon); }
+  inline double degLat(void) const { return degree (lat); }
+  inline double degLon(void) const { return degree (lon); }
 };
 
 
@@ -114,7 +122,7 @@ public:
 
   // Etendre le pave pour qui'il contienne le point donne
   // + close() is the required initial state
-  inline void extend (LatLon &ll)
+  inline void extend (const LatLon &ll)
   {
     if (ll.lat < min.lat) min.lat = ll.lat;
     if (ll.lat > max.lat) max.lat = ll.lat;
@@ -122,6 +130,20 @@ public:
     if (ll.lon > max.lon) max.lon = ll.lon;
   }
 
+  // "Le point est dans le pave" (bords compris)
+  inline bool contains (const LatLon &ll) const
+  {
+    return (ll.lat >= min.lat) && (ll.lat <= max.lat) &&
+           (ll.lon >= min.lon) && (ll.lon <= max.lon);
+  }
+
+  // "Le pave est tout le domaine" (cf open())
+  inline bool isOpen (void) const
+  {
+    return (min.lat <= -LATLONMAX) && (min.lon <= -LATLONMAX) &&
+           (max.lat >=  LATLONMAX) && (max.lon >=  LATLONMAX);
+  }
+
   // C# put/get is better ...
   inline double degMinLat(void) { return degree (min.lat); }
   inline double degMaxLat(void) { return degree (max.lat); }
@@ -135,6 +157,7 @@ private:
 
 // Un niveau de zoom : cela va de 0 a 17
 typedef unsigned zoom_t;
+const zoom_t maxZoom = 17;      // Tous les details
 
 
 // Un identifiant d'element de fichier OSM / XML
@@ -144,17 +167,209 @@ typedef unsigned zoom_t;
 //   Les std::map::find de id_t sont le premier poste de cout pour gprof
 //   Donc il peut y avoir un interet de perfo a rester sur 32 bits ... qui semble suffisant
 //   dans les fichiers OSM vus (en 2011, mais la croissance est exponentielle)
+// + L'id memorise dans un element peut etre plus court, cf Config::id_type
 
-#ifndef OSM_ID32
-  typedef uint64_t id_t;        // unsignedLong XML, "API v0.6/XSD" conformant
-#else
-  typedef uint32_t id_t;        // RAM is expensive ...
-#endif
+typedef uint64_t id_t;          // unsignedLong XML, "API v0.6/XSD" conformant
+
+
+// Configurations de OSMData (cf A)
+// + id_type : type de l'id memorise par chaque element, void pour aucun
+// + nodeTagged : un Node peut porter des tags
+// Une autre configuration se declare de meme, et s'ajoute a
+// OSM_FOR_EACH_CONFIG pour etre instanciee
+struct FullConfig               // Conforme a la spec, la reference
+{
+  typedef uint64_t id_type;
+  static const bool nodeTagged = true;
+};
+
+struct LeanConfig               // RAM is expensive ...
+{
+  // Un id au dela de 2^32 (plus de 10^10 Node en 2020) est tronque : id()
+  // n'est qu'indicatif, mais la lecture et les index restent sur 64 bits
+  typedef uint32_t id_type;
+  static const bool nodeTagged = false;
+};
+
+struct IdlessConfig             // ID's are forgotten
+{
+  typedef void id_type;
+  static const bool nodeTagged = true;
+};
+
+// X(Config) pour chacune des configurations instanciees dans OSM*.cpp
+#define OSM_FOR_EACH_CONFIG(X)  X(FullConfig) X(LeanConfig) X(IdlessConfig)
 
 
 // Les trois types elements d'un OSM : Node, Way, Relation
 enum eltType { eltNode, eltWay, eltRelation };
 
+
+// Un ensemble d'ID, en bitmap par pages allouees a la demande
+// + Un extrait ne touche que peu de pages : la RAM suit la taille de
+//   l'extrait, pas celle de l'espace des ID (plus de 10^10 Node en 2020)
+// + Les ID negatifs (fichiers JOSM) ou enormes sont dans une map de pages
+class IdBitmap
+{
+public:
+  IdBitmap () {}
+  ~IdBitmap ();
+
+  inline void set (id_t id)
+  {
+    uint64_t const n = (uint64_t) id >> pageBits;
+    uint32_t *p = findPage (n);
+    if (p == NULL) p = newPage (n);
+    unsigned const b = (unsigned) id & pageMask;
+    p[b >> 5] |= 1u << (b & 31);
+  }
+
+  inline bool test (id_t id) const
+  {
+    const uint32_t *p = findPage ((uint64_t) id >> pageBits);
+    if (p == NULL) return false;
+    unsigned const b = (unsigned) id & pageMask;
+    return (p[b >> 5] >> (b & 31)) & 1;
+  }
+
+  // RAM occupee, en octets
+  size_t size (void) const;
+
+private:
+  static const unsigned pageBits = 16;          // 64K ID = 8 Ko par page
+  static const unsigned pageMask = (1u << pageBits) - 1;
+  static const uint64_t maxDirect = 1u << 26;   // Acces direct : ID < 2^42
+
+  std::vector<uint32_t *> m_direct;
+  std::map<uint64_t, uint32_t *> m_far;
+
+  inline uint32_t *findPage (uint64_t n) const
+  {
+    if (n < m_direct.size()) return m_direct[n];
+    if (n < maxDirect) return NULL;
+    std::map<uint64_t, uint32_t *>::const_iterator i = m_far.find (n);
+    return (i == m_far.end()) ? NULL : i->second;
+  }
+  uint32_t *newPage (uint64_t n);
+
+  IdBitmap (const IdBitmap &);                  // Non copiable
+  void operator= (const IdBitmap &);
+};
+
+
+// Un index "id XML" -> "index dans un vector" (cf OSMData::m_idnodes)
+// + std::map coute ~48 octets et une allocation par entree, et son find()
+//   est le premier poste de gprof au chargement. D'ou plusieurs versions
+//   (cf IdIndex.cpp, et "testosm -b" pour les comparer) :
+//   idMap    : std::map, la reference
+//   idHash   : table de hachage a adressage ouvert, 16 octets par place
+//   idSorted : tableau trie par ajout en fin (les id d'un OSM arrivent en
+//              ordre croissant), recherche par interpolation. Un id en
+//              desordre va dans une std::map annexe
+//   idDense  : tableau direct id - base, 4 octets par id de la plage. Pour
+//              les plages d'id compactes (fichier renumerote, etc). Un id
+//              trop loin de la plage va dans une std::map annexe
+// Toutes admettent n'importe quel id, et donnent le meme resultat
+class IIdIndex
+{
+public:
+  virtual ~IIdIndex () {}
+
+  virtual void set (id_t id, unsigned ix) = 0;    // Ajoute ou remplace
+  virtual int  find (id_t id) const = 0;          // -1 si absent
+
+  // Ajouter si absent, et retourner false sinon (l'element est deja charge)
+  virtual bool insert (id_t id, unsigned ix)
+  {
+    if (find (id) >= 0) return false;
+    set (id, ix);
+    return true;
+  }
+  virtual void erase (id_t id) = 0;
+  virtual size_t size (void) const = 0;
+  virtual size_t memory (void) const = 0;         // Octets occupes (environ)
+
+  // Les index >= first deviennent remap[index - first], ou sont retires
+  // si celui-ci est < 0
+  virtual void renumber (unsigned first, const std::vector<int> &remap) = 0;
+
+  // out[i] = find (ids[i]), pour des ids croissants (cf OSMData::m_refMode)
+  // + idSorted en fait une fusion avec son tableau, les autres des find()
+  virtual void findSorted (const id_t *ids, int *out, size_t n) const
+  {
+    for (size_t i = 0; i < n; ++i)
+      out[i] = find (ids[i]);
+  }
+};
+
+enum idIndexKind { idMap, idHash, idSorted, idDense };
+
+IIdIndex *NewIdIndex (idIndexKind kind);
+
+// Position de id dans items[0..n), tries par id croissant, ou -1 (cf idSorted
+// et storeSparse)
+// + idOf(items[i]) est l'id de items[i]
+// + Une etape par interpolation, une par dichotomie : l'interpolation seule
+//   degenere sur une repartition tres inegale (saut d'id d'un import, etc)
+template<class T, class IdOf>
+long interpolationSearch (const T *items, size_t n, id_t id, IdOf idOf)
+{
+  if ((n == 0) || (id < idOf (items[0])) || (id > idOf (items[n - 1]))) return -1;
+
+  size_t lo = 0, hi = n - 1;
+  for (bool interpolate = true; hi - lo > 8; interpolate = ! interpolate)
+  {
+    size_t mid;
+    if (interpolate)
+      mid = lo + (size_t) ((double) (id - idOf (items[lo])) /
+                           (double) (idOf (items[hi]) - idOf (items[lo])) * (double) (hi - lo));
+    else
+      mid = lo + (hi - lo) / 2;
+    if (mid > hi) mid = hi;
+
+    if (idOf (items[mid]) < id)
+      lo = mid + 1;
+    else if (idOf (items[mid]) > id)
+      hi = mid - 1;
+    else
+      return (long) mid;
+    if ((id < idOf (items[lo])) || (id > idOf (items[hi]))) return -1;
+  }
+
+  for (size_t i = lo; i <= hi; ++i)
+    if (idOf (items[i]) == id) return (long) i;
+  return -1;
+}
+
+
+// Positions des Node, par id, dans un fichier mappe en memoire (cf
+// OSMData::m_nodeStore et NodeStore.cpp)
+// + La RAM n'en garde que les pages recemment touchees : le noyau les ecrit
+//   dans le fichier et les oublie au besoin
+// + storeDense : un LatLon (8 octets) par id, a la position id du fichier.
+//   Les id non vus sont des trous du fichier, qui n'occupent pas le disque.
+//   Pour le planet (10^10 id), il faut un espace d'adressage 64 bits
+// + storeSparse : des couples (id, LatLon) tries, 16 octets par Node vu,
+//   recherche par interpolation. Pour les extraits
+// + filename NULL : fichier temporaire, oublie a la destruction. Sinon le
+//   fichier est repris s'il existe : on peut y ranger les Node d'un OSM,
+//   puis charger plus tard les Way d'un autre
+// + Un id hors du fichier (storeDense : >= 2^40 ou negatif ; storeSparse :
+//   en desordre) est garde en RAM, et n'est pas conserve dans le fichier
+class INodeStore
+{
+public:
+  virtual ~INodeStore () {}
+
+  virtual void set (id_t id, const LatLon &pos) = 0;
+  virtual bool get (id_t id, LatLon &pos) const = 0;   // false si absent
+};
+
+enum nodeStoreKind { storeDense, storeSparse };
+
+// NULL si le fichier ne peut etre ouvert
+INodeStore *NewNodeStore (nodeStoreKind kind, const char *filename = NULL);
+
 // Noms de proprietes usuelles
 // + Le format OSM permet de stocker n'importe quel tags "key=value", neanmoins
 //   l'usage prevoit certains "key" :
@@ -166,37 +381,347 @@ enum eltType { eltNode, eltWay, eltRelation };
 //   Mais cela melangerait l'objet et son rendu ... donc on se contente ici
 //   de memoriser des chaines de caracteres usuelles, pour perfos (memoire,
 //   int==int au lieu de strcmp, etc ?)
+// + Ces chaines sont les premiers atomes (cf atom_t) : la valeur de l'enum est
+//   l'atome de la chaine, sans recherche
 //
 enum commonTag
 {
   tagNil = 0,
-  tagHighway,
-      tagMotorway, tagMotorwayLink, tagTrunk, tagTrunkLink, tagPrimary,
-      tagPrimaryLink,
-  tagTrafficCalming,
-  tagService,
-  tagBoundary,
-      tagAdministrative, tagCivil, tagPolitical, tagMaritime,
+
+  // Proprietes
+  tagName, tagRef, tagType, tagLayer, tagLevel, tagArea, tagOneway,
+  tagBridge, tagTunnel, tagLanes, tagMaxspeed, tagSurface, tagAccess,
+  tagWidth, tagHeight, tagBuildingLevels, tagEle, tagAdminLevel,
+  tagPopulation, tagOperator, tagSource, tagNote, tagWikipedia,
+  tagWikidata, tagAddrHousenumber, tagAddrStreet, tagAddrPostcode,
+  tagAddrCity,
+
+  // Elements de Map_Features
+  tagAerialway, tagAeroway, tagAmenity, tagBarrier, tagBoundary,
+  tagBuilding, tagCraft, tagEmergency, tagHighway, tagHistoric, tagLanduse,
+  tagLeisure, tagManMade, tagMilitary, tagNatural, tagOffice, tagPlace,
+  tagPower, tagPublicTransport, tagRailway, tagRoute, tagShop, tagSport,
+  tagTourism, tagWater, tagWaterway,
+
+  // Valeurs
+  tagYes, tagNo,
+  tagMotorway, tagMotorwayLink, tagTrunk, tagTrunkLink, tagPrimary,
+  tagPrimaryLink, tagSecondary, tagSecondaryLink, tagTertiary,
+  tagTertiaryLink, tagUnclassified, tagResidential, tagLivingStreet,
+  tagService, tagTrack, tagPedestrian, tagFootway, tagCycleway, tagPath,
+  tagSteps, tagTrafficCalming,
+  tagRail, tagLightRail, tagSubway, tagTram, tagAbandoned,
+  tagRiver, tagStream, tagCanal, tagDitch, tagDrain, tagRiverbank,
+  tagCoastline, tagWood, tagForest, tagScrub, tagGrassland, tagTree,
+  tagFarmland, tagMeadow, tagGrass, tagIndustrial, tagCommercial,
+  tagRetail, tagCemetery, tagPark, tagGarden, tagPitch, tagParking,
+  tagSchool, tagPlaceOfWorship, tagRestaurant,
+  tagHouse, tagApartments, tagGarage,
+  tagAdministrative, tagCivil, tagPolitical, tagMaritime, tagCountry,
+  tagState, tagCity, tagTown, tagVillage, tagHamlet, tagSuburb,
+  tagLocality,
+  tagAerodrome, tagMultipolygon, tagAsphalt, tagUnpaved,
 
   // Nombre de chaines predefinies
   tagCommonCount
 };
 
-//extern XML_Char *commonTagStr[(int) tagCommonCount];
+// Chaines des commonTag, dans l'ordre de l'enum
+extern const char *const commonTagStr[(int) tagCommonCount];
+
+// Chaine de tag (key ou value) internee : chaque chaine vue n'est memorisee
+// qu'une fois, et designee par son numero. Comparer deux chaines, c'est
+// comparer deux entiers
+// + tagNil (0) est la chaine vide, puis viennent les commonTag
+// + Les atomes sont propres a un OSMData (cf TagArena) : hors des commonTag,
+//   deux OSMData ne donnent pas le meme numero a la meme chaine
+typedef uint32_t atom_t;
 
-union tagString         // UTF-8  (char compatible)
+// commonTag de str, ou tagNil si ce n'en est pas un
+atom_t findCommonTag (const char *str);
+
+struct tagPair
 {
-  enum commonTag index;        // Valid only if < tagStringCount
-  const char    *pntr;
+  atom_t key, value;
+};
 
-  inline const char *str(void)
-//{ return ((unsigned) index < tagCommonCount) ? commonTagStr[index] : pntr; }
-  { return pntr; }
+// Valeurs de quelques tags usuels, decodees une fois au chargement (cf
+// OSMData::storeTag), pour ne pas avoir a relire leur chaine
+// + 0 : tag absent ou valeur non comprise
+struct TagValues
+{
+  uint16_t height;              // height, en dm (les pieds sont convertis)
+  uint8_t levels;               // building:levels
+  uint8_t maxspeed;             // maxspeed, en km/h (les mph sont convertis)
+  uint8_t lanes;                // lanes
+  int8_t oneway;                // oneway : 1 sens du Way, -1 sens inverse
+  int8_t area;                  // area : 1 yes, -1 no
+  uint8_t unused;
+
+  static const uint8_t maxspeedNone = 255;      // maxspeed=none
 };
 
-struct tagPair
+// Decoder la valeur d'un tag, si key est l'un de ceux de TagValues
+void decodeValue (TagValues &values, atom_t key, const char *value);
+
+// Tags d'un element : count paires a partir de pairs[first] de sa TagArena,
+// triees par key
+// + values n'a de sens que si count != 0
+struct TagRun
 {
-  union tagString key, value;
+  uint32_t first, count;
+  TagValues values;
+};
+
+// Tableau de T en RAM (std::vector), ou vue sur un fichier mappe (cf
+// OSMData::OpenSnapshot)
+// + m_data et m_size suivent m_vec : la lecture d'un T ne teste pas d'ou il
+//   vient
+// + Un Column mappe est recopie en RAM des que sa taille change. Un T modifie
+//   sur place ne touche que sa page (mapping prive)
+template<class T>
+class Column
+{
+public:
+  Column () : m_data (NULL), m_size (0), m_mapped (false) {}
+  Column (const Column &c) : m_vec (c.begin(), c.end()), m_mapped (false) { sync(); }
+  Column &operator= (const Column &c)
+  {
+    std::vector<T> (c.begin(), c.end()).swap (m_vec);
+    m_mapped = false;
+    sync();
+    return *this;
+  }
+
+  inline size_t size (void) const { return m_size; }
+  inline bool empty (void) const { return m_size == 0; }
+  inline size_t capacity (void) const { return m_mapped ? m_size : m_vec.capacity(); }
+  inline bool mapped (void) const { return m_mapped; }
+
+  inline const T& operator[] (size_t i) const { return m_data[i]; }
+  inline T& operator[] (size_t i) { return m_data[i]; }
+  inline const T *begin (void) const { return m_data; }
+  inline const T *end (void) const { return m_data + m_size; }
+  inline T *begin (void) { return m_data; }
+  inline T *end (void) { return m_data + m_size; }
+  inline const T& back (void) const { return m_data[m_size - 1]; }
+  inline T& back (void) { return m_data[m_size - 1]; }
+
+  inline void push_back (const T &v) { own(); m_vec.push_back (v); sync(); }
+  inline void reserve (size_t n) { own(); m_vec.reserve (n); sync(); }
+  inline void resize (size_t n) { own(); m_vec.resize (n); sync(); }
+  inline void resize (size_t n, const T &v) { own(); m_vec.resize (n, v); sync(); }
+  inline void clear (void) { own(); m_vec.clear(); sync(); }
+
+  // Rendre la RAM non employee
+  inline void shrink (void) { own(); std::vector<T> (m_vec).swap (m_vec); sync(); }
+
+  // Octets occupes (ceux d'un Column mappe sont dans le cache du noyau)
+  inline size_t memory (void) const { return capacity() * sizeof (T); }
+
+  // Devenir une vue sur les n T de data, qui doivent survivre a ce Column
+  inline void map (const T *data, size_t n)
+  {
+    std::vector<T> ().swap (m_vec);
+    m_data = const_cast<T *> (data);
+    m_size = n;
+    m_mapped = true;
+  }
+
+private:
+  std::vector<T> m_vec;
+  T *m_data;
+  size_t m_size;
+  bool m_mapped;
+
+  inline void sync (void)
+  {
+    m_data = m_vec.empty() ? NULL : &m_vec[0];
+    m_size = m_vec.size();
+  }
+  inline void own (void)
+  {
+    if (! m_mapped) return;
+    m_vec.assign (m_data, m_data + m_size);
+    m_mapped = false;
+    sync();
+  }
+};
+
+// Tableau de T par blocs de blockSize T, qui ne sont jamais deplaces
+// (cf OSMData::m_nodes, m_ways, m_relations)
+// + Grandir alloue un bloc de plus, sans recopier les T deja la : un
+//   std::vector de 11M Node recopiait ses 100+ Mo a chaque doublement, et
+//   occupait alors jusqu'a deux fois sa taille. Un T& reste valide
+// + L'acces est un decalage et un masque de plus qu'un tableau. Les blocs
+//   ne sont pas contigus entre eux : pas de begin()/end()
+// + Peut etre la vue d'un snapshot : chaque bloc designe alors sa part des
+//   T mappes, et seul le dernier, s'il est incomplet, est recopie en RAM
+//   quand le tableau grandit
+// + reserve() ne dimensionne que la table des blocs
+template<class T>
+class BlockColumn
+{
+public:
+  static const unsigned blockBits = 14;
+  static const size_t blockSize = (size_t) 1 << blockBits;   // T par bloc
+
+  BlockColumn () : m_size (0), m_capacity (0), m_mapped (0) {}
+  ~BlockColumn () { release(); }
+
+  inline size_t size (void) const { return m_size; }
+  inline bool empty (void) const { return m_size == 0; }
+  inline size_t capacity (void) const { return m_capacity; }
+  inline bool mapped (void) const { return m_mapped != 0; }
+
+  inline const T& operator[] (size_t i) const { return m_blocks[i >> blockBits][i & (blockSize - 1)]; }
+  inline T& operator[] (size_t i) { return m_blocks[i >> blockBits][i & (blockSize - 1)]; }
+  inline const T& back (void) const { return (*this)[m_size - 1]; }
+  inline T& back (void) { return (*this)[m_size - 1]; }
+
+  // Le bloc b, et son nombre de T (cf SaveSnapshot)
+  inline unsigned blocks (void) const { return (m_size + blockSize - 1) >> blockBits; }
+  inline const T *block (unsigned b) const { return m_blocks[b]; }
+  inline size_t blockCount (unsigned b) const
+  { return std::min (blockSize, m_size - ((size_t) b << blockBits)); }
+
+  inline void push_back (const T &v)
+  {
+    if (m_size == m_capacity) grow (m_size + 1);
+    (*this)[m_size++] = v;
+  }
+  inline void pop_back (void) { --m_size; }
+
+  // Les T ajoutes valent T()
+  inline void resize (size_t n) { resize (n, T()); }
+  inline void resize (size_t n, const T &v)
+  {
+    if (n > m_capacity) grow (n);
+    for (size_t i = m_size; i < n; ++i)
+      (*this)[i] = v;
+    m_size = n;
+  }
+  inline void reserve (size_t n) { m_blocks.reserve ((n + blockSize - 1) >> blockBits); }
+  inline void clear (void) { m_size = 0; }
+
+  // Rendre les blocs alloues non employes
+  inline void shrink (void)
+  {
+    const size_t keep = std::max<size_t> (blocks(), m_mapped);
+    if (keep < m_blocks.size())
+    {
+      for (size_t b = keep; b < m_blocks.size(); ++b)
+        delete [] m_blocks[b];
+      m_blocks.resize (keep);
+      m_capacity = keep * blockSize;
+    }
+    std::vector<T *> (m_blocks).swap (m_blocks);
+  }
+
+  // Octets occupes (ceux des blocs mappes sont dans le cache du noyau)
+  inline size_t memory (void) const
+  { return (m_blocks.size() - m_mapped) * blockSize * sizeof (T) + m_blocks.capacity() * sizeof (T *); }
+
+  // Devenir une vue sur les n T de data, qui doivent survivre a ce tableau
+  inline void map (const T *data, size_t n)
+  {
+    release();
+    for (size_t i = 0; i < n; i += blockSize)
+      m_blocks.push_back (const_cast<T *> (data) + i);
+    m_mapped = m_blocks.size();
+    m_size = m_capacity = n;
+  }
+
+private:
+  std::vector<T *> m_blocks;
+  size_t m_size;
+  size_t m_capacity;            // T ecrivables : le dernier bloc mappe peut etre incomplet
+  size_t m_mapped;              // Premiers blocs, mappes (pas alloues)
+
+  BlockColumn (const BlockColumn &);                  // Non copiable
+  void operator= (const BlockColumn &);
+
+  void grow (size_t n)
+  {
+    // Le dernier bloc mappe est incomplet : le recopier
+    if (m_capacity & (blockSize - 1))
+    {
+      T *const b = new T[blockSize]();
+      std::copy (m_blocks.back(), m_blocks.back() + (m_capacity & (blockSize - 1)), b);
+      m_blocks.back() = b;
+      --m_mapped;
+      m_capacity = m_blocks.size() * blockSize;
+    }
+    while (m_capacity < n)
+    {
+      m_blocks.push_back (new T[blockSize]());
+      m_capacity += blockSize;
+    }
+  }
+
+  void release (void)
+  {
+    for (size_t b = m_mapped; b < m_blocks.size(); ++b)
+      delete [] m_blocks[b];
+    std::vector<T *> ().swap (m_blocks);
+    m_mapped = 0;
+    m_size = m_capacity = 0;
+  }
+};
+
+class StringStock;
+
+// Les tags d'un OSMData : les paires de tous ses elements, bout a bout, et
+// les chaines de ses atomes (cf OSMData::m_tagArena)
+// + Les paires d'un element sont ajoutees en fin pendant sa lecture (cf
+//   OSMData::storeTag), et les chaines dans des blocs de 64 Ko : aucune
+//   allocation par element ni par chaine
+// + Detruire l'OSMData rend le tout en quelques free() (un par bloc), et
+//   le snapshot qu'il a mappe : recharger dans un process qui dure ne laisse
+//   rien derriere, ni des chaines d'une region qui n'est plus chargee
+// + Un TagRun ne designe pas sa TagArena : elle est donnee a la lecture
+//   (IElement::tags (arena), NodeTable). Aucun etat global, les OSMData
+//   sont independants, d'un thread a l'autre
+class TagArena
+{
+public:
+  TagArena ();
+  ~TagArena ();
+
+  Column<tagPair> pairs;        // Peut etre la vue d'un snapshot
+
+  // Atome de str, ajoute s'il n'a jamais ete vu
+  atom_t addAtom (const char *str);
+
+  // Atome de str, ou tagNil si cette chaine n'a jamais ete vue
+  atom_t findAtom (const char *str) const;
+
+  // Chaine (UTF-8) d'un atome
+  const char *atomString (atom_t atom) const;
+
+  // Nombre d'atomes
+  unsigned atomCount (void) const;
+
+  // Ajouter count atomes, dont les chaines sont mises bout a bout dans strings
+  // (et y restent : pas de copie). Cf OSMData::OpenSnapshot
+  // + false si des atomes autres que les commonTag existent deja : les atomes
+  //   ajoutes n'auraient pas les numeros voulus
+  bool mapAtoms (const char *strings, unsigned count);
+
+  // Garder le fichier mappe (ou lu) ou pointent pairs et les atomes, et le
+  // rendre avec cette TagArena (cf OpenSnapshot)
+  void adopt (const char *base, size_t size);
+
+  // Octets occupes (environ)
+  size_t memory (void) const;
+
+private:
+  StringStock *m_strings;
+  const char *m_mapped;         // Cf adopt
+  size_t m_mappedSize;
+
+  TagArena (const TagArena &);                        // Non copiable
+  void operator= (const TagArena &);
 };
 
 
@@ -219,15 +744,18 @@ struct tagPair
 //                            poorRel =   1  richRel = 17k
 //   Mais la proportion de Node sans tag justifie que l'on specialise la classe Node
 //   en "avec" ou "sans" tag.
+// + Les tags sont donc des paires d'atomes dans la TagArena de l'OSMData, et
+//   un Tags n'est qu'une vue sur celles d'un element, valide tant que
+//   celle-ci ne grandit pas (pas pendant un chargement)
+// + name, layer et la nature de l'element ne sont que des paires parmi les
+//   autres, trouvees par findTag
 class Tags
 {
 public:
-  // May have a ctor : is not un IElement, no ctor will be called by large containers
-  Tags() { Init(); }
-
-  // Usual tags
-  char *name;         // Not so usual ?  (UTF-8)
-  char layer;         // -5 .. 5,  0 == au sol, -1 == tunnel, etc
+  Tags () : m_pairs (NULL), m_arena (NULL), m_count (0), m_values () {}
+  Tags (const TagRun &run, const TagArena &arena)
+    : m_pairs (NULL), m_arena (NULL), m_count (0), m_values ()
+  { if (run.count != 0) set (run, arena); }
 
   enum Kind
   {
@@ -236,32 +764,61 @@ public:
     highway,
     waterway,
     railway
-  } kind;
+  };
 
-  unsigned short count;     // Stats : nombre de tags, nom compris
+  inline unsigned size (void) const { return m_count; }
+  inline bool isEmpty (void) const { return m_count == 0; }
+  inline const tagPair& operator[] (unsigned i) const { return m_pairs[i]; }
+  inline const tagPair *begin (void) const { return m_pairs; }
+  inline const tagPair *end (void) const { return m_pairs + m_count; }
 
-  // Discovered tags
-  // + L'examen de quelques OSM montre que de nombreux tags non documentes existent ...
-  // TODO: liste de chaines "Atom" : faire une map string->index et in vector index->string
-  //       des chaines trouvees.
-  //       initialiser cette map/vector avec les chaines predefinies par la "spec" d'emploi
-  //       d'OSM ("highway", etc), de sorte qu'elles soient reconnues par le code par un enum
-  //       connu a la compilation.
-  //       Pour les chaines "nom de propriete" : ok
-  //       Pour les chaines "valeur de propriete" : la valeur est a stocker dans sa traduction
-  //       binaire plutot que comme une chaine
-  std::vector<struct tagPair> pairs;    // ou *pairs pour eviter un ctor systematique ?
+  // Valeur du tag key, ou tagNil s'il est absent
+  inline atom_t findTag (atom_t key) const
+  {
+    if (key == tagNil) return tagNil;
+    unsigned lo = 0, hi = m_count;
+    while (lo < hi)
+    {
+      unsigned const mid = (lo + hi) / 2;
+      if (m_pairs[mid].key < key) lo = mid + 1; else hi = mid;
+    }
+    return ((lo < m_count) && (m_pairs[lo].key == key)) ? m_pairs[lo].value : (atom_t) tagNil;
+  }
 
-  inline void Init (void)
-  { name = NULL; layer = 0; kind = unknown; count = 0; }
+  // Chaine d'un atome de ces tags
+  inline const char *str (atom_t atom) const { return m_arena->atomString (atom); }
 
-  inline bool isEmpty (void)
-  { return (name == NULL) && (pairs.size() == 0); }
+  // Valeur du tag key, ou NULL s'il est absent (UTF-8)
+  const char *get (const char *key) const;
+
+  // Usual tags
+  const char *name (void) const;  // NULL si absent  (UTF-8)
+  int layer (void) const;         // -5 .. 5,  0 == au sol, -1 == tunnel, etc
+  Kind kind (void) const;
+
+  // Tags decodes au chargement (cf TagValues), 0 si absent
+  inline const TagValues &values (void) const { return m_values; }
+  inline float height (void) const { return m_values.height / 10.0f; }   // m
+  inline unsigned levels (void) const { return m_values.levels; }
+  inline unsigned maxspeed (void) const { return m_values.maxspeed; }    // km/h
+  inline unsigned lanes (void) const { return m_values.lanes; }
+  inline int oneway (void) const { return m_values.oneway; }
+  inline int area (void) const { return m_values.area; }
 
 private:
-};
+  const tagPair *m_pairs;
+  const TagArena *m_arena;
+  unsigned m_count;
+  TagValues m_values;
 
-extern Tags nilTags;   // Always empty
+  inline void set (const TagRun &run, const TagArena &arena)
+  {
+    m_pairs = &arena.pairs[run.first];
+    m_arena = &arena;
+    m_count = run.count;
+    m_values = run.values;
+  }
+};
 
 
 // Classe racine des elements OSM Node, Way, Relation
@@ -307,24 +864,39 @@ extern Tags nilTags;   // Always empty
 //        memoriser les latlon dans le Way. Quid des Relation qui detiennent des PoorNode ?
 //   => Il semble complique d'eloigner les IElement des capacites effectives du format OSM
 
-class IElement
+// Id memorise par un element (cf Config::id_type)
+// + Using an inline function has no cost and enables user code syntatic
+//   independance of Config::id_type
+template<class T>
+class ElementId
 {
 public:
+  static const unsigned idBits = 8 * sizeof (T);   // 0 : id non memorise
+
   // unique ID value of this OSM Element
-  // + Using an inline function has no cost and enables user code syntatic
-  //   independance of ODM_ID_STORED
-#ifdef OSM_ID_STORED
-  inline id_t id (void) const { return mID; };
-#else
-  inline id_t id (void) const { return 0; };   // 0 is not a valid OSM ID
-#endif
+  inline id_t id (void) const { return mID; }
+  inline void setId (id_t value) { mID = (T) value; }
+
+//protected:
+  T mID;              // Identifiant unique (dans un fichier ou pour tous ?)
+};
+
+template<>
+class ElementId<void>
+{
+public:
+  static const unsigned idBits = 0;
+
+  inline id_t id (void) const { return 0; }       // 0 is not a valid OSM ID
+  inline void setId (id_t) {}
+};
 
+template<class Cfg>
+class IElement : public ElementId<typename Cfg::id_type>
+{
+public:
   inline virtual void Init()
-  {
-#ifdef OSM_ID_STORED
-    mID = 0;
-#endif
-  }
+  { this->setId (0); }
 
   // Type d'element Node / Way / Relation
   inline virtual eltType type (void) const = 0;
@@ -333,33 +905,28 @@ public:
   inline virtual bool tagCapable (void) const
   { return false; }
 
-  inline virtual const Tags& tags (void) const
-  { return nilTags; }
+  // + arena : celle de l'OSMData de l'element (cf TagArena)
+  inline virtual Tags tags (const TagArena &) const
+  { return Tags(); }
 
   // "Possede au moins un tag" (qui peut etre par exemple "name")
   // + Always false if !tagCapable()
   inline virtual bool hasTag (void) const
   { return false; }
-
-//protected:
-#ifdef OSM_ID_STORED
-  id_t mID;           // Identifiant unique (dans un fichier ou pour tous ?)
-#endif
 };
 
 // OSM Element that can store Tags
-class ITaggedElement : public IElement
+template<class Cfg>
+class ITaggedElement : public IElement<Cfg>
 {
 public:
-  inline virtual const Tags& tags (void) const
-  { return *mTags; }
+  inline virtual Tags tags (const TagArena &arena) const
+  { return Tags (mTags, arena); }
 
   inline virtual void Init()
   {
-#ifdef OSM_ID_STORED
-    mID = 0;
-#endif
-    mTags = &nilTags;
+    this->setId (0);
+    mTags.first = mTags.count = 0;
   }
 
   // "Est capable de stocker des tags"
@@ -367,12 +934,503 @@ public:
   { return true; }
 
   inline virtual bool hasTag (void) const
-  { return ! mTags->isEmpty(); }
+  { return mTags.count != 0; }
 
 //protected:
-  // A Tags object (set of tags) is much larger than a (void *), so we store
-  // it only then at least one tag exists
-  Tags *mTags;
+  TagRun mTags;       // Dans la TagArena de l'OSMData
+};
+
+// Colonne des id des Node (cf OSMData::NodeTable et Config::id_type)
+template<class T>
+class IdColumn
+{
+public:
+  static const unsigned bytes = sizeof (T);        // Par Node
+
+  inline id_t get (unsigned ix) const { return m_ids[ix]; }
+  inline void push_back (id_t id) { m_ids.push_back ((T) id); }
+  inline void move (unsigned from, unsigned to) { m_ids[to] = m_ids[from]; }
+  inline void set (unsigned ix, id_t id) { m_ids[ix] = (T) id; }
+  inline void reserve (unsigned n) { m_ids.reserve (n); }
+  inline void resize (unsigned n)
+  {
+    m_ids.resize (n);
+    m_ids.shrink();                                 // Rendre la RAM
+  }
+  inline size_t memory (void) const { return m_ids.memory(); }
+
+  // Ecrire ou mapper ses Column (cf OSMData::SaveSnapshot)
+  template<class S> void snapshot (S &s) { s.column (m_ids); }
+
+private:
+  BlockColumn<T> m_ids;
+};
+
+template<>
+class IdColumn<void>
+{
+public:
+  static const unsigned bytes = 0;
+
+  inline id_t get (unsigned) const { return 0; }
+  inline void push_back (id_t) {}
+  inline void move (unsigned, unsigned) {}
+  inline void set (unsigned, id_t) {}
+  inline void reserve (unsigned) {}
+  inline void resize (unsigned) {}
+  inline size_t memory (void) const { return 0; }
+  template<class S> void snapshot (S &) {}
+};
+
+
+// Vue sur une suite contigue de T (une ligne de RowTable)
+template<class T>
+class Span
+{
+public:
+  Span (const T *first, unsigned n) : m_first (first), m_size (n) {}
+
+  typedef const T *const_iterator;
+  inline const T *begin (void) const { return m_first; }
+  inline const T *end (void) const { return m_first + m_size; }
+  inline unsigned size (void) const { return m_size; }
+  inline bool empty (void) const { return m_size == 0; }
+  inline const T& operator[] (unsigned i) const { return m_first[i]; }
+  inline const T& front (void) const { return m_first[0]; }
+  inline const T& back (void) const { return m_first[m_size - 1]; }
+
+private:
+  const T *m_first;
+  unsigned m_size;
+};
+
+// Listes de T mises bout a bout (compressed sparse row)
+// + La ligne r est items[start[r] .. start[r+1]-1] : un seul tableau pour
+//   tous les Way (ou Relation), au lieu d'un vector et de son allocation
+//   par element
+// + Seule la derniere ligne grandit, et seules les dernieres peuvent etre
+//   retirees : c'est l'ordre de la lecture. Les autres ne changent que par
+//   replace(), en une passe
+template<class T>
+class RowTable
+{
+public:
+  RowTable () { m_start.push_back (0); }
+
+  inline unsigned size (void) const { return m_start.size() - 1; }
+  inline unsigned items (void) const { return m_items.size(); }
+  inline Span<T> operator[] (unsigned row) const
+  { return Span<T> (data (row), m_start[row+1] - m_start[row]); }
+
+  // Premier T de la ligne row, ou fin des T si row == size()
+  inline const T *data (unsigned row) const { return m_items.begin() + m_start[row]; }
+  inline T *data (unsigned row) { return m_items.begin() + m_start[row]; }
+
+  inline void addRow (void) { m_start.push_back (m_items.size()); }
+  inline void push_back (const T &item)    // A la derniere ligne
+  {
+    m_items.push_back (item);
+    ++m_start.back();
+  }
+  inline void reserve (unsigned rows, unsigned items)
+  {
+    m_start.reserve (rows + 1);
+    m_items.reserve (items);
+  }
+
+  // Garder les n premiers T de la derniere ligne
+  inline void shrinkLast (unsigned n)
+  {
+    m_start.back() = m_start[m_start.size() - 2] + n;
+    m_items.resize (m_start.back());
+  }
+
+  // Garder les rows premieres lignes
+  inline void truncate (unsigned rows)
+  {
+    m_start.resize (rows + 1);
+    m_items.resize (m_start.back());
+  }
+
+  // Remplacer des lignes (ligne -> ses T), toutes < size()
+  // + Les lignes qui suivent la premiere remplacee sont recopiees : les
+  //   lignes restent contigues
+  void replace (const std::map<unsigned,std::vector<T> > &rows)
+  {
+    if (rows.empty()) return;
+    unsigned const first = rows.begin()->first;
+    unsigned const base = m_start[first];
+    std::vector<T> tail;                     // Lignes first et suivantes
+    tail.reserve (m_items.size() - base);
+    typename std::map<unsigned,std::vector<T> >::const_iterator r = rows.begin();
+    for (unsigned row = first; row < size(); ++row)
+    {
+      unsigned const start = base + tail.size();
+      if ((r != rows.end()) && (r->first == row))
+      {
+        tail.insert (tail.end(), r->second.begin(), r->second.end());
+        ++r;
+      }
+      else
+        tail.insert (tail.end(), data (row), data (row + 1));
+      m_start[row] = start;
+    }
+    m_start.back() = base + tail.size();
+    m_items.resize (m_start.back());
+    std::copy (tail.begin(), tail.end(), m_items.begin() + base);
+  }
+
+  // Rendre la RAM non employee
+  inline void shrink (void)
+  {
+    m_start.shrink();
+    m_items.shrink();
+  }
+
+  // Octets occupes
+  inline size_t memory (void) const
+  { return m_start.memory() + m_items.memory(); }
+
+  // Ecrire ou mapper ses Column (cf OSMData::SaveSnapshot)
+  template<class S> void snapshot (S &s) { s.column (m_start); s.column (m_items); }
+
+private:
+  Column<unsigned> m_start;        // size()+1 debuts de ligne, dans m_items
+  Column<T> m_items;
+};
+
+
+// Parcours des index de Node d'un Way (cf WayNodes), a plat ou codes en
+// delta : chaque index est l'ecart au precedent (au premier : a 0), en
+// zigzag (0, -1, 1, -2 ... => 0, 1, 2, 3 ...), ecrit en varint (7 bits par
+// octet, poids faibles d'abord, bit 7 a 1 s'il y a une suite)
+class WayNodeIterator
+{
+public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef int value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const int *pointer;
+  typedef int reference;
+
+  WayNodeIterator () : m_plain (NULL), m_code (NULL), m_value (0), m_left (0) {}
+  WayNodeIterator (const int *plain, unsigned n)
+    : m_plain (plain), m_code (NULL), m_value (0), m_left (n)
+  { if (n > 0) m_value = *plain; }
+  WayNodeIterator (const unsigned char *code, unsigned n)
+    : m_plain (NULL), m_code (code), m_value (0), m_left (n)
+  { if (n > 0) m_value = unzigzag (varint (m_code)); }
+
+  inline int operator* (void) const { return (int) m_value; }
+  inline WayNodeIterator &operator++ (void)
+  {
+    if (--m_left == 0) return *this;
+    if (m_plain != NULL)
+      m_value = *++m_plain;
+    else
+      m_value += unzigzag (varint (m_code));
+    return *this;
+  }
+  inline bool operator== (const WayNodeIterator &i) const { return m_left == i.m_left; }
+  inline bool operator!= (const WayNodeIterator &i) const { return m_left != i.m_left; }
+
+  static inline unsigned varint (const unsigned char *&p)
+  {
+    unsigned v = *p++;
+    if (v < 0x80) return v;         // Le cas courant : un octet
+    v &= 0x7F;
+    for (unsigned shift = 7; ; shift += 7)
+    {
+      unsigned const c = *p++;
+      v |= (c & 0x7F) << shift;
+      if (c < 0x80) return v;
+    }
+  }
+  static inline unsigned zigzag (unsigned d) { return (d << 1) ^ (0u - (d >> 31)); }
+  static inline unsigned unzigzag (unsigned z) { return (z >> 1) ^ (0u - (z & 1)); }
+
+private:
+  const int *m_plain;               // NULL : codes en delta
+  const unsigned char *m_code;
+  unsigned m_value;                 // Index courant (modulo 2^32)
+  unsigned m_left;                  // Dont le courant
+};
+
+// Index des Node d'un Way, dans l'ordre (cf OSMData::wayNodes)
+// + Code en delta (cf WayNodeIterator), le nombre d'index precede les ecarts
+class WayNodes
+{
+public:
+  WayNodes (const Span<int> &plain) : m_plain (plain.begin()), m_code (NULL), m_size (plain.size()) {}
+  WayNodes (const unsigned char *code) : m_plain (NULL), m_code (code)
+  { m_size = WayNodeIterator::varint (m_code); }
+
+  inline unsigned size (void) const { return m_size; }
+  inline bool empty (void) const { return m_size == 0; }
+  inline WayNodeIterator begin (void) const
+  { return (m_code != NULL) ? WayNodeIterator (m_code, m_size) : WayNodeIterator (m_plain, m_size); }
+  inline WayNodeIterator end (void) const { return WayNodeIterator(); }
+  inline int front (void) const { return *begin(); }
+  inline int back (void) const
+  {
+    if (m_code == NULL) return m_plain[m_size - 1];
+    WayNodeIterator i = begin();
+    for (unsigned n = 1; n < m_size; ++n) ++i;
+    return *i;
+  }
+
+  // Ajouter a out (push_back d'octets) le codage de ix
+  template<class Out>
+  static void encode (const Span<int> &ix, Out &out)
+  {
+    putVarint (ix.size(), out);
+    unsigned prev = 0;
+    for (unsigned i = 0; i < ix.size(); ++i)
+    {
+      putVarint (WayNodeIterator::zigzag ((unsigned) ix[i] - prev), out);
+      prev = (unsigned) ix[i];
+    }
+  }
+
+private:
+  const int *m_plain;
+  const unsigned char *m_code;      // Apres le nombre d'index
+  unsigned m_size;
+
+  template<class Out>
+  static inline void putVarint (unsigned v, Out &out)
+  {
+    for (; v >= 0x80; v >>= 7)
+      out.push_back ((unsigned char) (v | 0x80));
+    out.push_back ((unsigned char) v);
+  }
+};
+
+
+// Partie de OSMData independante de sa configuration (cf BasicOSMData) :
+// options et comptes rendus de chargement, et lecture hors de OSMData
+// (Batch, ClipScan)
+
+class OSMDataCommon
+{
+public:
+  OSMDataCommon();
+
+  // Filtrage de LoadText(filename, clip) sur un pave
+  // + clipNodes : une seule lecture. Les Node hors du pave sont ignores, et
+  //   les references des Way et Relation vers eux aussi. Un Way ou Relation
+  //   qui n'a plus aucun membre est oublie
+  // + clipCompleteWays : deux lectures. La premiere note (IdBitmap) les Node
+  //   du pave, les Way qui en ont au moins un, tous les Node de ces Way, et
+  //   les Relation ayant un membre parmi ceux-ci. La seconde ne charge que
+  //   ces elements : les Way sont donc entiers, meme hors du pave
+  // Dans les deux cas, la RAM occupee est celle de l'extrait
+  enum clipMode { clipNodes, clipCompleteWays };
+  clipMode m_clipMode;
+
+  // Zoom de la vue a produire, pour LoadText et LoadPBF (maxZoom par defaut :
+  // tout est charge)
+  // + Un element dont la classe (cf minZoom) n'est visible qu'a un zoom plus
+  //   fort est ignore. Un Node garde sa position mais perd ses tags
+  // + La geometrie des Way est simplifiee (Douglas-Peucker) au pixel pres
+  //   d'une tuile 256x256 de ce zoom. Une aire plus petite est ignoree
+  // + A la fin du chargement, les Node qui n'ont plus ni tag ni reference
+  //   sont retires : un Way d'un fichier charge ensuite ne les trouve pas
+  // Par exemple, sur une region a zoom 10, il ne reste guere que les routes
+  // principales, les voies ferrees, les rivieres et les grandes aires
+  zoom_t m_zoom;
+
+  // Zoom a partir duquel est visible un element portant le tag key=value,
+  // ou maxZoom+1 si ce tag ne determine pas la visibilite (name, source, ...)
+  static zoom_t minZoom (const char *key, const char *value);
+
+  // Resolution des references (nd des Way, member des Relation)
+  // + refsImmediate : chaque id est cherche des sa lecture. Une reference
+  //   vers un element decrit plus loin dans le fichier est perdue (comptee
+  //   dans m_badrefwn, m_badrefr)
+  // + refsDeferred : les id sont notes, puis resolus a la fin du chargement :
+  //   tries par morceaux sur plusieurs threads, chaque morceau est cherche
+  //   dans l'ordre des id (fusion avec idSorted), ce qui evite les defauts
+  //   de cache d'une recherche par reference. Les references en avant sont
+  //   resolues
+  //   Le filtrage clipNodes et m_zoom a besoin des Node a la fin de chaque
+  //   Way : la resolution est alors immediate
+  enum refMode { refsImmediate, refsDeferred };
+  refMode m_refMode;
+
+  // Analyseur XML employe par LoadText
+  // + xmlExpat : expat, qui admet tout XML bien forme
+  // + xmlNative : lecteur dedie au sous-ensemble de XML employe par les OSM
+  //   (cf OSMXml.cpp), plus rapide. UTF-8 seulement.
+  // + xmlParallel : idem xmlNative, mais un fichier non comprime (mappe) est
+  //   decoupe en morceaux a des debuts d'element (<node, <way, <relation),
+  //   analyses sur plusieurs threads puis ajoutes dans l'ordre du fichier.
+  //   Un fichier comprime est lu comme par xmlNative
+  // Tous donnent le meme OSMData (memes index)
+  enum xmlParser { xmlExpat, xmlNative, xmlParallel };
+  xmlParser m_xmlParser;
+
+  // Stockage des index de Node des Way (cf OSMData::wayNodes)
+  // + waysPlain : un int par Node (m_wayNodes), en acces direct
+  // + waysDelta : a la fin de chaque chargement, les Way sont codes en delta
+  //   (m_wayDeltas, cf WayNodeIterator) et lus dans l'ordre. Les Node d'un
+  //   Way se suivent le plus souvent dans m_nodes : un index tient alors
+  //   sur un octet au lieu de quatre
+  enum wayStorage { waysPlain, waysDelta };
+  wayStorage m_wayStorage;
+
+  // Quelques statistiques de dernier appel a LoadText
+  // - Nombre d'elements Node/Way/Relation designes mais absents
+  //   (l'absence peut etre due au filtrage demande)
+  //   Ceci peut arriver si un OSM contient des "references en avant",
+  //   i.e. un Way dont les Node seraient decrits apres le Way.
+  //   L'exament de quelques fichiers montre que ceci est negligeable
+  //   et le lecteur fonctionne donc en une seule passe
+  //   TODO: sinon ecrire un LoadText qui recompile ensuite au format
+  //         canonique
+  unsigned m_badrefwn,       // Node inconnu reference par un Way
+           m_badrefr;        // Element inconnu reference par un Relation
+  LatLonBox m_filebound;     // Limites annoncees par le fichier
+  LatLonBox m_loadbound;     // Limites du domaine effectivement charge
+
+  // Evaluer les limites effectives de ce qui est charge
+  // Bof: systematique lors du Load(), toute appli en aura besoin inutile
+  //      d'economiser cela
+//void ComputeBound ();
+
+
+  // Lot d'elements lus hors de OSMData (par exemple decode d'un bloc PBF
+  // par un thread), dont les references sont encore des ID.
+  // + Les chaines (tags, roles) sont recopiees dans text[], designees par
+  //   leur offset : le lot ne depend donc plus du tampon d'ou il a ete lu
+  // + Merge() l'ajoute a OSMData comme le ferait la lecture XML
+  // + Un lot peut etre rempli par les memes primitives que OSMData (newNode,
+  //   addTag, etc), et donc par l'analyse XML (startElementHandler)
+  // + Merge() ajoute les Node, puis les Way, puis les Relation : dans un
+  //   fichier ou ils sont melanges (hors norme), une reference en avant
+  //   au sein d'un meme lot est alors resolue, ce que ne fait pas la
+  //   lecture en serie
+  // + Lu dans un osmChange (cf OSMData::ApplyChange), chaque element note
+  //   le bloc create, modify ou delete qui le contient
+  enum changeAction { changeCreate, changeModify, changeDelete };
+
+  struct Batch
+  {
+    struct Elt
+    {
+      id_t     id;
+      LatLon   pos;              // Node seulement
+      changeAction action;       // changeCreate hors d'un osmChange
+      unsigned tags, ntags;      // Paires key,value dans kv[]
+      unsigned refs, nrefs;      // Way : dans refs[] ; Relation : dans members[]
+    };
+
+    struct Member
+    {
+      id_t     id;
+      eltType  elt;
+      unsigned role;             // Offset dans text[]
+    };
+
+    std::vector<Elt>      nodes, ways, relations;
+    std::vector<unsigned> kv;      // Offsets dans text[], key et value alternes
+    std::vector<id_t>     refs;    // ID des Node des Way
+    std::vector<Member>   members; // Membres des Relation
+    std::vector<char>     text;    // Chaines terminees par '\0'
+    const char *error;             // Non NULL si le decodage a echoue
+    bool isChange;                 // Un element "osmChange" a ete lu
+    bool hasBound;                 // Un element "bounds" a ete lu
+    LatLonBox bound;
+
+    Batch() { clear(); }
+
+    inline const char *str (unsigned offset) const
+    { return &text[offset]; }
+
+    // Memoriser une chaine (non terminee) et retourner son offset
+    inline unsigned addString (const char *s, size_t n)
+    {
+      unsigned const offset = text.size();
+      text.insert (text.end(), s, s + n);
+      text.push_back ('\0');
+      return offset;
+    }
+
+    void clear (void)
+    {
+      nodes.clear(); ways.clear(); relations.clear();
+      kv.clear(); refs.clear(); members.clear(); text.clear();
+      error = NULL;
+      isChange = false;
+      hasBound = false;
+      m_cur = NULL;
+      m_inway = m_inrel = false;
+      m_action = changeCreate;
+    }
+
+    // Primitives de remplissage, idem celles de OSMData
+    void setFileBound (const LatLonBox &box);
+    void startChange (void) { isChange = true; }
+    void setAction (changeAction action) { m_action = action; }
+    void newNode (id_t id, const LatLon &pos);
+    void endNode (void);
+    void newWay  (id_t id);
+    void newND   (id_t id);
+    void endWay  (void);
+    void newRelation (id_t id);
+    void newMember (id_t id, enum eltType elt, const XML_Char *role);
+    void endRelation (void);
+    void addTag (const XML_Char *key, const XML_Char *value);
+
+    void startElementHandler (const XML_Char *name, const XML_Char **atts);
+    void endElementHandler (const XML_Char *name);
+
+  private:
+    std::vector<Elt> *m_cur;       // Dont le dernier recoit les tags
+    bool m_inway, m_inrel;
+    changeAction m_action;         // Bloc en cours d'un osmChange
+  };
+
+  // Premiere lecture du mode clipCompleteWays : les elements a garder
+  // + Memes primitives que OSMData, pour l'analyse XML
+  class ClipScan
+  {
+  public:
+    ClipScan (const LatLonBox &clip) : m_clip(clip), m_inway(false), m_inrel(false) {}
+
+    IdBitmap nodes, ways, relations;  // A charger
+
+    void setFileBound (const LatLonBox &) {}
+    void startChange (void) {}
+    void setAction (changeAction) {}
+    inline void newNode (id_t id, const LatLon &pos);
+    void endNode (void) {}
+    inline void newWay  (id_t id);
+    inline void newND   (id_t id);
+    inline void endWay  (void);
+    inline void newRelation (id_t id);
+    inline void newMember (id_t id, enum eltType elt, const XML_Char *role);
+    inline void endRelation (void);
+    void addTag (const XML_Char *, const XML_Char *) {}
+
+    void startElementHandler (const XML_Char *name, const XML_Char **atts);
+    void endElementHandler (const XML_Char *name);
+
+  private:
+    LatLonBox m_clip;
+    IdBitmap m_inBox;                 // Node dans le pave
+    id_t m_id;                        // Way ou Relation en cours
+    std::vector<id_t> m_refs;         // Node du Way en cours
+    bool m_touch;                     // Le Way/Relation en cours touche le pave
+    bool m_inway, m_inrel;
+  };
+
+protected:
+  // Interpretation des elements XML, commune a OSMData, Batch et ClipScan
+  template<class T> static void startElement (T &t, const XML_Char *name, const XML_Char **atts);
+  template<class T> static void endElement (T &t, const XML_Char *name);
+
+  static latlon_t fixedlatlon (const char *str);      // strtoul() "optimise"
 };
 
 
@@ -388,15 +1446,25 @@ public:
 //   dynamiquemlent agrandis lors de la lecture ne garantissent pas que l'adresse
 //   des objets contenus est inchangee (ils contiennent des valeurs, pas des
 //   "objets").
+// + Cfg est une configuration (cf FullConfig) : la representation des
+//   elements en depend, le reste (OSMDataCommon) non
+// + Les membres sont instancies dans OSM*.cpp pour les configurations de
+//   OSM_FOR_EACH_CONFIG
 
-class OSMData
+template<class Cfg>
+class BasicOSMData : public OSMDataCommon
 {
 public:
-  OSMData();
-  ~OSMData();
+  typedef Cfg Config;
+  typedef IElement<Cfg> Element;
+  typedef ITaggedElement<Cfg> TaggedElement;
+
+  BasicOSMData();
+  ~BasicOSMData();
 
   // Lire un fichier OSM (XML)
-  // + Les fichiers OSM comprimes en ".bz2" ou ".gz" sont admis
+  // + Les fichiers OSM comprimes en bzip2, gzip ou zstd (si -DHAS_ZSTD) sont
+  //   admis, reconnus par leur contenu et non par leur extension
   // + Les donnees sont ajoutees a l'existant, il est permis d'appeler LoadText
   //   plusieurs fois.
   //   Si un element Node/Way/Relation est deja charge, le second est ignore
@@ -406,104 +1474,193 @@ public:
   //   Il y a donc des version de LoadText pour ne charger qu'une partie filtree
   //   sur un domaine geographique, ou pour un niveau de zoom defini
   //
-  // TODO: facteur de zoom, pour ne pas charger des details inutiles si
-  //       cet OSM est destine a produire une vue de zoom faible, etc.
-  // TODO: PBF reader
+  // + Cf m_zoom pour ne pas charger des details inutiles si cet OSM est
+  //   destine a produire une vue de zoom faible
   void LoadText (const char *filename);
   void LoadText (const char *filename, LatLonBox &clip);
 
-  // Quelques statistiques de dernier appel a LoadText
-  // - Nombre d'elements Node/Way/Relation designes mais absents
-  //   (l'absence peut etre due au filtrage demande)
-  //   Ceci peut arriver si un OSM contient des "references en avant",
-  //   i.e. un Way dont les Node seraient decrits apres le Way.
-  //   L'exament de quelques fichiers montre que ceci est negligeable
-  //   et le lecteur fonctionne donc en une seule passe
-  //   TODO: sinon ecrire un LoadText qui recompile ensuite au format
-  //         canonique
-  unsigned m_badrefwn,       // Node inconnu reference par un Way
-           m_badrefr;        // Element inconnu reference par un Relation
-  LatLonBox m_filebound;     // Limites annoncees par le fichier
-  LatLonBox m_loadbound;     // Limites du domaine effectivement charge
-
-  // Evaluer les limites effectives de ce qui est charge
-  // Bof: systematique lors du Load(), toute appli en aura besoin inutile
-  //      d'economiser cela
-//void ComputeBound ();
-
+  // Lire plusieurs fichiers OSM (XML) ensemble, par exemple des extraits
+  // regionaux voisins dont les bords se recouvrent
+  // + Les fichiers sont analyses en meme temps, chacun par morceaux sur un
+  //   thread. Les morceaux sont
+  //   ajoutes tour a tour, un de chaque fichier : la lecture dure a peu
+  //   pres celle du plus gros fichier, et non la somme
+  // + Un element deja charge (meme id, d'un autre fichier) est ignore
+  // + m_xmlParser choisit l'analyseur de chaque fichier (xmlParallel : idem
+  //   xmlNative)
+  // + Les references sont resolues a la fin (refsDeferred, quel que soit
+  //   m_refMode) : celles vers un element d'un autre fichier, ajoute plus
+  //   tard, le sont aussi. Sauf avec m_zoom, dont la resolution est
+  //   immediate : elles sont alors perdues si l'element n'est pas deja ajoute
+  // + Les id des fichiers s'entremelent : idHash convient mieux que idSorted
+  // + m_zoom s'applique, pas le filtrage sur un pave
+  void LoadText (const std::vector<const char *> &filenames);
+
+  // Snapshot : l'image binaire d'un OSMData charge, tel quel (Node, index
+  // des Node des Way, membres des Relation, tags et leurs chaines)
+  // + Chaque tableau est une section du fichier, designee par son offset :
+  //   OpenSnapshot mappe le fichier et ses tableaux deviennent des vues sur
+  //   les sections (cf Column), sans lecture ni decodage. Plusieurs process
+  //   partagent ainsi les memes pages du cache du noyau
+  // + Seuls les Way et Relation (id et TagRun) sont recopies, car ils ont
+  //   une vtable ; les IIdIndex sont reconstruits au premier besoin (find*Ix
+  //   ou chargement suivant), et pas du tout pour un Config sans id
+  // + Le fichier est propre a la machine (endianness) et au Config ("syntaxError"
+  //   sinon). Il s'ouvre dans un OSMData vide ("ProgramError" sinon), qui
+  //   le garde mappe jusqu'a sa destruction (cf TagArena::adopt). Chaque
+  //   OSMData a ses atomes : plusieurs snapshots peuvent etre ouverts
+  // + Un OSMData ouvert ainsi peut etre complete par LoadText, etc : les
+  //   tableaux modifies sont alors recopies en RAM
+  void SaveSnapshot (const char *filename) const;
+  void OpenSnapshot (const char *filename);
+
+  // Lire un fichier OSM au format PBF (".osm.pbf", Protocol Buffers)
+  //      http://wiki.openstreetmap.org/wiki/PBF_Format
+  // + Le fichier est une suite de blocs independants ("Blob" zlib) : ils
+  //   sont decomprimes et decodes par plusieurs threads (un par coeur), puis
+  //   ajoutes dans l'ordre du fichier, ce qui donne les memes index que la
+  //   lecture du meme OSM en XML
+  // + Comme LoadText, c'est un ajout a l'existant
+  void LoadPBF (const char *filename);
+
+  // Appliquer un fichier de modifications (osmChange, ".osc", comprime ou
+  // non comme pour LoadText), par exemple le diff quotidien d'une region
+  //      http://wiki.openstreetmap.org/wiki/OsmChange
+  // + Les elements des blocs create et modify sont ajoutes ou remplaces
+  //   (position, tags, Node des Way, membres des Relation), ceux de delete
+  //   sont retires. Les Node sont appliques d'abord, puis les Way, puis les
+  //   Relation : leurs references sont resolues apres coup
+  // + Les index des elements existants ne changent pas. Un element retire
+  //   garde sa place, vide (id 0, sans tag ni reference), jusqu'a ce qu'un
+  //   ApplyChange suivant la reprenne pour un element cree
+  // + Les lignes de m_wayNodes, m_wayDeltas et m_members sont remplacees en
+  //   une passe (cf RowTable::replace), et la table des Tags des Node en une
+  //   fusion : le cout est celui d'une copie de ces tableaux, pas d'un
+  //   chargement
+  // + m_zoom et le filtrage sur un pave ne s'appliquent pas. Les anciens
+  //   tags d'un element modifie restent dans m_tagArena
+  // + Les places libres ne sont pas dans un snapshot (cf SaveSnapshot)
+  void ApplyChange (const char *filename);
 
   // Un Node
   // + C'est un simple point sur la carte, qui peut faire partir d'un autre element
   // + Il peut etre tag-capable, auquel cas dans cette version 'riche', un Way memorise
   //   un index de Node, ce qui lui permet d'acceder aux eventuels tags de son Node qui
   //   pourraient affecter son rendu. Par contre c'est assez cher en RAM alors que la
-  //   majorite des Node n'ont pas de tag. Donc :
-  // + Il peut etre tag-incapable, auquel cas un Way memorise 
+  //   majorite des Node n'ont pas de tag (cf Config::nodeTagged)
+  // + Les Node sont donc ranges en colonnes (cf NodeTable), et un Node n'est
+  //   qu'une vue sur sa ligne, sans vtable. Un Node coutait 32 octets (vtable,
+  //   Tags*, id, position), il en coute 16 (position, id), plus ses Tags
+  //   s'il en a
 
-#ifdef OSM_NODE_TAGGED
-  class Node : public ITaggedElement
-#else
-  class Node : public IElement
-#endif
+  class NodeTable;
+
+  class Node
   {
   public:
+    Node (const NodeTable &table, unsigned ix)
+      : pos (table.pos[ix]), m_table (&table), m_ix (ix) {}
+
     inline eltType type (void) const { return eltNode; }
+    inline id_t id (void) const { return m_table->id (m_ix); }
+    inline bool tagCapable (void) const { return Cfg::nodeTagged; }
+    inline Tags tags (void) const { return m_table->tags (m_ix); }
+    inline bool hasTag (void) const { return ! tags().isEmpty(); }
 
     // A Node is only a Lat/Lon and zero or some tags.
-    LatLon pos;
-
-    // Definition a partir des chaines lat="" et lon="" du OSM/XML
-    // + gprof prouve que ceci est un des principaux consomateurs de CPU au
-    //   chargement aussi est-il inline avec un "atoi()" dedie
-    //   Le temps de LoadText passe ainsi de 75s a 67s sur "rhone-alpes.osm"
-    inline void set (const char *latimg, const char *lonimg)
-    { pos.lat = fixedlatlon (latimg);
-      pos.lon = fixedlatlon (lonimg);
-    }
+    const LatLon &pos;
 
-//  inline void set (double latdeg, double londeg)
-//  { pos.lat = latlon (canonicalDeg(latdeg));
-//    pos.lon = latlon (canonicalDeg(londeg));
-//  }
+  private:
+    const NodeTable *m_table;
+    unsigned m_ix;
   };
 
-  // NB: Le cout memoire de ce double heritage est supportable
-  //     Le sizeof() est juste la somme des deux classes meres
-  //     Ce sont juste les VTable qui doivent se compliquer ?
+  // Les Node, en colonnes (struct-of-arrays)
+  // + pos[i] est la position du Node d'index i : une passe de projection ne
+  //   parcourt que ce tableau
+  // + Les id sont une autre colonne (cf IdColumn), absente si
+  //   Config::id_type est void
+  // + Les Tags sont dans une table annexe, triee par index de Node, ou seuls
+  //   les Node tagges (5% environ) ont une entree
+  // + Un Node est ajoute en fin, et seul le dernier recoit des tags : la
+  //   table annexe reste triee sans effort
+  class NodeTable
+  {
+  public:
+    NodeTable (const TagArena &arena) : m_arena (&arena) {}
 
-//class PoorNode : public Node, public IElement
-//{
-//  inline eltType type (void) { return eltNode; }
-//};
+    BlockColumn<LatLon> pos;      // Positions
 
-//class RichNode : public Node, public ITaggedElement
-//{
-//  inline eltType type (void) { return eltNode; }
-//};
+    // Octets par Node, hors Tags
+    static const unsigned rowSize = sizeof (LatLon) + IdColumn<typename Cfg::id_type>::bytes;
+
+    inline unsigned size (void) const { return pos.size(); }
+    inline unsigned capacity (void) const { return pos.capacity(); }
+    inline void reserve (unsigned n) { pos.reserve (n); m_ids.reserve (n); }
+
+    inline Node operator[] (unsigned ix) const { return Node (*this, ix); }
+    inline id_t id (unsigned ix) const { return m_ids.get (ix); }
+    inline Tags tags (unsigned ix) const
+    {
+      const unsigned *t = std::lower_bound (m_tagged.begin(), m_tagged.end(), ix);
+      return ((t == m_tagged.end()) || (*t != ix)) ? Tags() : Tags (m_tags[t - m_tagged.begin()], *m_arena);
+    }
+
+    inline void push_back (id_t id, const LatLon &p)
+    {
+      pos.push_back (p);
+      m_ids.push_back (id);
+    }
+
+    // Donner ses Tags au dernier Node
+    inline void setLastTags (const TagRun &tags)
+    {
+      m_tagged.push_back (pos.size() - 1);
+      m_tags.push_back (tags);
+    }
+
+    // Remplacer l'id d'un Node (cf ApplyChange)
+    inline void setId (unsigned ix, id_t id) { m_ids.set (ix, id); }
+
+    // Remplacer les Tags des Node de tags (index -> Tags, ou count 0 pour
+    // n'en plus avoir), en une fusion avec la table annexe (cf ApplyChange)
+    void replaceTags (const std::map<unsigned,TagRun> &tags);
+
+    // Les index >= first deviennent remap[index - first], ou sont retires si
+    // celui-ci est < 0 (cf IIdIndex::renumber). remap doit etre croissant
+    void renumber (unsigned first, const std::vector<int> &remap);
+
+    // Octets occupes (environ), Tags non compris
+    inline size_t memory (void) const
+    { return pos.memory() + m_ids.memory() + m_tagged.memory() + m_tags.memory(); }
+
+    // Ecrire ou mapper ses Column (cf OSMData::SaveSnapshot)
+    template<class S> void snapshot (S &s)
+    {
+      s.column (pos);
+      m_ids.snapshot (s);
+      s.column (m_tagged);
+      s.column (m_tags);
+    }
+
+  private:
+    const TagArena *m_arena;                // Celle de l'OSMData
+    IdColumn<typename Cfg::id_type> m_ids;
+    Column<unsigned> m_tagged;              // Index des Node tagges, croissants
+    Column<TagRun> m_tags;                  // Leurs Tags (TagRun::arena ignore)
+  };
 
 
   // Un Way
   // + C'est un ensemble ordonne de Node, formant un ligne ou delimitant une aire
 
-  class Way : public ITaggedElement
+  class Way : public ITaggedElement<Cfg>
   {
   public:
     inline eltType type (void) const { return eltWay; }
 
-    // "the same node is at first and last"
-    // + So it is an area, event if no tag tells it ?
-    inline bool isLoop(void) const
-    { return nodesIx.front() == nodesIx.back(); }
-
-    // Index des Node constituant le Way
-    // + nodesIx[i] == -1 si le Node i n'a pas pu etre trouve a partir
-    //   de son ID.
-    //   Ceci est une provision, en l'etat actuel un tel Node n'est plus
-    //   conserve dans le Way. En effet, le cas ne se presente pas dans les
-    //   fichiers OSM testes
-    // + On a couramment plus de 2^16 Nodes dans un fichier, donc pas possible
-    //   de stocker ces index sur un short
-    std::vector<int> nodesIx;      // Indexes in m_nodes (-1 if unknown)
+    // Les index de ses Node sont dans m_wayNodes (cf RowTable) : un Way
+    // n'est plus que son id et ses Tags
 
     // TODO: est-il utile de garder un pointeur vers les Node et leurs Tags ?
     //       reproduire ici la lat/lon ne suffit-il pas ? Un Node est rarement
@@ -516,7 +1673,7 @@ public:
   // Un Relation
   // + C'est un ensemble de Node, de Way, et de Relation  (resursif)
 
-  class Relation : public ITaggedElement
+  class Relation : public ITaggedElement<Cfg>
   {
   public:
     inline eltType type (void) const { return eltRelation; }
@@ -526,7 +1683,7 @@ public:
       eltType elt;
       int     ix;
     };
-    std::vector<Member> eltIx;       // Indexes (-1 if unknown)
+    // Ses membres sont dans m_members (cf RowTable)
   };
 
 #if 0
@@ -556,19 +1713,73 @@ public:
   //      de reference en avant.
   //      Par ailleurs le nombre de Node non reference, bien que non nul, est
   //      negligeable face a la totalite.
+  // + La "map" est un IIdIndex, dont le type est choisi par SetIdIndex
   // + TODO: template pour cette paire vector/map ?
 
-  std::vector<Node>       m_nodes;         // Liste des Node
-  std::map<id_t,unsigned> m_idnodes;       // Map id -> index dans m_nodes
+  // Tags et atomes de tous les elements (avant m_nodes, qui la designe)
+  TagArena                m_tagArena;
+
+  NodeTable               m_nodes;         // Liste des Node
+  IIdIndex               *m_idnodes;       // Map id -> index dans m_nodes
 
-  std::vector<Way>        m_ways;          // Liste des Way
-  std::map<id_t,unsigned> m_idways;        // Map id -> index dans m_nodes
+  BlockColumn<Way>        m_ways;          // Liste des Way
+  IIdIndex               *m_idways;        // Map id -> index dans m_ways
 
-  std::vector<Relation>   m_relations;     // Liste des Relation
-  std::map<id_t,unsigned> m_idrelations;   // Map id -> index dans m_nodes
+  // Index des Node constituant chaque Way : m_wayNodes[w] pour m_ways[w]
+  // + Un Node qui n'a pas pu etre trouve a partir de son ID n'est pas
+  //   conserve dans le Way (cf m_badrefwn)
+  // + On a couramment plus de 2^16 Nodes dans un fichier, donc pas possible
+  //   de stocker ces index sur un short
+  // + Les Way codes en delta (cf waysDelta) sont les m_wayDeltas.size()
+  //   premiers : leur ligne de m_wayNodes est vide
+  RowTable<int>           m_wayNodes;      // Indexes in m_nodes
+  RowTable<unsigned char> m_wayDeltas;     // Idem, codes en delta
 
+  // Index des Node du Way w, quel que soit leur stockage
+  inline WayNodes wayNodes (unsigned w) const
+  { return (w < m_wayDeltas.size()) ? WayNodes (m_wayDeltas.data (w)) : WayNodes (m_wayNodes[w]); }
+
+  // "the same node is at first and last"
+  // + So it is an area, event if no tag tells it ?
+  inline bool isLoop (unsigned w) const
+  {
+    const WayNodes nodes = wayNodes (w);
+    return nodes.front() == nodes.back();
+  }
+
+  BlockColumn<Relation>   m_relations;     // Liste des Relation
+  IIdIndex               *m_idrelations;   // Map id -> index dans m_relations
+
+  // Membres de chaque Relation : m_members[r] pour m_relations[r]
+  RowTable<typename Relation::Member> m_members;
+
+  // Stockage des positions des Node hors de la RAM (NULL par defaut)
+  // + A la lecture, la position de chaque Node est ecrite dans m_nodeStore.
+  //   Seul un Node qui a des tags entre dans m_nodes ; un Node sans tag n'y
+  //   entre que lorsqu'un Way ou Relation le designe, sa position etant lue
+  //   dans m_nodeStore. Les Node sans tag ni reference (la plupart, dans un
+  //   extrait filtre) ne coutent donc pas de RAM
+  // + Mais un Node designe coute autant qu'un chargement sans m_nodeStore :
+  //   sa ligne de m_nodes (id et position, 16 octets) plus son entree
+  //   d'index (idHash : 16 octets par place, 2 a 4 places par Node). Les
+  //   Way renvoyant a des index de m_nodes, leurs Node y sont tous : sur un
+  //   extrait complet (ou presque tous les Node sont ceux d'un Way), la RAM
+  //   n'y gagne rien, elle y perd meme l'index idSorted (12 octets par Node)
+  // + Les Node entrent alors dans m_nodes dans l'ordre des references :
+  //   employer SetIdIndex (idHash)
+  // + Le INodeStore appartient a l'appelant, et peut servir a plusieurs
+  //   chargements ou OSMData
+  INodeStore *m_nodeStore;
+
+  // Type des index id -> index (idSorted par defaut : un OSM est trie par id)
+  // + A choisir avant le premier chargement ("ProgramError" sinon)
+  void SetIdIndex (idIndexKind kind);
+
+
+  void Merge (const Batch &b);
 
 public:
+  // + Construisent les IIdIndex s'ils sont en attente (cf OpenSnapshot)
   int findNodeIx (id_t id);
   int findWayIx (id_t id);
   int findRelationIx (id_t id);
@@ -578,30 +1789,93 @@ private:
 //struct ParserContext          // Si ceci s'avere volumineux
 //{
     XML_Parser m_parser;
-    ITaggedElement *m_curelt;
+    TagRun *m_curtags;                // Tags de l'element en cours (NULL : ignores)
     bool m_inway, m_inrel;
+    id_t m_curid;
+
+    // Filtrage (cf clipMode)
+    bool m_clipping;                  // clipNodes : m_clip s'applique
+    LatLonBox m_clip;
+    const IdBitmap *m_keepNodes, *m_keepWays, *m_keepRelations; // Seconde lecture
+    std::vector<std::string> m_pendingTags; // Tags d'un Way/Relation pas encore garde
+    unsigned m_npending;
+    bool m_zooming;                   // m_zoom < maxZoom pour ce chargement
+    unsigned m_firstNode, m_firstWay, m_firstRelation; // Debut de ce chargement
+    std::vector<unsigned> m_dpStack;  // Douglas-Peucker
+    std::vector<bool> m_dpKeep;
+
+    // Resolution differee (cf refMode)
+    struct Ref
+    {
+      id_t    id;
+      eltType elt;
+    };
+    bool m_deferring;
+    std::vector<id_t> m_refNodes;     // nd des Way de ce chargement
+    std::vector<unsigned> m_refWays;  // Debut des nd de chaque Way dans m_refNodes
+    std::vector<Ref> m_refMembers;    // member des Relation
+    std::vector<unsigned> m_refRelations;
+
+    LatLon m_curpos;                  // Node en cours, s'il va dans m_nodeStore
+    TagRun m_nodeTags;                // Tags du Node en cours
 //};
+  bool m_indexPending;                // IIdIndex a construire (cf OpenSnapshot)
+
+  // Places des elements retires, a reprendre (cf ApplyChange)
+  std::vector<unsigned> m_freeNodes, m_freeWays, m_freeRelations;
 //ParserContext *m_ctx;
 //
 
-  inline void newNode (const XML_Char **atts);
+  void StartLoad (void);
+  void EndLoad (void);
+  void ReserveFor (size_t bytes, unsigned bytesPerNode);
+  static size_t fileSize (const char *filename);
+  static const unsigned xmlBytesPerNode = 10;   // .osm.bz2 : 12 a 15
+  static const unsigned pbfBytesPerNode = 6;    // .osm.pbf : 7 a 10
+  void BuildIndexes (void);
+  void ResolveRefs (void);
+  void DropUnusedNodes (void);
+  void EncodeWays (void);
+  int storedNodeIx (id_t id);
+  zoom_t pendingZoom (void) const;
+  bool simplify (void);
+  template<class T> void ParseText (const char *filename, T &sink);
+  template<class T> void ParseExpat (IByteFileReader *f, T &sink);
+  template<class T> void ParseNativeXml (IByteFileReader *f, T &sink);
+  void LoadParallelXml (IByteFileReader *f);
+  inline void setFileBound (const LatLonBox &box) { m_filebound = box; }
+  inline void startChange (void) { throw "syntaxError"; }  // osmChange : cf ApplyChange
+  inline void setAction (changeAction) {}
+  inline void newNode (id_t id, const LatLon &pos);
   inline void endNode (void);
-  inline void newWay  (const XML_Char **atts);
+  inline void newWay  (id_t id);
   inline void newND   (id_t id);
   inline void endWay  (void);
-  inline void newRelation (const XML_Char **atts);
+  inline void newRelation (id_t id);
   inline void newMember (id_t id, enum eltType elt, const XML_Char *role);
   inline void endRelation (void);
   inline void addTag (const XML_Char *key, const XML_Char *value);
+  inline void storeTag (const XML_Char *key, const XML_Char *value);
+  inline void flushTags (void);
+  template<class E, class T> void dropLast (BlockColumn<E> &elts, RowTable<T> &rows, IIdIndex *ids);
+  TagRun changeTags (const Batch &b, const Batch::Elt &e);
+  template<class E, class T> unsigned newSlot (BlockColumn<E> &elts, RowTable<T> &rows,
+                                               std::vector<unsigned> &free);
+
+  friend class OSMDataCommon;   // startElement, endElement
 public: // really private
   void startElementHandler (const XML_Char *name, const XML_Char **atts);
   void endElementHandler (const XML_Char *name);
 
 private:
-  static latlon_t fixedlatlon (const char *str);      // strtoul() "optimise"
+  BasicOSMData (const BasicOSMData &);                // Non copiable
+  void operator= (const BasicOSMData &);
 
 };
 
+typedef BasicOSMData<FullConfig> OSMData;
+
+
 }  // namespace osm
 
 #endif
@@ -0,0 +1,578 @@
+// Lecture des fichiers OSM au format PBF
+//      http://wiki.openstreetmap.org/wiki/PBF_Format
+//
+// Un fichier PBF est une suite de couples (BlobHeader, Blob), chacun precede
+// de sa taille. Un Blob est un message Protocol Buffers le plus souvent
+// comprime par zlib, et independant des autres (il a sa propre table de
+// chaines) : c'est cela qui permet de les decoder en parallele.
+//
+// Il n'y a pas ici de dependance a libprotobuf : le format n'emploie que
+// quelques messages, decodes directement par PbfMessage.
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "OSM.h"
+#include "Workers.h"
+#include "zlib.h"
+
+namespace osm {
+
+// Limites imposees par la spec PBF
+static const size_t maxHeaderSize = 64*1024;
+static const size_t maxBlobSize   = 32*1024*1024;
+
+
+// Un message Protocol Buffers, ou un champ "packed", a parcourir
+// + Sur un tampon d'entree incoherent, on s'arrete a sa fin sans deborder
+//   et error est positionne
+class PbfMessage
+{
+public:
+  PbfMessage () : m_p(NULL), m_end(NULL), m_field(0), m_wire(0), error(false) {}
+  PbfMessage (const char *p, size_t n)
+    : m_p((const uint8_t *) p), m_end((const uint8_t *) p + n),
+      m_field(0), m_wire(0), error(false) {}
+
+  // Passer au champ suivant : false s'il n'y en a plus
+  inline bool next (void)
+  {
+    if (m_p >= m_end) return false;
+    uint64_t const key = varint();
+    m_field = (unsigned) (key >> 3);
+    m_wire  = (unsigned) (key & 7);
+    return ! error;
+  }
+
+  inline unsigned field (void) const { return m_field; }
+  inline bool atEnd (void) const { return m_p >= m_end; }
+
+  // Valeurs elementaires
+  inline uint64_t varint (void)
+  {
+    uint64_t v = 0;
+    for (unsigned shift = 0; (m_p < m_end) && (shift < 64); shift += 7)
+    {
+      uint8_t const c = *m_p++;
+      v |= (uint64_t) (c & 0x7F) << shift;
+      if (c < 0x80) return v;
+    }
+    error = true;
+    m_p = m_end;
+    return 0;
+  }
+
+  inline int64_t svarint (void)        // "sint64", codage zigzag
+  {
+    uint64_t const v = varint();
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+  }
+
+  // Champ de longueur variable : chaine, sous-message ou champ "packed"
+  inline const char *bytes (size_t *n)
+  {
+    uint64_t const len = varint();
+    if (len > (uint64_t) (m_end - m_p))
+    {
+      error = true;
+      m_p = m_end;
+      *n = 0;
+      return NULL;
+    }
+    const char *b = (const char *) m_p;
+    m_p += len;
+    *n = len;
+    return b;
+  }
+
+  inline PbfMessage message (void)
+  {
+    size_t n;
+    const char *b = bytes (&n);
+    PbfMessage m (b, n);
+    m.error = error;
+    return m;
+  }
+
+  // Ignorer le champ courant
+  void skip (void)
+  {
+    size_t n;
+    switch (m_wire)
+    {
+      case 0 : varint(); break;
+      case 1 : m_p += 8; break;
+      case 2 : bytes (&n); break;
+      case 5 : m_p += 4; break;
+      default: error = true; m_p = m_end;
+    }
+    if (m_p > m_end) { error = true; m_p = m_end; }
+  }
+
+private:
+  const uint8_t *m_p, *m_end;
+  unsigned m_field, m_wire;
+public:
+  bool error;
+};
+
+
+// Les lat/lon PBF sont en nanodegres : offset + granularity * valeur
+// + On arrondit au LSB de latlon_t (10^-7)
+static inline latlon_t nanoToLatlon (int64_t nano)
+{
+  return (latlon_t) ((nano >= 0) ? (nano + 50) / 100 : -((-nano + 50) / 100));
+}
+
+
+// Decodage d'un PrimitiveBlock dans un OSMData::Batch
+// + Ceci est execute par les threads de decodage : ne touche pas a OSMData
+class PbfBlockDecoder
+{
+public:
+  PbfBlockDecoder (OSMData::Batch &b) : m_b(b)
+  {
+    m_granularity = 100;
+    m_latOffset = m_lonOffset = 0;
+  }
+
+  void Decode (const char *p, size_t n)
+  {
+    std::vector<PbfMessage> groups;
+    PbfMessage block (p, n);
+
+    // Les groupes ne peuvent etre decodes qu'une fois la table de chaines et
+    // la granularite connues, qui peuvent suivre les groupes dans le message
+    while (block.next())
+      switch (block.field())
+      {
+        case 1 :        // StringTable
+        {
+          PbfMessage st = block.message();
+          while (st.next())
+            if (st.field() == 1)
+            {
+              size_t len;
+              const char *s = st.bytes (&len);
+              m_strings.push_back (m_b.addString (s, len));
+            }
+            else st.skip();
+          if (st.error) block.error = true;
+        }
+        break;
+        case 2  : groups.push_back (block.message()); break;
+        case 17 : m_granularity = (int64_t) block.varint(); break;
+        case 19 : m_latOffset = (int64_t) block.varint(); break;
+        case 20 : m_lonOffset = (int64_t) block.varint(); break;
+        default : block.skip();
+      }
+    check (block);
+
+    for (unsigned g = 0; g < groups.size(); ++g)
+    {
+      PbfMessage &group = groups[g];
+      while (group.next())
+        switch (group.field())
+        {
+          case 1 : { PbfMessage m = group.message(); Node (m); } break;
+          case 2 : { PbfMessage m = group.message(); DenseNodes (m); } break;
+          case 3 : { PbfMessage m = group.message(); Way (m); } break;
+          case 4 : { PbfMessage m = group.message(); Relation (m); } break;
+          default: group.skip();                // ChangeSet
+        }
+      check (group);
+    }
+  }
+
+private:
+  OSMData::Batch &m_b;
+  std::vector<unsigned> m_strings;      // Table de chaines du bloc : offsets dans m_b.text
+  int64_t m_granularity, m_latOffset, m_lonOffset;
+
+  inline void check (const PbfMessage &m)
+  { if (m.error) throw "syntaxError"; }
+
+  inline unsigned string (uint64_t index)
+  {
+    if (index >= m_strings.size()) throw "syntaxError";
+    return m_strings[index];
+  }
+
+  // Paires key/value donnees par deux champs "packed" d'index de chaines
+  void Tags (OSMData::Batch::Elt &e, PbfMessage keys, PbfMessage vals)
+  {
+    e.tags  = m_b.kv.size();
+    e.ntags = 0;
+    while (! keys.atEnd() && ! vals.atEnd())
+    {
+      m_b.kv.push_back (string (keys.varint()));
+      m_b.kv.push_back (string (vals.varint()));
+      ++e.ntags;
+    }
+    check (keys); check (vals);
+  }
+
+  static inline void Clear (OSMData::Batch::Elt &e)
+  {
+    e.id = 0;
+    e.pos.lat = e.pos.lon = 0;
+    e.action = OSMData::changeCreate;
+    e.tags = e.ntags = 0;
+    e.refs = e.nrefs = 0;
+  }
+
+  void Node (PbfMessage &m)
+  {
+    OSMData::Batch::Elt e;
+    PbfMessage keys, vals;
+    int64_t lat = 0, lon = 0;
+    Clear (e);
+    while (m.next())
+      switch (m.field())
+      {
+        case 1 : e.id = (id_t) m.svarint(); break;
+        case 2 : keys = m.message(); break;
+        case 3 : vals = m.message(); break;
+        case 8 : lat = m.svarint(); break;
+        case 9 : lon = m.svarint(); break;
+        default: m.skip();
+      }
+    check (m);
+    e.pos.lat = nanoToLatlon (m_latOffset + m_granularity * lat);
+    e.pos.lon = nanoToLatlon (m_lonOffset + m_granularity * lon);
+    Tags (e, keys, vals);
+    m_b.nodes.push_back (e);
+  }
+
+  // Les Node "denses" : un tableau par attribut, code en delta
+  // + Les tags de tous les Node sont dans keys_vals, ceux d'un Node
+  //   etant termines par un index 0
+  void DenseNodes (PbfMessage &m)
+  {
+    PbfMessage ids, lats, lons, kvs;
+    while (m.next())
+      switch (m.field())
+      {
+        case 1  : ids  = m.message(); break;
+        case 8  : lats = m.message(); break;
+        case 9  : lons = m.message(); break;
+        case 10 : kvs  = m.message(); break;
+        default : m.skip();           // DenseInfo
+      }
+    check (m);
+
+    int64_t id = 0, lat = 0, lon = 0;
+    while (! ids.atEnd())
+    {
+      OSMData::Batch::Elt e;
+      Clear (e);
+      id  += ids.svarint();
+      lat += lats.svarint();
+      lon += lons.svarint();
+      e.id = (id_t) id;
+      e.pos.lat = nanoToLatlon (m_latOffset + m_granularity * lat);
+      e.pos.lon = nanoToLatlon (m_lonOffset + m_granularity * lon);
+
+      e.tags = m_b.kv.size();
+      while (! kvs.atEnd())
+      {
+        uint64_t const k = kvs.varint();
+        if (k == 0) break;
+        m_b.kv.push_back (string (k));
+        m_b.kv.push_back (string (kvs.varint()));
+        ++e.ntags;
+      }
+      m_b.nodes.push_back (e);
+    }
+    check (ids); check (lats); check (lons); check (kvs);
+  }
+
+  void Way (PbfMessage &m)
+  {
+    OSMData::Batch::Elt e;
+    PbfMessage keys, vals, refs;
+    Clear (e);
+    while (m.next())
+      switch (m.field())
+      {
+        case 1 : e.id = (id_t) m.varint(); break;
+        case 2 : keys = m.message(); break;
+        case 3 : vals = m.message(); break;
+        case 8 : refs = m.message(); break;
+        default: m.skip();            // Info, LocationsOnWays
+      }
+    check (m);
+
+    e.refs = m_b.refs.size();
+    int64_t ref = 0;
+    while (! refs.atEnd())
+    {
+      ref += refs.svarint();
+      m_b.refs.push_back ((id_t) ref);
+    }
+    check (refs);
+    e.nrefs = m_b.refs.size() - e.refs;
+    Tags (e, keys, vals);
+    m_b.ways.push_back (e);
+  }
+
+  void Relation (PbfMessage &m)
+  {
+    OSMData::Batch::Elt e;
+    PbfMessage keys, vals, roles, memids, types;
+    Clear (e);
+    while (m.next())
+      switch (m.field())
+      {
+        case 1  : e.id = (id_t) m.varint(); break;
+        case 2  : keys   = m.message(); break;
+        case 3  : vals   = m.message(); break;
+        case 8  : roles  = m.message(); break;
+        case 9  : memids = m.message(); break;
+        case 10 : types  = m.message(); break;
+        default : m.skip();
+      }
+    check (m);
+
+    e.refs = m_b.members.size();
+    int64_t ref = 0;
+    while (! memids.atEnd())
+    {
+      OSMData::Batch::Member mb;
+      ref += memids.svarint();
+      mb.id   = (id_t) ref;
+      mb.role = string (roles.varint());
+      switch (types.varint())   // MemberType : NODE = 0, WAY = 1, RELATION = 2
+      {
+        case 0  : mb.elt = eltNode; break;
+        case 1  : mb.elt = eltWay; break;
+        case 2  : mb.elt = eltRelation; break;
+        default : throw "syntaxError";
+      }
+      m_b.members.push_back (mb);
+    }
+    check (memids); check (roles); check (types);
+    e.nrefs = m_b.members.size() - e.refs;
+    Tags (e, keys, vals);
+    m_b.relations.push_back (e);
+  }
+};
+
+
+// Decomprimer un Blob
+static void Inflate (const char *p, size_t n, std::vector<char> &out)
+{
+  PbfMessage blob (p, n);
+  const char *raw = NULL, *zdata = NULL;
+  size_t rawlen = 0, zlen = 0;
+  uint64_t rawsize = 0;
+
+  while (blob.next())
+    switch (blob.field())
+    {
+      case 1 : raw = blob.bytes (&rawlen); break;
+      case 2 : rawsize = blob.varint(); break;
+      case 3 : zdata = blob.bytes (&zlen); break;
+      default: blob.skip();             // lzma, zstd, ...
+    }
+  if (blob.error) throw "syntaxError";
+
+  if (raw != NULL)
+    out.assign (raw, raw + rawlen);
+  else if (zdata != NULL)
+  {
+    if (rawsize > maxBlobSize) throw "syntaxError";
+    out.resize (rawsize);
+    uLongf len = rawsize;
+    if (rawsize > 0)
+      if ((uncompress ((Bytef *) &out[0], &len, (const Bytef *) zdata, zlen) != Z_OK)
+          || (len != rawsize))
+        throw "syntaxError";
+  }
+  else
+    throw "unsupportedCompression";
+}
+
+
+// Un lot de Blob "OSMData" lus du fichier, a decoder par le WorkerPool
+class PbfJob : public IJob
+{
+public:
+  std::vector< std::vector<char> > blobs;
+  std::vector<OSMData::Batch> batches;
+  unsigned count;
+
+  PbfJob () : count(0) {}
+
+  void Run (unsigned i)
+  {
+    std::vector<char> raw;
+    OSMData::Batch &b = batches[i];
+    b.clear();
+    try
+    {
+      Inflate (blobs[i].empty() ? NULL : &blobs[i][0], blobs[i].size(), raw);
+      PbfBlockDecoder (b).Decode (raw.empty() ? NULL : &raw[0], raw.size());
+    }
+    catch (const char *error)
+    {
+      b.error = error;          // Sera leve par OSMData::Merge, dans le thread appelant
+    }
+  }
+};
+
+
+// Lire le couple (BlobHeader,Blob) suivant
+// + Retourne false en fin de fichier
+static bool ReadBlob (FILE *fp, std::string &type, std::vector<char> &blob)
+{
+  unsigned char be[4];
+  size_t n = fread (be, 1, 4, fp);
+  if (n == 0) return false;
+  if (n != 4) throw "syntaxError";
+
+  size_t const hlen = ((size_t) be[0] << 24) | (be[1] << 16) | (be[2] << 8) | be[3];
+  if (hlen > maxHeaderSize) throw "syntaxError";
+  std::vector<char> header (hlen + 1);
+  if (fread (&header[0], 1, hlen, fp) != hlen) throw "syntaxError";
+
+  PbfMessage m (&header[0], hlen);
+  uint64_t datasize = 0;
+  type.clear();
+  while (m.next())
+    switch (m.field())
+    {
+      case 1 : { size_t len; const char *s = m.bytes (&len); type.assign (s, len); } break;
+      case 3 : datasize = m.varint(); break;
+      default: m.skip();
+    }
+  if (m.error || (datasize > maxBlobSize)) throw "syntaxError";
+
+  blob.resize (datasize);
+  if ((datasize > 0) && (fread (&blob[0], 1, datasize, fp) != datasize))
+    throw "syntaxError";
+  return true;
+}
+
+// Le HeaderBlock : limites du fichier, et fonctionnalites requises
+static void DecodeHeader (const std::vector<char> &blob, LatLonBox &bound)
+{
+  std::vector<char> raw;
+  Inflate (blob.empty() ? NULL : &blob[0], blob.size(), raw);
+
+  PbfMessage m (raw.empty() ? NULL : &raw[0], raw.size());
+  while (m.next())
+    switch (m.field())
+    {
+      case 1 :  // HeaderBBox, en nanodegres
+      {
+        PbfMessage bbox = m.message();
+        while (bbox.next())
+          switch (bbox.field())
+          {
+            case 1 : bound.min.lon = nanoToLatlon (bbox.svarint()); break;
+            case 2 : bound.max.lon = nanoToLatlon (bbox.svarint()); break;
+            case 3 : bound.max.lat = nanoToLatlon (bbox.svarint()); break;
+            case 4 : bound.min.lat = nanoToLatlon (bbox.svarint()); break;
+            default: bbox.skip();
+          }
+        if (bbox.error) throw "syntaxError";
+      }
+      break;
+
+      case 4 :  // required_features
+      {
+        size_t len;
+        const char *s = m.bytes (&len);
+        std::string feature (s, len);
+        if ((feature != "OsmSchema-V0.6") && (feature != "DenseNodes"))
+        {
+          printf ("PBF: unsupported feature %s\n", feature.c_str());
+          throw "unsupportedFeature";
+        }
+      }
+      break;
+
+      default: m.skip();
+    }
+  if (m.error) throw "syntaxError";
+}
+
+
+// Lire un lot de Blob "OSMData" (le HeaderBlock est traite au passage)
+static void ReadBlobs (FILE *fp, PbfJob &job, LatLonBox &bound)
+{
+  std::string type;
+  job.count = 0;
+  while (job.count < job.blobs.size())
+  {
+    if (! ReadBlob (fp, type, job.blobs[job.count])) break;
+    if (type == "OSMData")
+      ++job.count;
+    else if (type == "OSMHeader")
+      DecodeHeader (job.blobs[job.count], bound);
+    // Les autres types de Blob sont a ignorer
+  }
+}
+
+
+template<class Cfg>
+void BasicOSMData<Cfg>::LoadPBF (const char *filename)
+{
+  FILE *fp = fopen (filename, "rb");
+  if (fp == NULL)
+  {
+    perror (filename);
+    throw "nofile";
+  }
+
+  ReserveFor (fileSize (filename), pbfBytesPerNode);
+  StartLoad();
+
+  // Deux lots : pendant que les threads decodent l'un, le thread appelant
+  // ajoute l'autre a OSMData (ce qui ne peut se faire que dans l'ordre)
+  WorkerPool pool;
+  unsigned const perJob = 4 * (pool.size() + 1);
+  PbfJob jobs[2];
+  for (unsigned j = 0; j < 2; ++j)
+  {
+    jobs[j].blobs.resize (perJob);
+    jobs[j].batches.resize (perJob);
+  }
+
+  try
+  {
+    PbfJob *prev = NULL;
+    for (unsigned k = 0; ; k ^= 1)
+    {
+      PbfJob &job = jobs[k];
+      ReadBlobs (fp, job, m_filebound);
+      pool.Start (&job, job.count);
+
+      if (prev != NULL)
+        for (unsigned i = 0; i < prev->count; ++i)
+          Merge (prev->batches[i]);
+
+      pool.Wait();
+      if (job.count == 0) break;
+      prev = &job;
+    }
+  }
+  catch (...)
+  {
+    pool.Wait();
+    fclose (fp);
+    throw;
+  }
+
+  fclose (fp);
+  EndLoad();
+}
+
+// Instances (cf OSM_FOR_EACH_CONFIG)
+#define INSTANTIATE(Cfg)  template void BasicOSMData<Cfg>::LoadPBF (const char *);
+OSM_FOR_EACH_CONFIG (INSTANTIATE)
+#undef INSTANTIATE
+
+}  // namespace osm
@@ -0,0 +1,867 @@
+// Lecture du XML d'un OSM sans expat
+//
+// Un fichier OSM n'emploie qu'une petite partie de XML : quelques elements
+// (osm, bounds, node, way, nd, relation, member, tag) faits d'attributs, sans
+// texte, sans DTD, en UTF-8. Expat traite le cas general (encodages, entites
+// declarees, validation UTF-8, etc), ce qui coute : d'ou les contournements
+// de OSM.cpp (sameEltName, value(), fixedlatlon).
+// XmlTokenizer ne connait que ce sous-ensemble :
+// + Les '<', '"' et '>' sont cherches 16 octets a la fois (SSE2 si dispo)
+// + Les attributs sont decodes en place dans le tampon de lecture, termines
+//   par un '\0' pose sur leur guillemet fermant : aucune allocation par
+//   attribut, et les entites (&lt; &#233; ...) ne sont traitees que dans les
+//   valeurs qui en contiennent
+// + Les elements sont passes a startElementHandler / endElementHandler,
+//   comme le fait expat : le OSMData obtenu est le meme
+// + Les erreurs de forme (balise non fermee, imbrication fausse, entite
+//   inconnue) levent "syntaxError". Un encodage autre que UTF-8 (ou ASCII)
+//   leve "badEncoding" : il faut alors employer expat.
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "OSM.h"
+#include "Files.h"
+#include "Workers.h"
+
+namespace osm {
+
+//-----------------------------
+// Recherches de caracteres
+
+// Premier c de [p,end), ou end
+static inline char *findChar (char *p, char *end, char c)
+{
+#ifdef __SSE2__
+  __m128i const cc = _mm_set1_epi8 (c);
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i const v = _mm_loadu_si128 ((const __m128i *) p);
+    int const m = _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, cc));
+    if (m != 0) return p + __builtin_ctz (m);
+  }
+#endif
+  while ((p < end) && (*p != c)) ++p;
+  return p;
+}
+
+// Fin d'une valeur d'attribut : premier caractere de [p,end) qui est le
+// guillemet q, ou a traiter ('&', '<', tab/CR/LF), ou end
+static inline bool valueSpecial (char c, char q)
+{
+  return (c == q) || (c == '&') || (c == '<') ||
+         (c == '\t') || (c == '\n') || (c == '\r');
+}
+
+static inline char *findValueEnd (char *p, char *end, char q)
+{
+#ifdef __SSE2__
+  __m128i const cq   = _mm_set1_epi8 (q);
+  __m128i const camp = _mm_set1_epi8 ('&');
+  __m128i const clt  = _mm_set1_epi8 ('<');
+  __m128i const c20  = _mm_set1_epi8 (0x20);
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i const v = _mm_loadu_si128 ((const __m128i *) p);
+    // Les octets UTF-8 (>= 0x80) sont negatifs : on ne retient que [0,0x20)
+    __m128i const ctrl = _mm_and_si128 (_mm_cmplt_epi8 (v, c20),
+                                        _mm_cmpgt_epi8 (v, _mm_setzero_si128()));
+    __m128i const hit = _mm_or_si128 (
+        _mm_or_si128 (_mm_cmpeq_epi8 (v, cq), _mm_cmpeq_epi8 (v, camp)),
+        _mm_or_si128 (_mm_cmpeq_epi8 (v, clt), ctrl));
+    int const m = _mm_movemask_epi8 (hit);
+    if (m != 0)
+    {
+      // Un caractere de controle autre que tab/CR/LF n'est pas special
+      char *s = p + __builtin_ctz (m);
+      while ((s < p + 16) && ! valueSpecial (*s, q)) ++s;
+      if (s < p + 16) return s;
+    }
+  }
+#endif
+  while ((p < end) && ! valueSpecial (*p, q)) ++p;
+  return p;
+}
+
+static inline bool isSpace (char c)
+{
+  return (c == ' ') || (c == '\n') || (c == '\t') || (c == '\r');
+}
+
+// Fin d'un nom d'element ou d'attribut
+static inline bool isNameEnd (char c)
+{
+  return isSpace (c) || (c == '=') || (c == '>') || (c == '/');
+}
+
+
+//-----------------------------
+// Decodage en place d'une valeur d'attribut, terminee par '\0'
+// + Entites predefinies et references numeriques, converties en UTF-8
+// + Normalisation XML : tab, LF, CR et CR-LF deviennent un espace
+// Le resultat n'est jamais plus long que la source
+
+static void decodeValue (char *v)
+{
+  char *r = v, *w = v;
+  for (;;)
+  {
+    char const c = *r;
+    if (c == '\0') break;
+    if (c == '&')
+    {
+      char *semi = strchr (r, ';');
+      if (semi == NULL) throw "syntaxError";
+      *semi = '\0';
+      const char *ent = r + 1;
+      r = semi + 1;
+      if      (! strcmp (ent, "lt"))   *w++ = '<';
+      else if (! strcmp (ent, "gt"))   *w++ = '>';
+      else if (! strcmp (ent, "amp"))  *w++ = '&';
+      else if (! strcmp (ent, "quot")) *w++ = '"';
+      else if (! strcmp (ent, "apos")) *w++ = '\'';
+      else if (ent[0] == '#')
+      {
+        char *e;
+        unsigned long u = (ent[1] == 'x') ? strtoul (ent + 2, &e, 16)
+                                          : strtoul (ent + 1, &e, 10);
+        if ((*e != '\0') || (e == ent + 1) || (u == 0) || (u > 0x10FFFF) ||
+            ((u >= 0xD800) && (u < 0xE000)))
+          throw "syntaxError";
+        if (u < 0x80)
+          *w++ = (char) u;
+        else if (u < 0x800)
+        {
+          *w++ = (char) (0xC0 | (u >> 6));
+          *w++ = (char) (0x80 | (u & 0x3F));
+        }
+        else if (u < 0x10000)
+        {
+          *w++ = (char) (0xE0 | (u >> 12));
+          *w++ = (char) (0x80 | ((u >> 6) & 0x3F));
+          *w++ = (char) (0x80 | (u & 0x3F));
+        }
+        else
+        {
+          *w++ = (char) (0xF0 | (u >> 18));
+          *w++ = (char) (0x80 | ((u >> 12) & 0x3F));
+          *w++ = (char) (0x80 | ((u >> 6) & 0x3F));
+          *w++ = (char) (0x80 | (u & 0x3F));
+        }
+      }
+      else
+        throw "syntaxError";    // Pas de DTD, donc pas d'autre entite
+    }
+    else if (c == '\r')
+    {
+      *w++ = ' ';
+      if (*++r == '\n') ++r;
+    }
+    else if ((c == '\n') || (c == '\t'))
+    {
+      *w++ = ' ';
+      ++r;
+    }
+    else
+      *w++ = *r++;
+  }
+  *w = '\0';
+}
+
+
+//-----------------------------
+// Le lecteur
+// + Chaque bloc lu est ajoute a m_buf, derriere ce qui restait du precedent
+//   (une balise coupee par la fin du bloc). C'est la seule copie, comme celle
+//   que fait XML_Parse dans son propre tampon.
+// + Sink recoit les elements : OSMData, ou un Batch (cf LoadParallelXml)
+
+template<class Sink>
+class XmlTokenizer
+{
+public:
+  XmlTokenizer (Sink *sink) : m_sink(sink), m_depth(0), m_endDepth(0),
+                              m_rootDone(false), m_first(true), m_kept(0),
+                              m_offset(0) {}
+
+  // Lire tout le fichier
+  void Load (IByteFileReader *f);
+
+  // Analyser la suite du fichier. n == 0 : fin, tout doit avoir ete traite
+  void Feed (const char *data, size_t n);
+
+  // Analyse d'une partie seulement du fichier (cf LoadParallelXml)
+  // + Head : le debut, qui s'arrete dans l'element racine (ouvert)
+  // + Tail : un morceau qui commence dans l'element racine, et qui le
+  //   referme s'il est le dernier. offset est sa position dans le fichier
+  inline void Head (void) { m_endDepth = 1; }
+  inline void sink (Sink *s) { m_sink = s; }
+  void Tail (const std::string &root, bool last, unsigned long offset);
+  inline const std::string &root (void) const { return m_open[0]; }
+
+  // Position (octets depuis le debut du fichier) de ce qui est en cours
+  inline unsigned long offset (void) const { return m_offset; }
+
+private:
+  Sink *m_sink;
+  std::vector<char> m_buf;
+  std::vector<const char *> m_atts;     // Paires nom,valeur puis NULL
+  std::vector<char *> m_decode;         // Valeurs a decoder
+  std::vector< std::pair<char *, char> > m_undo;   // Octets remplaces par '\0'
+  std::vector<std::string> m_open;      // Elements ouverts
+  unsigned m_depth, m_endDepth;
+  bool m_rootDone, m_first;
+  size_t m_kept;                        // Octets non traites en tete de m_buf
+  unsigned long m_offset;
+
+  char *Parse (char *p, char *end);
+  char *StartTag (char *lt, char *end);
+  char *EndTag (char *lt, char *end);
+  void Declaration (char *p);
+
+  // Poser un '\0', en memorisant l'octet remplace si la balise est incomplete
+  inline void terminate (char *p)
+  {
+    m_undo.push_back (std::make_pair (p, *p));
+    *p = '\0';
+  }
+};
+
+template<class Sink>
+void XmlTokenizer<Sink>::Load (IByteFileReader *f)
+{
+  do
+  {
+    f->Async_Feed();
+    Feed (f->buffer, f->fill);
+  } while (f->fill > 0);
+}
+
+template<class Sink>
+void XmlTokenizer<Sink>::Tail (const std::string &root, bool last, unsigned long offset)
+{
+  m_first = false;
+  m_rootDone = true;
+  m_open.resize (1);
+  m_open[0] = root;
+  m_depth = 1;
+  m_endDepth = last ? 0 : 1;
+  m_offset = offset;
+}
+
+template<class Sink>
+void XmlTokenizer<Sink>::Feed (const char *data, size_t n)
+{
+  // Ajouter le bloc, plus une fin '\0' (cf decodeValue)
+  if (m_buf.size() < m_kept + n + 1)
+    m_buf.resize (m_kept + n + 1);
+  if (n > 0)
+    memcpy (&m_buf[m_kept], data, n);
+  char *const begin = &m_buf[0];
+  char *p = begin;
+  char *const end = begin + m_kept + n;
+  *end = '\0';
+
+  if (m_first && (end - p >= 4))
+  {
+    m_first = false;
+    // BOM UTF-8 admis, UTF-16 non
+    if (! memcmp (p, "\xEF\xBB\xBF", 3)) p += 3;
+    else if (((p[0] == '\xFE') && (p[1] == '\xFF')) ||
+             ((p[0] == '\xFF') && (p[1] == '\xFE')) ||
+             (p[0] == '\0') || (p[1] == '\0'))
+      throw "badEncoding";
+  }
+
+  p = Parse (p, end);
+
+  if (n == 0)           // Fin : tout doit avoir ete traite
+  {
+    if ((p != end) || (m_depth != m_endDepth) || ! m_rootDone)
+      throw "syntaxError";
+    return;
+  }
+
+  m_kept = end - p;
+  m_offset += p - begin;
+  memmove (begin, p, m_kept);
+}
+
+// Traiter ce qui est complet dans [p,end), rendre le debut de ce qui ne l'est pas
+template<class Sink>
+char *XmlTokenizer<Sink>::Parse (char *p, char *end)
+{
+  for (;;)
+  {
+    // Le texte entre les balises n'est que de la mise en page
+    p = findChar (p, end, '<');
+    if (end - p < 2) return p;
+
+    char *next;
+    switch (p[1])
+    {
+      case '/' :
+        next = EndTag (p, end);
+        break;
+
+      case '?' :        // <?xml ... ?>  ou autre instruction
+      {
+        next = NULL;
+        for (char *q = p + 2; (q = findChar (q, end, '>')) < end; ++q)
+          if (q[-1] == '?')
+          {
+            *q = '\0';
+            if (! strncmp (p + 2, "xml", 3) && isSpace (p[5]))
+              Declaration (p + 5);
+            next = q + 1;
+            break;
+          }
+      }
+      break;
+
+      case '!' :        // Commentaire, CDATA ou DOCTYPE
+      {
+        if (end - p < ((p[2] == '[') ? 9 : 4)) return p;
+        const char *open, *close;
+        if      (! strncmp (p, "<!--", 4))      { open = "<!--";      close = "-->"; }
+        else if (! strncmp (p, "<![CDATA[", 9)) { open = "<![CDATA["; close = "]]>"; }
+        else                                    { open = "<!";        close = ">"; }
+        size_t const n = strlen (close);
+        char *const from = p + strlen (open);
+        next = NULL;
+        for (char *q = from; (q = findChar (q, end, '>')) < end; ++q)
+          if ((q + 1 - n >= from) && ! strncmp (q + 1 - n, close, n))
+          {
+            next = q + 1;
+            break;
+          }
+        // Un DOCTYPE a sous-ensemble interne peut declarer des entites
+        if ((next != NULL) && (n == 1) && (memchr (p, '[', next - p) != NULL))
+          throw "syntaxError";
+      }
+      break;
+
+      default :
+        next = StartTag (p, end);
+        break;
+    }
+    if (next == NULL) return p;         // Incomplet
+    p = next;
+  }
+}
+
+// <?xml version="1.0" encoding="UTF-8"?>
+template<class Sink>
+void XmlTokenizer<Sink>::Declaration (char *p)
+{
+  char *enc = strstr (p, "encoding");
+  if (enc == NULL) return;              // UTF-8 par defaut
+  enc += 8;
+  while (isSpace (*enc) || (*enc == '=')) ++enc;
+  char const q = *enc++;
+  char *e = strchr (enc, q);
+  if (e == NULL) throw "syntaxError";
+  *e = '\0';
+  if (strcasecmp (enc, "UTF-8") && strcasecmp (enc, "US-ASCII"))
+    throw "badEncoding";
+}
+
+// <name att="value" ...> ou <name ... />
+template<class Sink>
+char *XmlTokenizer<Sink>::StartTag (char *lt, char *end)
+{
+  m_atts.clear();
+  m_decode.clear();
+  m_undo.clear();
+
+  char *p = lt + 1;
+  char *const name = p;
+  while ((p < end) && ! isNameEnd (*p)) ++p;
+  if ((p == name) && (p < end)) throw "syntaxError";
+
+  bool empty = false;           // <name ... />
+  char *next = NULL;
+  while (p < end)
+  {
+    // Fin du nom precedent
+    char c = *p;
+    if (! isSpace (c) && (c != '>') && (c != '/'))
+      throw "syntaxError";
+    while ((p < end) && isSpace (*p)) ++p;
+    if (p >= end) break;
+    c = *p;
+
+    if (c == '>')
+    {
+      next = p + 1;
+      terminate (p);
+      break;
+    }
+    if (c == '/')
+    {
+      if (p + 1 >= end) break;
+      if (p[1] != '>') throw "syntaxError";
+      empty = true;
+      next = p + 2;
+      terminate (p);
+      break;
+    }
+
+    // Attribut  nom = "valeur"
+    char *const att = p;
+    while ((p < end) && ! isNameEnd (*p)) ++p;
+    if (p >= end) break;
+    if (p == att) throw "syntaxError";
+    char *const attEnd = p;
+    while ((p < end) && isSpace (*p)) ++p;
+    if (p >= end) break;
+    if (*p != '=') throw "syntaxError";
+    ++p;
+    while ((p < end) && isSpace (*p)) ++p;
+    if (p >= end) break;
+    char const q = *p++;
+    if ((q != '"') && (q != '\'')) throw "syntaxError";
+    char *const value = p;
+    bool decode = false;
+    for (;;)
+    {
+      p = findValueEnd (p, end, q);
+      if ((p >= end) || (*p == q)) break;
+      if (*p == '<') throw "syntaxError";
+      decode = true;
+      ++p;
+    }
+    if (p >= end) break;
+
+    terminate (attEnd);
+    terminate (p);
+    ++p;
+    m_atts.push_back (att);
+    m_atts.push_back (value);
+    if (decode) m_decode.push_back (value);
+  }
+
+  if (next == NULL)
+  {
+    // Balise coupee par la fin du tampon : la rendre intacte
+    for (unsigned i = m_undo.size(); i-- > 0; )
+      *m_undo[i].first = m_undo[i].second;
+    return NULL;
+  }
+
+  // Le nom de l'element se termine au premier separateur
+  for (char *n = name; *n != '\0'; ++n)
+    if (isSpace (*n)) { *n = '\0'; break; }
+
+  for (unsigned i = 0; i < m_decode.size(); ++i)
+    decodeValue (m_decode[i]);
+  m_atts.push_back (NULL);
+
+  if (m_depth == 0)
+  {
+    if (m_rootDone) throw "syntaxError";        // Un seul element racine
+    m_rootDone = true;
+  }
+
+  m_sink->startElementHandler (name, &m_atts[0]);
+  if (empty)
+    m_sink->endElementHandler (name);
+  else
+  {
+    if (m_open.size() <= m_depth) m_open.resize (m_depth + 1);
+    m_open[m_depth++].assign (name);
+  }
+  return next;
+}
+
+// </name>
+template<class Sink>
+char *XmlTokenizer<Sink>::EndTag (char *lt, char *end)
+{
+  char *const gt = findChar (lt + 2, end, '>');
+  if (gt >= end) return NULL;
+  char *const name = lt + 2;
+  char *p = name;
+  while ((p < gt) && ! isSpace (*p)) ++p;
+  for (char *s = p; s < gt; ++s)
+    if (! isSpace (*s)) throw "syntaxError";
+  *p = '\0';
+
+  if ((m_depth == 0) || (m_open[m_depth - 1] != name))
+    throw "syntaxError";
+  --m_depth;
+  m_sink->endElementHandler (name);
+  return gt + 1;
+}
+
+
+//-----------------------------
+
+template<class Cfg>
+template<class T>
+void BasicOSMData<Cfg>::ParseNativeXml (IByteFileReader *f, T &sink)
+{
+  XmlTokenizer<T> xml (&sink);
+  try
+  {
+    xml.Load (f);
+  }
+  catch (...)
+  {
+    printf ("EXC offset %lu  node=%u way=%u relations=%u\n",
+            xml.offset(), (unsigned) m_nodes.size(),
+            (unsigned) m_ways.size(), (unsigned) m_relations.size());
+    throw;
+  }
+}
+
+
+
+//-----------------------------
+// Lecture en parallele d'un fichier mappe
+// + Le fichier est coupe devant des elements "<node", "<way" ou "<relation",
+//   qui sont toujours des fils de l'element racine : chaque morceau est donc
+//   une suite d'elements complets, analysable seul, dans un Batch
+// + Le debut (<?xml, <osm>, <bounds>) est lu directement, en serie
+// + Un "<node" dans un commentaire serait pris pour un debut d'element : le
+//   morceau qui commence la serait alors faux (syntaxError). Les OSM n'ont
+//   pas de tels commentaires.
+
+static const size_t chunkSize = 4*1024*1024;
+
+static inline bool startsElement (const char *p, const char *end, const char *name)
+{
+  size_t const n = strlen (name);
+  return ((size_t) (end - p) > n) && ! memcmp (p, name, n) && isNameEnd (p[n]);
+}
+
+// Debut du premier element node/way/relation de [p,end), ou end
+static const char *findElement (const char *p, const char *end)
+{
+  while ((p = (const char *) memchr (p, '<', end - p)) != NULL)
+  {
+    if (startsElement (p, end, "<node") || startsElement (p, end, "<way") ||
+        startsElement (p, end, "<relation"))
+      return p;
+    ++p;
+  }
+  return end;
+}
+
+// Un lot de morceaux, a analyser par le WorkerPool
+class XmlChunkJob : public IJob
+{
+public:
+  const char *base;             // Debut du fichier
+  std::string root;             // Nom de l'element racine
+  std::vector<const char *> begin, end;
+  std::vector<OSMData::Batch> batches;
+  unsigned count;
+  bool last;                    // Le dernier morceau est la fin du fichier
+
+  XmlChunkJob () : base(NULL), count(0), last(false) {}
+
+  void Run (unsigned i)
+  {
+    OSMData::Batch &b = batches[i];
+    b.clear();
+    XmlTokenizer<OSMData::Batch> xml (&b);
+    xml.Tail (root, last && (i == count-1), begin[i] - base);
+    try
+    {
+      xml.Feed (begin[i], end[i] - begin[i]);
+      xml.Feed (NULL, 0);
+    }
+    catch (const char *error)
+    {
+      printf ("EXC offset %lu\n", xml.offset());
+      b.error = error;          // Sera leve par OSMData::Merge, dans le thread appelant
+    }
+  }
+};
+
+template<class Cfg>
+void BasicOSMData<Cfg>::LoadParallelXml (IByteFileReader *f)
+{
+  size_t size;
+  const char *const data = f->Whole (&size);
+  if (data == NULL)             // Pas mappe (comprime, etc) : lecture en serie
+  {
+    ParseNativeXml (f, *this);
+    return;
+  }
+  const char *const end = data + size;
+
+  // Le debut, jusqu'au premier element node/way/relation
+  const char *p = findElement (data, end);
+  XmlTokenizer<BasicOSMData> head (this);
+  if (p < end) head.Head();
+  try
+  {
+    head.Feed (data, p - data);
+    head.Feed (NULL, 0);
+  }
+  catch (...)
+  {
+    printf ("EXC offset %lu\n", head.offset());
+    throw;
+  }
+  if (p == end) return;
+
+  // Deux lots : pendant que les threads analysent l'un, le thread appelant
+  // ajoute l'autre a OSMData (ce qui ne peut se faire que dans l'ordre)
+  WorkerPool pool;
+  unsigned const perJob = 2 * (pool.size() + 1);
+  XmlChunkJob jobs[2];
+  for (unsigned j = 0; j < 2; ++j)
+  {
+    jobs[j].base = data;
+    jobs[j].root = head.root();
+    jobs[j].begin.resize (perJob);
+    jobs[j].end.resize (perJob);
+    jobs[j].batches.resize (perJob);
+  }
+
+  try
+  {
+    XmlChunkJob *prev = NULL;
+    for (unsigned k = 0; ; k ^= 1)
+    {
+      XmlChunkJob &job = jobs[k];
+      for (job.count = 0; (job.count < perJob) && (p < end); ++job.count)
+      {
+        job.begin[job.count] = p;
+        p = (end - p > (ptrdiff_t) chunkSize) ? findElement (p + chunkSize, end) : end;
+        job.end[job.count] = p;
+      }
+      job.last = (p == end);
+      pool.Start (&job, job.count);
+
+      if (prev != NULL)
+        for (unsigned i = 0; i < prev->count; ++i)
+          Merge (prev->batches[i]);
+
+      pool.Wait();
+      if (job.count == 0) break;
+      prev = &job;
+    }
+  }
+  catch (...)
+  {
+    pool.Wait();
+    throw;
+  }
+}
+
+
+//-----------------------------
+// Lecture de plusieurs fichiers ensemble (cf LoadText (filenames))
+// + Chaque fichier est analyse dans l'ordre par son XmlTokenizer (ou son
+//   parser expat), mais les fichiers le sont en meme temps : un tour lit un
+//   morceau de chacun, dans un Batch, sur le WorkerPool
+// + Un morceau s'arrete devant un element node/way/relation (cf
+//   findElement), apres au moins chunkSize octets
+// + Les Batch d'un tour sont ajoutes a OSMData dans l'ordre des fichiers,
+//   pendant que les threads analysent le tour suivant
+
+static void XMLCALL batchStartElement (void *b, const XML_Char *name, const XML_Char **atts)
+{ ((OSMData::Batch *) b)->startElementHandler (name, atts); }
+
+static void XMLCALL batchEndElement (void *b, const XML_Char *name)
+{ ((OSMData::Batch *) b)->endElementHandler (name); }
+
+// Un fichier en cours de lecture
+class XmlStream
+{
+public:
+  // expat : analyse par expat plutot que par XmlTokenizer (cf xmlExpat)
+  XmlStream (IByteFileReader *f, bool expat) : done (false), m_f (f), m_xml (NULL),
+                                   m_expat (NULL), m_data (NULL), m_left (0)
+  {
+    if (! expat) return;
+    m_expat = XML_ParserCreate (NULL);
+    XML_SetElementHandler (m_expat, batchStartElement, batchEndElement);
+  }
+  ~XmlStream ()
+  {
+    if (m_expat != NULL) XML_ParserFree (m_expat);
+    delete m_f;
+  }
+
+  bool done;                    // Lu jusqu'au bout (ou en erreur)
+
+  // Analyser le morceau suivant dans b
+  void Next (OSMData::Batch &b)
+  {
+    b.clear();
+    m_xml.sink (&b);
+    if (m_expat != NULL) XML_SetUserData (m_expat, &b);
+    try
+    {
+      for (size_t n = 0; ; )
+      {
+        if (m_left == 0)
+        {
+          m_f->Async_Feed();
+          m_data = m_f->buffer;
+          m_left = m_f->fill;
+          if (m_left == 0)
+          {
+            parse (NULL, 0);
+            done = true;
+            return;
+          }
+        }
+        if (n + m_left > chunkSize)
+        {
+          const char *const end = m_data + m_left;
+          const char *const cut = findElement ((n < chunkSize) ? m_data + (chunkSize - n) : m_data, end);
+          if (cut < end)
+          {
+            if (cut > m_data) parse (m_data, cut - m_data);
+            m_left -= cut - m_data;
+            m_data = cut;       // Reste a nous jusqu'au prochain Async_Feed
+            return;
+          }
+        }
+        parse (m_data, m_left);
+        n += m_left;
+        m_left = 0;
+      }
+    }
+    catch (const char *error)
+    {
+      printf ("EXC offset %lu\n", (m_expat != NULL) ?
+              (unsigned long) XML_GetCurrentByteIndex (m_expat) : m_xml.offset());
+      b.error = error;          // Sera leve par OSMData::Merge, dans le thread appelant
+      done = true;
+    }
+  }
+
+private:
+  IByteFileReader *m_f;
+  XmlTokenizer<OSMData::Batch> m_xml;
+  XML_Parser m_expat;           // NULL : m_xml
+  const char *m_data;           // Pas encore analyse, dans le bloc lu
+  size_t m_left;
+
+  // Analyser n octets de plus (0 : fin du fichier)
+  void parse (const char *data, size_t n)
+  {
+    if (m_expat == NULL)
+      m_xml.Feed (data, n);
+    else if (! XML_Parse (m_expat, data, n, n == 0))
+      throw "syntaxError";
+  }
+};
+
+// Un tour : un morceau de chaque fichier pas encore fini
+class XmlStreamsJob : public IJob
+{
+public:
+  std::vector<XmlStream *> streams;
+  std::vector<OSMData::Batch> batches;
+
+  void Run (unsigned i)
+  { streams[i]->Next (batches[i]); }
+};
+
+template<class Cfg>
+void BasicOSMData<Cfg>::LoadText (const std::vector<const char *> &filenames)
+{
+  std::vector<XmlStream *> streams;
+  LatLonBox bound;              // Union des "bounds" des fichiers
+  bound.close();
+  bool hasBound = false;
+
+  // Les references vers un autre fichier sont resolues a la fin : sans
+  // cela, celles vers un element ajoute plus tard seraient perdues
+  refMode const refs = m_refMode;
+  m_refMode = refsDeferred;
+
+  try
+  {
+    size_t bytes = 0;
+    for (unsigned i = 0; i < filenames.size(); ++i)
+    {
+      IByteFileReader *f = NewByteFileReader (filenames[i]);
+      if (f == NULL) throw "nofile";
+      streams.push_back (new XmlStream (f, m_xmlParser == xmlExpat));
+      bytes += fileSize (filenames[i]);
+    }
+    ReserveFor (bytes, xmlBytesPerNode);
+
+    StartLoad();
+    m_refMode = refs;
+
+    // Deux tours : pendant que les threads analysent l'un, le thread
+    // appelant ajoute l'autre a OSMData
+    WorkerPool pool;
+    XmlStreamsJob jobs[2];
+    try
+    {
+      XmlStreamsJob *prev = NULL;
+      for (unsigned k = 0; ; k ^= 1)
+      {
+        XmlStreamsJob &job = jobs[k];
+        job.streams.clear();
+        for (unsigned i = 0; i < streams.size(); ++i)
+          if (! streams[i]->done) job.streams.push_back (streams[i]);
+        job.batches.resize (job.streams.size());
+        pool.Start (&job, job.streams.size());
+
+        if (prev != NULL)
+          for (unsigned i = 0; i < prev->batches.size(); ++i)
+          {
+            const Batch &b = prev->batches[i];
+            if (b.hasBound)
+            {
+              bound.extend (b.bound.min);
+              bound.extend (b.bound.max);
+              hasBound = true;
+            }
+            Merge (b);
+          }
+
+        pool.Wait();
+        if (job.streams.empty()) break;
+        prev = &job;
+      }
+    }
+    catch (...)
+    {
+      pool.Wait();
+      throw;
+    }
+  }
+  catch (...)
+  {
+    m_refMode = refs;
+    for (unsigned i = 0; i < streams.size(); ++i)
+      delete streams[i];
+    throw;
+  }
+
+  for (unsigned i = 0; i < streams.size(); ++i)
+    delete streams[i];
+  if (hasBound) m_filebound = bound;
+  EndLoad();
+}
+
+// Instances (cf OSM_FOR_EACH_CONFIG)
+#define INSTANTIATE(Cfg) \
+  template void BasicOSMData<Cfg>::ParseNativeXml (IByteFileReader *, BasicOSMData<Cfg> &); \
+  template void BasicOSMData<Cfg>::ParseNativeXml (IByteFileReader *, ClipScan &); \
+  template void BasicOSMData<Cfg>::ParseNativeXml (IByteFileReader *, Batch &); \
+  template void BasicOSMData<Cfg>::LoadParallelXml (IByteFileReader *); \
+  template void BasicOSMData<Cfg>::LoadText (const std::vector<const char *> &);
+OSM_FOR_EACH_CONFIG (INSTANTIATE)
+#undef INSTANTIATE
+
+}  // namespace osm
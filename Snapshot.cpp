@@ -0,0 +1,357 @@
+// Snapshot d'un OSMData charge (cf OSMData::SaveSnapshot dans OSM.h)
+//
+// Relire "rhone-alpes.osm" prend une minute ou plus a chaque lancement de
+// testosm ou testgl, pour retrouver toujours les memes tableaux. Un snapshot
+// est l'image de ces tableaux : une en-tete, puis une section par Column,
+// alignee sur 64 octets et designee par son offset dans le fichier. Rien n'y
+// est un pointeur, le fichier peut donc etre mappe a n'importe quelle adresse
+// et ses sections employees telles quelles.
+//
+// + Ordre des sections : cf columns(), seul endroit qui le definisse
+// + Les chaines des atomes autres que les commonTag sont une section de
+//   char, mises bout a bout avec leur 0 final, dans l'ordre des atomes
+// + Sans mmap (WIN32), le fichier est lu en RAM d'un bloc
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include <sys/stat.h>
+
+#include "OSM.h"
+
+namespace osm {
+
+static const char snapshotMagic[8] = { 'O', 'S', 'M', 'S', 'N', 'A', 'P', 0 };
+static const uint32_t snapshotVersion = 1;
+static const unsigned maxSections = 32;
+static const size_t sectionAlign = 64;
+
+struct SnapshotSection
+{
+  uint64_t offset;              // Depuis le debut du fichier
+  uint64_t count;               // Nombre de T
+  uint32_t size;                // sizeof (T)
+  uint32_t unused;
+};
+
+struct SnapshotHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t idBytes;             // Config::id_type
+  uint32_t nodeTagged;          // Config::nodeTagged
+  uint32_t sections;
+  LatLonBox filebound, loadbound;
+  SnapshotSection section[maxSections];
+};
+
+// Les id et TagRun des Way ou des Relation, en colonnes
+// + Un Way a une vtable : ce sont ces colonnes qui vont au fichier
+template<class Cfg>
+struct ElementColumns
+{
+  IdColumn<typename Cfg::id_type> ids;
+  Column<TagRun> tags;
+
+  template<class E> void From (const BlockColumn<E> &elts)
+  {
+    ids.reserve (elts.size());
+    tags.reserve (elts.size());
+    for (unsigned i = 0; i < elts.size(); ++i)
+    {
+      ids.push_back (elts[i].id());
+      tags.push_back (elts[i].mTags);
+    }
+  }
+
+  template<class E> void To (BlockColumn<E> &elts) const
+  {
+    elts.resize (tags.size());
+    for (unsigned i = 0; i < elts.size(); ++i)
+    {
+      elts[i].Init();
+      elts[i].setId (ids.get (i));
+      elts[i].mTags = tags[i];
+    }
+  }
+};
+
+// Les Column d'un snapshot, dans l'ordre du fichier
+// + S est SnapshotWriter ou SnapshotReader
+template<class D, class S>
+static void columns (S &s, D &osm, ElementColumns<typename D::Config> &ways,
+    ElementColumns<typename D::Config> &relations, Column<char> &strings)
+{
+  osm.m_nodes.snapshot (s);
+  ways.ids.snapshot (s);
+  s.column (ways.tags);
+  osm.m_wayNodes.snapshot (s);
+  osm.m_wayDeltas.snapshot (s);
+  relations.ids.snapshot (s);
+  s.column (relations.tags);
+  osm.m_members.snapshot (s);
+  s.column (osm.m_tagArena.pairs);
+  s.column (strings);
+}
+
+
+//-----------------------------
+// Ecriture
+
+class SnapshotWriter
+{
+public:
+  SnapshotWriter (FILE *fp, SnapshotHeader &header)
+    : m_fp (fp), m_header (header), m_offset (sizeof (SnapshotHeader)) {}
+
+  template<class T> void column (const Column<T> &c)
+  {
+    section<T> (c.size());
+    write (c.begin(), c.size());
+  }
+
+  // Les blocs, bout a bout : la section est contigue
+  template<class T> void column (const BlockColumn<T> &c)
+  {
+    section<T> (c.size());
+    for (unsigned b = 0; b < c.blocks(); ++b)
+      write (c.block (b), c.blockCount (b));
+  }
+
+private:
+  template<class T> void section (size_t count)
+  {
+    if (m_header.sections >= maxSections) throw "ProgramError";
+    m_offset = (m_offset + sectionAlign - 1) / sectionAlign * sectionAlign;
+    SnapshotSection &s = m_header.section[m_header.sections++];
+    s.offset = m_offset;
+    s.count  = count;
+    s.size   = sizeof (T);
+    s.unused = 0;
+    if (fseek (m_fp, m_offset, SEEK_SET) != 0) throw "nofile";
+  }
+
+  template<class T> void write (const T *data, size_t count)
+  {
+    if (fwrite (data, sizeof (T), count, m_fp) != count) throw "nofile";
+    m_offset += count * sizeof (T);
+  }
+
+  FILE *m_fp;
+  SnapshotHeader &m_header;
+  uint64_t m_offset;
+};
+
+template<class Cfg>
+void BasicOSMData<Cfg>::SaveSnapshot (const char *filename) const
+{
+  BasicOSMData &self = const_cast<BasicOSMData &> (*this);     // Lu seulement
+
+  ElementColumns<Cfg> ways, relations;
+  ways.From (m_ways);
+  relations.From (m_relations);
+  Column<char> strings;
+  for (atom_t a = tagCommonCount; a < m_tagArena.atomCount(); ++a)
+  {
+    const char *p = m_tagArena.atomString (a);
+    do strings.push_back (*p); while (*p++ != 0);
+  }
+
+  FILE *fp = fopen (filename, "wb");
+  if (fp == NULL)
+  {
+    perror (filename);
+    throw "nofile";
+  }
+
+  SnapshotHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, snapshotMagic, sizeof (header.magic));
+  header.version    = snapshotVersion;
+  header.idBytes    = IdColumn<typename Cfg::id_type>::bytes;
+  header.nodeTagged = Cfg::nodeTagged;
+  header.filebound  = m_filebound;
+  header.loadbound  = m_loadbound;
+
+  try
+  {
+    SnapshotWriter w (fp, header);
+    columns (w, self, ways, relations, strings);
+    if ((fseek (fp, 0, SEEK_SET) != 0) ||
+        (fwrite (&header, sizeof (header), 1, fp) != 1))
+      throw "nofile";
+  }
+  catch (...)
+  {
+    fclose (fp);
+    throw;
+  }
+  if (fclose (fp) != 0) throw "nofile";
+}
+
+
+//-----------------------------
+// Lecture
+
+class SnapshotReader
+{
+public:
+  SnapshotReader (const char *base, size_t size)
+    : m_base (base), m_size (size), m_next (0),
+      m_header (*(const SnapshotHeader *) base) {}
+
+  template<class T> void column (Column<T> &c) { map (c); }
+  template<class T> void column (BlockColumn<T> &c) { map (c); }
+
+private:
+  template<class T, template<class> class C> void map (C<T> &c)
+  {
+    if (m_next >= m_header.sections) throw "syntaxError";
+    const SnapshotSection &s = m_header.section[m_next++];
+    if (s.size != sizeof (T)) throw "syntaxError";
+    if (s.count == 0)           // Sans octet dans le fichier, meme en fin
+    {
+      c.map (NULL, 0);
+      return;
+    }
+    if ((s.offset % sectionAlign != 0) ||
+        (s.offset > m_size) || (s.count > (m_size - s.offset) / sizeof (T)))
+      throw "syntaxError";
+    c.map ((const T *) (m_base + s.offset), s.count);
+  }
+
+  const char *m_base;
+  size_t m_size;
+  unsigned m_next;
+  const SnapshotHeader &m_header;
+};
+
+// Remettre a vide les Column deja mappees par un SnapshotReader qui a echoue
+class SnapshotReset
+{
+public:
+  template<class T> void column (Column<T> &c) { c.map (NULL, 0); }
+  template<class T> void column (BlockColumn<T> &c) { c.map (NULL, 0); }
+};
+
+// Le fichier entier, mappe (ou lu) : les atomes et les paires y pointent.
+// Il est rendu avec la TagArena (cf TagArena::adopt), ou par unmapSnapshot
+// s'il n'a pas pu etre ouvert
+static const char *mapSnapshot (const char *filename, size_t *size)
+{
+  struct stat st;
+  if (stat (filename, &st) != 0)
+  {
+    perror (filename);
+    throw "nofile";
+  }
+  if ((size_t) st.st_size < sizeof (SnapshotHeader)) throw "syntaxError";
+  *size = st.st_size;
+
+#ifndef WIN32
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+  {
+    perror (filename);
+    throw "nofile";
+  }
+  // Prive : un T modifie sur place n'atteint pas le fichier, et seule sa
+  // page cesse d'etre partagee
+  void *p = mmap (NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (p == MAP_FAILED)
+  {
+    perror (filename);
+    throw "nofile";
+  }
+  return (const char *) p;
+#else
+  FILE *fp = fopen (filename, "rb");
+  char *p = (char *) malloc (*size);
+  bool const ok = (fp != NULL) && (p != NULL) && (fread (p, 1, *size, fp) == *size);
+  if (fp != NULL) fclose (fp);
+  if (! ok)
+  {
+    perror (filename);
+    throw "nofile";
+  }
+  return p;
+#endif
+}
+
+static void unmapSnapshot (const char *base, size_t size)
+{
+#ifndef WIN32
+  munmap ((void *) base, size);
+#else
+  (void) size;
+  free ((void *) base);
+#endif
+}
+
+template<class Cfg>
+void BasicOSMData<Cfg>::OpenSnapshot (const char *filename)
+{
+  if (m_nodes.size() + m_ways.size() + m_relations.size() != 0)
+    throw "ProgramError";
+
+  if (! m_tagArena.pairs.empty() || (m_tagArena.atomCount() != (unsigned) tagCommonCount))
+    throw "ProgramError";
+
+  size_t size;
+  const char *const base = mapSnapshot (filename, &size);
+  const SnapshotHeader &header = *(const SnapshotHeader *) base;
+  ElementColumns<Cfg> ways, relations;
+  Column<char> strings;
+
+  // En cas d'echec, l'OSMData redevient vide et le fichier est rendu : un
+  // autre OpenSnapshot reste possible
+  try
+  {
+    if (memcmp (header.magic, snapshotMagic, sizeof (header.magic)) ||
+        (header.version != snapshotVersion) ||
+        (header.idBytes != IdColumn<typename Cfg::id_type>::bytes) ||
+        (header.nodeTagged != (uint32_t) Cfg::nodeTagged) ||
+        (header.sections > maxSections))
+      throw "syntaxError";
+
+    SnapshotReader r (base, size);
+    columns (r, *this, ways, relations, strings);
+
+    // Les atomes, dans l'ordre : les numeros des paires restent justes
+    unsigned count = 0;
+    for (size_t i = 0; i < strings.size(); ++i)
+      if (strings[i] == 0) ++count;
+    if (! strings.empty() && (strings.back() != 0)) throw "syntaxError";
+    if (! m_tagArena.mapAtoms (strings.begin(), count)) throw "ProgramError";
+  }
+  catch (...)
+  {
+    SnapshotReset z;
+    columns (z, *this, ways, relations, strings);
+    unmapSnapshot (base, size);
+    throw;
+  }
+  m_tagArena.adopt (base, size);
+
+  ways.To (m_ways);
+  relations.To (m_relations);
+  m_filebound = header.filebound;
+  m_loadbound = header.loadbound;
+  m_badrefwn = m_badrefr = 0;
+  m_indexPending = true;
+}
+
+// Instances (cf OSM_FOR_EACH_CONFIG)
+#define INSTANTIATE(Cfg) \
+  template void BasicOSMData<Cfg>::SaveSnapshot (const char *) const; \
+  template void BasicOSMData<Cfg>::OpenSnapshot (const char *);
+OSM_FOR_EACH_CONFIG (INSTANTIATE)
+#undef INSTANTIATE
+
+}  // namespace osm
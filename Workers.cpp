@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "Workers.h"
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+unsigned NumberOfCores (void)
+{
+#if defined(WIN32)
+  SYSTEM_INFO si;
+  GetSystemInfo (&si);
+  return (si.dwNumberOfProcessors > 0) ? si.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+  return (n > 0) ? (unsigned) n : 1;
+#else
+  return 1;
+#endif
+}
+
+
+#ifndef HAS_PTHREAD
+WorkerPool::WorkerPool (unsigned nthreads)
+{
+  m_count = 1;
+}
+
+WorkerPool::~WorkerPool ()
+{
+}
+
+void WorkerPool::Start (IJob *job, unsigned count)
+{
+  for (unsigned i = 0; i < count; ++i)
+    job->Run (i);
+}
+
+void WorkerPool::Wait (void)
+{
+}
+
+#else
+// Sommet "C" des threads
+extern "C" void *worker_entry (void *arg)
+{
+  ((WorkerPool *) arg)->entry();
+  return NULL;
+}
+
+WorkerPool::WorkerPool (unsigned nthreads)
+{
+  if (nthreads == 0) nthreads = NumberOfCores();
+
+  pthread_mutex_init (&m_mutex, NULL);
+  pthread_cond_init (&m_work, NULL);
+  pthread_cond_init (&m_done, NULL);
+  m_job = NULL;
+  m_next = m_total = m_finished = 0;
+  m_quit = false;
+
+  m_threads = new pthread_t[nthreads];
+  for (m_count = 0; m_count < nthreads; ++m_count)
+    if (pthread_create (&m_threads[m_count], NULL, worker_entry, this) != 0)
+    {
+      perror ("pthread_create");
+      break;
+    }
+}
+
+WorkerPool::~WorkerPool ()
+{
+  pthread_mutex_lock (&m_mutex);
+  m_quit = true;
+  pthread_cond_broadcast (&m_work);
+  pthread_mutex_unlock (&m_mutex);
+
+  for (unsigned i = 0; i < m_count; ++i)
+    pthread_join (m_threads[i], NULL);
+  delete[] m_threads;
+
+  pthread_cond_destroy (&m_done);
+  pthread_cond_destroy (&m_work);
+  pthread_mutex_destroy (&m_mutex);
+}
+
+void WorkerPool::Start (IJob *job, unsigned count)
+{
+  if (m_count == 0)
+  {                             // Pas de thread : retour a l'execution synchrone
+    for (unsigned i = 0; i < count; ++i)
+      job->Run (i);
+    return;
+  }
+
+  pthread_mutex_lock (&m_mutex);
+  m_job = job;
+  m_next = 0;
+  m_total = count;
+  m_finished = 0;
+  pthread_cond_broadcast (&m_work);
+  pthread_mutex_unlock (&m_mutex);
+}
+
+void WorkerPool::Wait (void)
+{
+  pthread_mutex_lock (&m_mutex);
+  while (m_finished < m_total)
+    pthread_cond_wait (&m_done, &m_mutex);
+  m_job = NULL;
+  pthread_mutex_unlock (&m_mutex);
+}
+
+// Un thread du pool : prendre le prochain morceau du lot courant, jusqu'a
+// ce qu'il n'y en ait plus, puis attendre le lot suivant
+void WorkerPool::entry (void)
+{
+  pthread_mutex_lock (&m_mutex);
+  for (;;)
+  {
+    while (! m_quit && ((m_job == NULL) || (m_next >= m_total)))
+      pthread_cond_wait (&m_work, &m_mutex);
+    if (m_quit) break;
+
+    IJob * const job = m_job;
+    unsigned const i = m_next++;
+    pthread_mutex_unlock (&m_mutex);
+
+    job->Run (i);
+
+    pthread_mutex_lock (&m_mutex);
+    if (++m_finished == m_total)
+      pthread_cond_broadcast (&m_done);
+  }
+  pthread_mutex_unlock (&m_mutex);
+}
+#endif
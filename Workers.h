@@ -0,0 +1,60 @@
+// Helper class to run a set of independant jobs on several threads
+//
+// Un WorkerPool garde ses threads d'un lot de travaux a l'autre : l'appelant
+// lance un lot par Start(), fait autre chose (par exemple consommer le lot
+// precedent), puis attend la fin du lot par Wait().
+// + Sans -DHAS_PTHREAD, Start() execute tout le lot avant de retourner
+
+#ifndef _H_WORKERS
+#define _H_WORKERS
+
+#ifdef HAS_PTHREAD
+#include <pthread.h>
+#endif
+
+// Un travail decoupe en morceaux independants, numerotes 0..count-1
+// + Run() est appele depuis plusieurs threads a la fois, sur des numeros differents
+class IJob
+{
+public:
+  virtual ~IJob() {}
+  virtual void Run (unsigned i) = 0;
+};
+
+class WorkerPool
+{
+public:
+  // nthreads == 0 : autant que de coeurs
+  WorkerPool (unsigned nthreads = 0);
+  ~WorkerPool ();
+
+  // Lancer job->Run(0..count-1) sur les threads, sans attendre
+  void Start (IJob *job, unsigned count);
+
+  // Attendre que tous les Run() du lot lance par Start() soient finis
+  void Wait (void);
+
+  // Start() + Wait()
+  void Run (IJob *job, unsigned count)
+  { Start (job, count); Wait(); }
+
+  unsigned size (void) const { return m_count; }
+
+#ifdef HAS_PTHREAD
+  void entry (void);    // private
+private:
+  pthread_t *m_threads;
+  pthread_mutex_t m_mutex;
+  pthread_cond_t  m_work, m_done;
+  IJob *m_job;
+  unsigned m_next, m_total, m_finished;
+  bool m_quit;
+#endif
+private:
+  unsigned m_count;     // Nombre de threads
+};
+
+// Nombre de coeurs de la machine (1 si inconnu)
+unsigned NumberOfCores (void);
+
+#endif
@@ -135,12 +135,12 @@ void osmRender::Render (void)
 
 void osmRender::RenderName (const mgl::Vec3 here, const osm::Tags &tags, int size)
 {
-  if ((tags.name != NULL) && (mFont != NULL))
+  if ((tags.name() != NULL) && (mFont != NULL))
   {
     mFont->FaceSize(size);
     glPushMatrix();
     glTranslated (here.vec[0], here.vec[1], here.vec[2] + 60.0);
-    mFont->Render(tags.name);
+    mFont->Render(tags.name());
     glPopMatrix();
   }
 }
@@ -148,7 +148,7 @@ void osmRender::RenderName (const mgl::Vec3 here, const osm::Tags &tags, int siz
 
 void osmRender::RenderNode (unsigned index)
 {
-  osm::OSMData::Node &node = mOSM->m_nodes[index];
+  osm::OSMData::Node node = mOSM->m_nodes[index];
   mgl::Vec3 v;
   Project (node.pos.degLat(), node.pos.degLon(), &v);
 
@@ -175,53 +175,60 @@ void osmRender::RenderWay (unsigned index)
   if (mWdone[index]) return;
 
   const osm::OSMData::Way &way = mOSM->m_ways[index];
-  if (way.nodesIx.size() == 0) return;
+  const osm::WayNodes nodes = mOSM->wayNodes (index);
+  if (nodes.empty()) return;
 
-  switch (way.tags().kind)
+  switch (way.tags (mOSM->m_tagArena).kind())
   {
     case osm::Tags::unknown :
-      if (! way.isLoop())
+      if (! mOSM->isLoop (index))
       {
         Material (1.0, 0.0, 0.0, 25.0);
-        RenderWayLine (way);
+        RenderWayLine (way, nodes);
       }
       else
       {
         Material (0.76, 0.80, 0.76, 25.0);         // A peu pres la couleur de fond, verdatre
-        RenderWayArea (way);
+        RenderWayArea (way, nodes);
       }
     break;
 
     case osm::Tags::building :          // En principe on a tags().isLoop
+    {
+      // height, sinon ~3m par etage, sinon une hauteur arbitraire
+      const osm::Tags tags = way.tags (mOSM->m_tagArena);
+      GLdouble height = tags.height();
+      if (height <= 0.0) height = (tags.levels() != 0) ? 3.0 * tags.levels() : 15.0;
       Material (0.6f, 0.6f, 0.6f, 25.0);
-      RenderWayExtruded (way, 15.0);    // TODO: comment connaitre sa hauteur ?
+      RenderWayExtruded (way, nodes, height);
+    }
     break;
 
     case osm::Tags::highway :
-      if (way.isLoop())       // Une place peut taggee highway=footway
+      if (mOSM->isLoop (index))       // Une place peut taggee highway=footway
       {
         Material (0.9f, 0.5f, 0.0f, 25.0);
-        RenderWayArea (way);
+        RenderWayArea (way, nodes);
       }
       else
       {
         Material (1.0f, 0.5f, 0.1f, 25.0);
-        RenderWayStrip (way, 5.0);
+        RenderWayStrip (way, nodes, 5.0);
       }
     break;
 
     case osm::Tags::waterway :
       Material (0.0f, 0.0f, 1.0f, 25.0);     // Blue (but the Seine is brown ...)
-      RenderWayStrip (way, 10.0);
+      RenderWayStrip (way, nodes, 10.0);
     break;
 
     case osm::Tags::railway :
       Material (0.5f, 0.1f, 0.7f, 25.0);
-//    RenderWayStrip (way, 3.0);
+//    RenderWayStrip (way, nodes, 3.0);
       glEnable(GL_LINE_STIPPLE);
       glLineStipple (1, 0xF0F0);
       glLineWidth (2.0);
-      RenderWayLine (way);
+      RenderWayLine (way, nodes);
       glDisable(GL_LINE_STIPPLE);
     break;
 
@@ -230,37 +237,37 @@ void osmRender::RenderWay (unsigned index)
 
   if (true)
   {
-    osm::OSMData::Node &p = mOSM->m_nodes[way.nodesIx[0]];
+    const osm::LatLon &p = mOSM->m_nodes.pos[nodes.front()];
     mgl::Vec3 v;
-    Project (p.pos.degLat(), p.pos.degLon(), &v);
-    RenderName (v, way.tags(), 12);
+    Project (p.degLat(), p.degLon(), &v);
+    RenderName (v, way.tags (mOSM->m_tagArena), 12);
   }
 }
 
-void osmRender::RenderWayLine (const osm::OSMData::Way &way)
+void osmRender::RenderWayLine (const osm::OSMData::Way &way, const osm::WayNodes &nodes)
 {
-  if (way.nodesIx.size() <= 1) return;
-  const GLdouble layer = way.tags().layer;
+  if (nodes.size() <= 1) return;
+  const GLdouble layer = way.tags (mOSM->m_tagArena).layer();
 
   // Une simple ligne brisee : pour les LoD faibles
   glLineWidth (1.0);
   glBegin (GL_LINE_STRIP);
-  for (unsigned n = 0; n < way.nodesIx.size(); ++n)
+  for (osm::WayNodeIterator n = nodes.begin(); n != nodes.end(); ++n)
   {
-    osm::OSMData::Node &p = mOSM->m_nodes[way.nodesIx[n]];
+    const osm::LatLon &p = mOSM->m_nodes.pos[*n];
     mgl::Vec3 v;
-    Project (p.pos.degLat(), p.pos.degLon(), &v);
+    Project (p.degLat(), p.degLon(), &v);
     glVertex3d (v.vec[0], v.vec[1], v.vec[2]+layer);
     ++mVertices;
   }
   glEnd();
 }
 
-void osmRender::RenderWayArea (const osm::OSMData::Way &way)
+void osmRender::RenderWayArea (const osm::OSMData::Way &way, const osm::WayNodes &nodes)
 {
-  if (way.nodesIx.size() <= 2) return;
-  if (! way.isLoop()) return;
-  const GLdouble layer = way.tags().layer - 500.0;
+  if (nodes.size() <= 2) return;
+  if (nodes.front() != nodes.back()) return;
+  const GLdouble layer = way.tags (mOSM->m_tagArena).layer() - 500.0;
 
 //return;       // En fait assez nuisible ... regler layer
 
@@ -268,11 +275,11 @@ void osmRender::RenderWayArea (const osm::OSMData::Way &way)
   glEnable(GL_POLYGON_STIPPLE);
 //glPolygonStipple(pattern);
   glBegin (GL_POLYGON);
-  for (unsigned n = 0; n < way.nodesIx.size(); ++n)
+  for (osm::WayNodeIterator n = nodes.begin(); n != nodes.end(); ++n)
   {
-    osm::OSMData::Node &p = mOSM->m_nodes[way.nodesIx[n]];
+    const osm::LatLon &p = mOSM->m_nodes.pos[*n];
     mgl::Vec3 v;
-    Project (p.pos.degLat(), p.pos.degLon(), &v);
+    Project (p.degLat(), p.degLon(), &v);
     glVertex3d (v.vec[0], v.vec[1], v.vec[2]+layer);
     ++mVertices;
   }
@@ -283,10 +290,10 @@ void osmRender::RenderWayArea (const osm::OSMData::Way &way)
 
 //
 //
-void osmRender::RenderWayStrip (const osm::OSMData::Way &way, GLdouble width)
+void osmRender::RenderWayStrip (const osm::OSMData::Way &way, const osm::WayNodes &nodes, GLdouble width)
 {
-  if (way.nodesIx.size() <= 1) return;
-  const GLdouble layer = way.tags().layer;
+  if (nodes.size() <= 1) return;
+  const GLdouble layer = way.tags (mOSM->m_tagArena).layer();
 
 #if 0
   // La voie simple : une LINE_STRIP, mais de taille large
@@ -294,11 +301,11 @@ void osmRender::RenderWayStrip (const osm::OSMData::Way &way, GLdouble width)
   //   soit la distance d'observation.
   glLineWidth (width);
   glBegin (GL_LINE_STRIP);
-  for (unsigned n = 0; n < way.nodesIx.size(); ++n)
+  for (osm::WayNodeIterator n = nodes.begin(); n != nodes.end(); ++n)
   {
-    osm::OSMData::Node &p = mOSM->m_nodes[way.nodesIx[n]];
+    const osm::LatLon &p = mOSM->m_nodes.pos[*n];
     mgl::Vec3 v;
-    Project (p.pos.degLat(), p.pos.degLon(), &v);
+    Project (p.degLat(), p.degLon(), &v);
     glVertex3d (v.vec[0], v.vec[1], v.vec[2]+layer);
     ++mVertices;
   }
@@ -311,16 +318,17 @@ void osmRender::RenderWayStrip (const osm::OSMData::Way &way, GLdouble width)
   mgl::Vec3 curr, prev, v;
   v.vec[0] = v.vec[1] = 0.0; // Ceci fait plaisir au compilateur sur le risque de non-init
  
-  osm::OSMData::Node &p = mOSM->m_nodes[way.nodesIx[0]];
-  Project (p.pos.degLat(), p.pos.degLon(), &prev);
+  osm::WayNodeIterator n = nodes.begin();
+  const osm::LatLon &p = mOSM->m_nodes.pos[*n];
+  Project (p.degLat(), p.degLon(), &prev);
 
   glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
   glBegin (GL_QUADS);
 //glNormal3d (0.0, 0.0, 1.0);
-  for (unsigned n = 1; n < way.nodesIx.size(); ++n)
+  for (++n; n != nodes.end(); ++n)
   {
-    osm::OSMData::Node &p = mOSM->m_nodes[way.nodesIx[n]];
-    Project (p.pos.degLat(), p.pos.degLon(), &curr);
+    const osm::LatLon &p = mOSM->m_nodes.pos[*n];
+    Project (p.degLat(), p.degLon(), &curr);
 
     // OSM est une carte 2D ... pour trouver la direction en largeur du Way
     // une rotation dans l'horizontale. Ce sera faux avec SRTM ?
@@ -341,7 +349,7 @@ void osmRender::RenderWayStrip (const osm::OSMData::Way &way, GLdouble width)
 
     prev = curr;
   }
-  mVertices += 2 * way.nodesIx.size();
+  mVertices += 2 * nodes.size();
 #else
   // La voie fatigante comme un ensemble de TRIANGLE
   // + Pour faire comme des QUAD mais un une petite excroissance triangulaire, approchant un
@@ -350,16 +358,17 @@ void osmRender::RenderWayStrip (const osm::OSMData::Way &way, GLdouble width)
   mgl::Vec3 curr, prev;
   GLdouble x,y;
  
-  osm::OSMData::Node &p = mOSM->m_nodes[way.nodesIx[0]];
-  Project (p.pos.degLat(), p.pos.degLon(), &prev);
+  osm::WayNodeIterator n = nodes.begin();
+  const osm::LatLon &p = mOSM->m_nodes.pos[*n];
+  Project (p.degLat(), p.degLon(), &prev);
 
   glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);   // normal=FILL debug=LINE
 
 //glNormal3d (0.0, 0.0, 1.0);
-  for (unsigned n = 1; n < way.nodesIx.size(); ++n)
+  for (++n; n != nodes.end(); ++n)
   {
-    osm::OSMData::Node &p = mOSM->m_nodes[way.nodesIx[n]];
-    Project (p.pos.degLat(), p.pos.degLon(), &curr);
+    const osm::LatLon &p = mOSM->m_nodes.pos[*n];
+    Project (p.degLat(), p.degLon(), &curr);
 
     // (x,y) est le vecteur 2D parallele a l'axe du segment courant, de longueur width/2 :
     x = curr.vec[0] - prev.vec[0];
@@ -394,20 +403,21 @@ void osmRender::RenderWayStrip (const osm::OSMData::Way &way, GLdouble width)
 
 // Juste les murs et le toit, pas de plancher
 //
-void osmRender::RenderWayExtruded (const osm::OSMData::Way &way, GLdouble height)
+void osmRender::RenderWayExtruded (const osm::OSMData::Way &way, const osm::WayNodes &nodes, GLdouble height)
 {
-  if (way.nodesIx.size() <= 3) return;
-  const GLdouble layer = way.tags().layer;
+  if (nodes.size() <= 3) return;
+  const GLdouble layer = way.tags (mOSM->m_tagArena).layer();
 
-  mgl::Vec3 grnd[way.nodesIx.size()];             // Should be small
+  mgl::Vec3 grnd[nodes.size()];             // Should be small
  
   // Walls
   glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
   glBegin (GL_QUAD_STRIP);
-  for (unsigned n = 0; n < way.nodesIx.size(); ++n)
+  osm::WayNodeIterator i = nodes.begin();
+  for (unsigned n = 0; n < nodes.size(); ++n, ++i)
   {
-    osm::OSMData::Node &p = mOSM->m_nodes[way.nodesIx[n]];
-    Project (p.pos.degLat(), p.pos.degLon(), &grnd[n]);
+    const osm::LatLon &p = mOSM->m_nodes.pos[*i];
+    Project (p.degLat(), p.degLon(), &grnd[n]);
     grnd[n].vec[2] += layer;
     glVertex3d (grnd[n].vec[0], grnd[n].vec[1], grnd[n].vec[2]);
     glVertex3d (grnd[n].vec[0], grnd[n].vec[1], grnd[n].vec[2]+height);
@@ -419,7 +429,7 @@ void osmRender::RenderWayExtruded (const osm::OSMData::Way &way, GLdouble height
   // Roof
   glBegin (GL_POLYGON);
 //glNormal3d (0.0, 0.0, 1.0);
-  for (unsigned n = 0; n < way.nodesIx.size(); ++n)
+  for (unsigned n = 0; n < nodes.size(); ++n)
     glVertex3d (grnd[n].vec[0], grnd[n].vec[1], grnd[n].vec[2]+height);
   glVertex3d (grnd[0].vec[0], grnd[0].vec[1], grnd[0].vec[2]+height);
   glEnd();
@@ -429,7 +439,7 @@ void osmRender::RenderWayExtruded (const osm::OSMData::Way &way, GLdouble height
   glLineWidth (1.5);
   glColor3f (0.0, 0.0, 0.0);
   glBegin (GL_QUAD_STRIP);
-  for (unsigned n = 0; n < way.nodesIx.size(); ++n)
+  for (unsigned n = 0; n < nodes.size(); ++n)
   {
     glVertex3d (grnd[n].vec[0], grnd[n].vec[1], grnd[n].vec[2]);
     glVertex3d (grnd[n].vec[0], grnd[n].vec[1], grnd[n].vec[2]+height);
@@ -438,7 +448,7 @@ void osmRender::RenderWayExtruded (const osm::OSMData::Way &way, GLdouble height
   glVertex3d (grnd[0].vec[0], grnd[0].vec[1], grnd[0].vec[2]+height);
   glEnd();
  
-  mVertices += 4 * (way.nodesIx.size()+1);
+  mVertices += 4 * (nodes.size()+1);
 }
 
 
@@ -447,31 +457,31 @@ void osmRender::RenderRelation (unsigned index, unsigned guard)
   // Not too deep please
   if (++guard > 10) return;
 
-  osm::OSMData::Relation &relation = mOSM->m_relations[index];
+  const osm::Span<osm::OSMData::Relation::Member> members = mOSM->m_members[index];
 
   // Render each member of relation
-  for (unsigned m = 0; m < relation.eltIx.size(); ++m)
+  for (unsigned m = 0; m < members.size(); ++m)
   {
-    switch (relation.eltIx[m].elt)
+    switch (members[m].elt)
     {
       case osm::eltNode :
       {
-        RenderNode (relation.eltIx[m].ix);
+        RenderNode (members[m].ix);
       }
       break;
 
       case osm::eltWay :
       {
-        RenderWay (relation.eltIx[m].ix);
+        RenderWay (members[m].ix);
 
         // Noter que ce Way est deja trace comme element d'un Relation
-        mWdone[relation.eltIx[m].ix] = true;
+        mWdone[members[m].ix] = true;
       }
       break;
 
       case osm::eltRelation :
       {
-        RenderRelation (relation.eltIx[m].ix, guard); 
+        RenderRelation (members[m].ix, guard); 
       }
       break;
     }
@@ -479,9 +489,9 @@ void osmRender::RenderRelation (unsigned index, unsigned guard)
 
 //if (guard == 0)
 //{
-//  osm::OSMData::Node &p = mOSM->m_nodes[way.nodesIx[0]];
+//  const osm::LatLon &p = mOSM->m_nodes.pos[way.nodesIx[0]];
 //  mgl::Vec3 v;
-//  Project (p.pos.degLat(), p.pos.degLon(), &v);
+//  Project (p.degLat(), p.degLon(), &v);
 //  RenderName (v, node.tags(), 72);
 //}
 }
@@ -28,10 +28,10 @@ private:
   void RenderRelation (unsigned index, unsigned guard = 0);
   void Project (double degLat, double degLon, mgl::Vec3 *vec3);
 
-  void RenderWayLine (const osm::OSMData::Way &way);
-  void RenderWayArea (const osm::OSMData::Way &way);
-  void RenderWayExtruded (const osm::OSMData::Way &way, GLdouble height);
-  void RenderWayStrip (const osm::OSMData::Way &way, GLdouble width);
+  void RenderWayLine (const osm::OSMData::Way &way, const osm::WayNodes &nodes);
+  void RenderWayArea (const osm::OSMData::Way &way, const osm::WayNodes &nodes);
+  void RenderWayExtruded (const osm::OSMData::Way &way, const osm::WayNodes &nodes, GLdouble height);
+  void RenderWayStrip (const osm::OSMData::Way &way, const osm::WayNodes &nodes, GLdouble width);
   void RenderName (const mgl::Vec3 here, const osm::Tags &tags, int size);
 };
 
@@ -248,7 +248,11 @@ int main(int argc, char **argv)
   setcam();
 
   print_rusage();
-  OSM.LoadText (argv[1]);  //("/c/GIS/Aravis.OSM");
+  size_t const len = strlen (argv[1]);
+  if ((len > 5) && ! strcmp (argv[1] + len - 5, ".snap"))
+    OSM.OpenSnapshot (argv[1]);         // Cf testosm -W
+  else
+    OSM.LoadText (argv[1]);  //("/c/GIS/Aravis.OSM");
   print_rusage();
 
   OSMgeom.Bind (&OSM);
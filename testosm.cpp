@@ -1,68 +1,428 @@
 #include <sys/time.h>
 #include <stdio.h>
+#include <string.h>
 #include <getopt.h>
 //#ifdef __GNUC__
 //#include <mcheck.h>
 //#endif
 #include "OSM.h"
+#include "Decode.h"
 
 #include "rusage.h"
 
-int main (int argc, char **argv)
+// Comparer deux chargements du meme fichier (cf option -c)
+// + Retourne le nombre de differences, et affiche les premieres
+// + Chaque chargement a ses atomes (cf TagArena) : les chaines sont comparees
+static bool sameTags (const osm::Tags &a, const osm::Tags &b)
 {
-//uint64_t id = 0;      // Can always hold a id_t whatever OSM_ID32
+  if (a.size() != b.size()) return false;
+  if (memcmp (&a.values(), &b.values(), sizeof (osm::TagValues))) return false;
+  for (unsigned i = 0; i < a.size(); ++i)
+  {
+    const char *const v = b.get (a.str (a[i].key));
+    if ((v == NULL) || strcmp (v, a.str (a[i].value)))
+      return false;
+  }
+  return true;
+}
 
-  // CLI options
-  int c;
-  bool opt_nodes = false;      // Show all nodes
-  bool opt_ways  = false;      // Show all ways
-  bool opt_relations = false;  // Show all relations
-  bool opt_manyrefs = false;   // Show Node having >10 references
-  bool opt_reftaged = false;   // Show Node having tags and references
-  bool opt_rnnotag = false;    // Show Node having R-ref and no tag
-
-  while ((c = getopt(argc, argv, "nwrmts")) > 0)
-    switch (c)
+template<class D>
+static unsigned compareOSM (D &a, D &b)
+{
+  unsigned diffs = 0;
+#define DIFF(what, i) { if (++diffs <= 10) printf ("DIFF %s %u\n", what, (unsigned) (i)); }
+
+  if ((a.m_nodes.size() != b.m_nodes.size()) ||
+      (a.m_ways.size() != b.m_ways.size()) ||
+      (a.m_relations.size() != b.m_relations.size()))
+    DIFF ("counts", 0);
+  if ((a.m_badrefwn != b.m_badrefwn) || (a.m_badrefr != b.m_badrefr))
+    DIFF ("badrefs", 0);
+  if (memcmp (&a.m_filebound, &b.m_filebound, sizeof(a.m_filebound)) ||
+      memcmp (&a.m_loadbound, &b.m_loadbound, sizeof(a.m_loadbound)))
+    DIFF ("bounds", 0);
+
+  for (unsigned i = 0; (i < a.m_nodes.size()) && (i < b.m_nodes.size()); ++i)
+  {
+    typename D::Node p = a.m_nodes[i], q = b.m_nodes[i];
+    if ((p.id() != q.id()) || (p.pos.lat != q.pos.lat) ||
+        (p.pos.lon != q.pos.lon) || ! sameTags (p.tags(), q.tags()))
+      DIFF ("node", i);
+  }
+  for (unsigned i = 0; (i < a.m_ways.size()) && (i < b.m_ways.size()); ++i)
+  {
+    typename D::Way &p = a.m_ways[i], &q = b.m_ways[i];
+    osm::WayNodes pn = a.wayNodes (i), qn = b.wayNodes (i);
+    if ((p.id() != q.id()) || (pn.size() != qn.size()) ||
+        ! std::equal (pn.begin(), pn.end(), qn.begin()) ||
+        ! sameTags (p.tags (a.m_tagArena), q.tags (b.m_tagArena)))
+      DIFF ("way", i);
+  }
+  for (unsigned i = 0; (i < a.m_relations.size()) && (i < b.m_relations.size()); ++i)
+  {
+    typename D::Relation &p = a.m_relations[i], &q = b.m_relations[i];
+    osm::Span<typename D::Relation::Member> pm = a.m_members[i], qm = b.m_members[i];
+    bool same = (p.id() == q.id()) && (pm.size() == qm.size()) &&
+                sameTags (p.tags (a.m_tagArena), q.tags (b.m_tagArena));
+    for (unsigned m = 0; same && (m < pm.size()); ++m)
+      same = (pm[m].elt == qm[m].elt) && (pm[m].ix == qm[m].ix);
+    if (! same)
+      DIFF ("relation", i);
+  }
+#undef DIFF
+  return diffs;
+}
+
+// Verifier les decodeurs rapides de Decode.h contre les versions scalaires
+// (cf option -d)
+// + Toutes les parties fractionnaires 0..9999999, ecrites sur 7 chiffres
+//   et sans les zeros de fin, pour quelques parties entieres, puis toutes
+//   les parties entieres [-180,180] avec quelques fractions
+// + Les id 0..9999999, toutes les puissances de 2 et de 10 a +/-1 pres, et
+//   les id negatifs
+// + Chaque chaine est placee a plusieurs distances d'une fin de page, pour
+//   passer aussi par les replis scalaires
+// Retourne le nombre d'erreurs
+static char decodePage[3*4096];
+
+static unsigned checkOne (const char *str, bool isId)
+{
+  // Debut de page alignee, et chaine collee a sa fin (ou pas)
+  char *const page = decodePage + 4096 - ((uintptr_t) decodePage & 4095);
+  size_t const len = strlen (str) + 1;
+  unsigned errors = 0;
+  for (unsigned pad = 0; pad < 12; pad += 11)
+  {
+    char *const p = page + 4096 - len - pad;
+    memcpy (p, str, len);
+    bool ok = isId ? (osm::decodeId (p) == osm::scalarId (p))
+                   : (osm::decodeLatLon (p) == osm::scalarLatLon (p));
+    if (! ok && (++errors <= 10))
+      printf ("DECODE ERROR \"%s\" pad=%u\n", str, pad);
+  }
+  return errors;
+}
+
+static unsigned checkDecoders (void)
+{
+  static const int ints[] = { 0, 1, 48, 99, 180 };
+  char str[64];
+  unsigned errors = 0, count = 0;
+
+  for (unsigned i = 0; i < sizeof(ints)/sizeof(ints[0]); ++i)
+    for (int sign = 0; sign < 2; ++sign)
+      for (unsigned f = 0; f < 10000000; ++f)
+      {
+        int n = sprintf (str, "%s%d.%07u", sign ? "-" : "", ints[i], f);
+        errors += checkOne (str, false);
+        while (str[n-1] == '0') str[--n] = '\0';
+        errors += checkOne (str, false);
+        count += 2;
+      }
+  for (int i = -180; i <= 180; ++i)
+    for (unsigned f = 0; f < 10000000; f += 9973)
     {
-      case 'n' : opt_nodes     = true; break;
-      case 'w' : opt_ways      = true; break;
-      case 'r' : opt_relations = true; break;
-      case 'm' : opt_manyrefs  = true; break;
-      case 't' : opt_reftaged  = true; break;
-      case 's' : opt_rnnotag   = true; break;
+      sprintf (str, "%d.%u", i, f);
+      errors += checkOne (str, false);
+      sprintf (str, "%d", i);
+      errors += checkOne (str, false);
+      count += 2;
     }
-  if (optind != argc-1) return -1;
+  static const char *odd[] = { "", "-", ".", "-.", "0.", ".5", "-0", "+1.5",
+                               " 12.5", "12.50000001", "1234.5" };
+  for (unsigned i = 0; i < sizeof(odd)/sizeof(odd[0]); ++i, ++count)
+    errors += checkOne (odd[i], false);
+  printf ("# Decode lat/lon : %u strings, %u errors\n", count, errors);
 
-  osm::OSMData OSM;
+  unsigned idErrors = 0;
+  count = 0;
+  for (unsigned id = 0; id < 10000000; ++id, ++count)
+  {
+    sprintf (str, "%u", id);
+    idErrors += checkOne (str, true);
+  }
+  for (int k = 0; k < 64; ++k)
+    for (int d = -1; d <= 1; ++d)
+    {
+      uint64_t const p2 = ((uint64_t) 1 << k) + d;
+      sprintf (str, "%llu", (unsigned long long) p2);
+      idErrors += checkOne (str, true);
+      sprintf (str, "-%llu", (unsigned long long) p2);
+      idErrors += checkOne (str, true);
+      count += 2;
+    }
+  uint64_t p10 = 1;
+  for (int k = 0; k < 20; ++k, p10 *= 10)
+    for (int d = -1; d <= 1; ++d, ++count)
+    {
+      sprintf (str, "%llu", (unsigned long long) (p10 + d));
+      idErrors += checkOne (str, true);
+    }
+  static const char *oddId[] = { "", "-", "18446744073709551615",
+                                 "18446744073709551616", "99999999999999999999",
+                                 "000000000000000000000012", " 12", "+12", "12a" };
+  for (unsigned i = 0; i < sizeof(oddId)/sizeof(oddId[0]); ++i, ++count)
+    idErrors += checkOne (oddId[i], true);
+  printf ("# Decode id      : %u strings, %u errors\n", count, idErrors);
 
-  // Restriction a une zone.
-  osm::LatLonBox clip;
-  clip.open();          // Par defaut, tout prendre
+  return errors + idErrors;
+}
 
+// Comparer les IIdIndex sur les id d'un OSM charge (cf option -b)
+// + Ajout des id des Node, Way, Relation dans l'ordre du fichier, puis
+//   recherche des Node de chaque Way et des membres de chaque Relation,
+//   comme au chargement
+// Retourne le nombre d'erreurs
+static double elapsed (struct timeval &prev)
+{
+  struct timeval curr;
+  gettimeofday (&curr, NULL);
+  double const dur =   (double) (curr.tv_sec - prev.tv_sec)
+                     + (double) (curr.tv_usec - prev.tv_usec)/1.0e6;
+  prev = curr;
+  return dur;
+}
 
-  // Lecture de fichier, chronometree pour test des perfs
+template<class D>
+static unsigned benchIdIndex (D &OSM)
+{
+  if (D::Element::idBits == 0)
   {
-    struct timeval prev, curr;
-    print_rusage();
-    gettimeofday(&prev, NULL);
-    OSM.LoadText (argv[optind], clip);
-    gettimeofday(&curr, NULL);
-    double dur =   (double) (curr.tv_sec - prev.tv_sec)
-                 + (double) (curr.tv_usec - prev.tv_usec)/1.0e6;
-    printf ("Loaded OSM file in %.3fs\n", dur);
-    print_rusage();
+    printf ("# Id index bench needs stored ids (-L full)\n");
+    return 0;
   }
+  std::vector<osm::id_t> refs;
+  std::vector<int> expected;
+  for (unsigned i = 0; i < OSM.m_ways.size(); ++i)
+  {
+    const osm::WayNodes ix = OSM.wayNodes (i);
+    for (osm::WayNodeIterator n = ix.begin(); n != ix.end(); ++n)
+    {
+      refs.push_back (OSM.m_nodes[*n].id());
+      expected.push_back (*n);
+    }
+  }
+  size_t const nrefs = refs.size();
+  for (unsigned i = 0; i < OSM.m_relations.size(); ++i)
+  {
+    const osm::Span<typename D::Relation::Member> m = OSM.m_members[i];
+    for (unsigned n = 0; n < m.size(); ++n)
+    {
+      refs.push_back ((m[n].elt == osm::eltNode) ? OSM.m_nodes[m[n].ix].id() :
+                      (m[n].elt == osm::eltWay)  ? OSM.m_ways[m[n].ix].id() :
+                                                   OSM.m_relations[m[n].ix].id());
+      expected.push_back (m[n].ix);
+    }
+  }
+
+  static const char *names[] = { "map", "hash", "sorted", "dense" };
+  unsigned errors = 0;
+  printf ("# Id index  %8s %8s %10s  (%u ids, %u lookups)\n", "add", "find", "bytes",
+      (unsigned) (OSM.m_nodes.size() + OSM.m_ways.size() + OSM.m_relations.size()),
+      (unsigned) refs.size());
+  for (unsigned k = 0; k < 4; ++k)
+  {
+    osm::IIdIndex *idx[3];
+    for (unsigned t = 0; t < 3; ++t)
+      idx[t] = osm::NewIdIndex ((osm::idIndexKind) k);
+
+    struct timeval prev;
+    gettimeofday (&prev, NULL);
+    for (unsigned i = 0; i < OSM.m_nodes.size(); ++i)
+      idx[0]->set (OSM.m_nodes[i].id(), i);
+    for (unsigned i = 0; i < OSM.m_ways.size(); ++i)
+      idx[1]->set (OSM.m_ways[i].id(), i);
+    for (unsigned i = 0; i < OSM.m_relations.size(); ++i)
+      idx[2]->set (OSM.m_relations[i].id(), i);
+    double const add = elapsed (prev);
+
+    unsigned bad = 0;
+    for (size_t i = 0; i < nrefs; ++i)
+      bad += (idx[0]->find (refs[i]) != expected[i]);
+    unsigned r = 0;
+    for (unsigned i = 0; i < OSM.m_relations.size(); ++i)
+    {
+      const osm::Span<typename D::Relation::Member> m = OSM.m_members[i];
+      for (unsigned n = 0; n < m.size(); ++n, ++r)
+        bad += (idx[m[n].elt]->find (refs[nrefs + r]) != expected[nrefs + r]);
+    }
+    double const find = elapsed (prev);
+
+    size_t const bytes = idx[0]->memory() + idx[1]->memory() + idx[2]->memory();
+    printf ("# Id index  %8.3f %8.3f %10u  %s\n", add, find, (unsigned) bytes, names[k]);
+    if (bad != 0) printf ("# Id index %s : %u errors\n", names[k], bad);
+    errors += bad;
+    for (unsigned t = 0; t < 3; ++t)
+      delete idx[t];
+  }
+  return errors;
+}
+
+// Options (cf main)
+static bool opt_nodes = false;      // Show all nodes
+static bool opt_ways  = false;      // Show all ways
+static bool opt_relations = false;  // Show all relations
+static bool opt_manyrefs = false;   // Show Node having >10 references
+static bool opt_reftaged = false;   // Show Node having tags and references
+static bool opt_rnnotag = false;    // Show Node having R-ref and no tag
+static bool opt_native = false;     // Read XML without expat
+static bool opt_parallel = false;   // Idem, in chunks on all cores
+static bool opt_check = false;      // Cross-check expat and native XML readers,
+                                    // or a .pbf against its .osm
+static bool opt_decode = false;     // Check id and lat/lon decoders, then exit
+static const char *opt_clip = NULL; // Load only "minlat,minlon,maxlat,maxlon"
+static bool opt_complete = false;   // Idem, keeping whole ways
+static int opt_zoom = -1;           // Load only what is visible at this zoom
+static const char *opt_index = NULL;// Id index kind : map, hash, sorted, dense
+static bool opt_bench = false;      // Compare id index kinds
+static bool opt_deferred = false;   // Resolve references after loading
+static bool opt_delta = false;      // Delta-coded way geometry
+static const char *opt_store = NULL;// Node positions in this file ("-" : temporary)
+static osm::nodeStoreKind opt_storeKind = osm::storeDense;
+static const char *opt_snapshot = NULL; // Save the loaded data as a snapshot
+static const char *opt_change = NULL;   // Apply this osmChange after loading
+static bool opt_multi = false;      // Load the XML files together (extracts)
+
+static osm::LatLonBox clip;         // Cf opt_clip
+static osm::INodeStore *store = NULL;
+
+static int indexKind (const char *name)
+{
+  if (! strcmp (name, "map"))    return osm::idMap;
+  if (! strcmp (name, "hash"))   return osm::idHash;
+  if (! strcmp (name, "sorted")) return osm::idSorted;
+  if (! strcmp (name, "dense"))  return osm::idDense;
+  return -1;
+}
+
+// Appliquer les options de chargement a OSM
+template<class D>
+static void configure (D &OSM)
+{
+  if (opt_native) OSM.m_xmlParser = D::xmlNative;
+  if (opt_parallel) OSM.m_xmlParser = D::xmlParallel;
+  if (opt_deferred) OSM.m_refMode = D::refsDeferred;
+  if (opt_delta) OSM.m_wayStorage = D::waysDelta;
+  if ((opt_zoom >= 0) && (opt_zoom <= (int) osm::maxZoom)) OSM.m_zoom = opt_zoom;
+  if (opt_index != NULL) OSM.SetIdIndex ((osm::idIndexKind) indexKind (opt_index));
+  if (store != NULL)
+  {
+    OSM.m_nodeStore = store;
+    if (opt_index == NULL) OSM.SetIdIndex (osm::idHash);
+  }
+  if (opt_complete) OSM.m_clipMode = D::clipCompleteWays;
+}
+
+// Lecture des fichiers (ajoutes l'un a l'autre), chronometree pour test
+// des perfs
+template<class D>
+static double load (D &OSM, int argc, char **argv)
+{
+  struct timeval prev;
+  gettimeofday (&prev, NULL);
+  if (opt_multi)
+  {
+    OSM.LoadText (std::vector<const char *> (argv + optind, argv + argc));
+    return elapsed (prev);
+  }
+  for (int f = optind; f < argc; ++f)
+  {
+    const char *filename = argv[f];
+    size_t const len = strlen (filename);
+    if ((len > 4) && ! strcmp (filename + len - 4, ".pbf"))
+      OSM.LoadPBF (filename);
+    else if ((len > 5) && ! strcmp (filename + len - 5, ".snap"))
+      OSM.OpenSnapshot (filename);
+    else
+      OSM.LoadText (filename, clip);
+  }
+  return elapsed (prev);
+}
+
+// Fichier XML de memes donnees qu'un .pbf, pour -c : "x.osm.pbf" (ou
+// "x.pbf") est compare a "x.osm"
+static std::string xmlTwin (const char *filename)
+{
+  std::string name (filename);
+  if ((name.size() > 4) && (name.compare (name.size() - 4, 4, ".pbf") == 0))
+    name.erase (name.size() - 4);
+  if ((name.size() < 4) || (name.compare (name.size() - 4, 4, ".osm") != 0))
+    name += ".osm";
+  return name;
+}
+
+// Charger, verifier et decrire les fichiers, dans la configuration D
+template<class D>
+static int run (int argc, char **argv)
+{
+  D OSM;
+  configure (OSM);
+
+  print_rusage();
+  printf ("Loaded OSM file in %.3fs\n", load (OSM, argc, argv));
+  print_rusage();
+
+  if (opt_change != NULL)
+  {
+    struct timeval prev;
+    gettimeofday (&prev, NULL);
+    OSM.ApplyChange (opt_change);
+    printf ("Applied change in %.3fs (badref %u %u)\n", elapsed (prev),
+        OSM.m_badrefwn, OSM.m_badrefr);
+  }
+
+  if (opt_snapshot != NULL)
+  {
+    struct timeval prev;
+    gettimeofday (&prev, NULL);
+    OSM.SaveSnapshot (opt_snapshot);
+    printf ("Saved snapshot in %.3fs\n", elapsed (prev));
+  }
+
+  // Relire avec un autre analyseur XML (expat, ou le natif si on a lu par
+  // expat), et comparer. Un .pbf est compare a la lecture XML de son .osm,
+  // et -M relit les fichiers ensemble
+  if (opt_check)
+  {
+    D other;
+    other.m_xmlParser = (OSM.m_xmlParser == D::xmlExpat) ?
+                          D::xmlNative : D::xmlExpat;
+    other.m_clipMode = OSM.m_clipMode;
+    other.m_zoom = OSM.m_zoom;
+    other.m_refMode = OSM.m_refMode;     // Mais pas m_wayStorage : le compare
+    if (store != NULL)
+    {
+      other.m_nodeStore = store;
+      other.SetIdIndex (osm::idHash);
+    }
+    if (opt_multi)
+      other.LoadText (std::vector<const char *> (argv + optind, argv + argc));
+    else for (int f = optind; f < argc; ++f)
+    {
+      size_t const len = strlen (argv[f]);
+      if ((len > 4) && ! strcmp (argv[f] + len - 4, ".pbf"))
+        other.LoadText (xmlTwin (argv[f]).c_str(), clip);
+      else
+        other.LoadText (argv[f], clip);
+    }
+    if (opt_change != NULL) other.ApplyChange (opt_change);
+    unsigned const diffs = compareOSM (OSM, other);
+    printf ("# Cross-check XML readers : %u differences\n", diffs);
+    if (diffs != 0) return 1;
+  }
+
+  if (opt_bench && (benchIdIndex (OSM) != 0)) return 1;
 
   // Liste des noeuds
   if (opt_nodes)
   {
     for (unsigned i = 0; i < OSM.m_nodes.size(); ++i)
     {
-      osm::OSMData::Node &p = OSM.m_nodes[i];
+      typename D::Node p = OSM.m_nodes[i];
       printf ("%10.7f %10.7f  %10I64u  T=%d %s\n",
           p.pos.degLat(), p.pos.degLon(), (uint64_t) p.id(),
-          p.tags().count,
-          (p.tags().name) ? p.tags().name : "");
+          p.tags().size(),
+          (p.tags().name()) ? p.tags().name() : "");
     }
     printf ("\n\n");
   }
@@ -72,10 +432,10 @@ int main (int argc, char **argv)
   {
     for (unsigned i = 0; i < OSM.m_ways.size(); ++i)
     {
-      osm::OSMData::Way &p = OSM.m_ways[i];
+      const osm::Tags t = OSM.m_ways[i].tags (OSM.m_tagArena);
       printf ("%5d %s\n",
-          p.nodesIx.size(),
-          (p.tags().name) ? p.tags().name : "");
+          OSM.wayNodes (i).size(),
+          (t.name()) ? t.name() : "");
     }
     printf ("\n\n");
   }
@@ -85,11 +445,10 @@ int main (int argc, char **argv)
   {
     for (unsigned i = 0; i < OSM.m_relations.size(); ++i)
     {
-      osm::OSMData::Relation &p = OSM.m_relations[i];
-      if (p.tags().name == NULL) continue;
+      const osm::Tags t = OSM.m_relations[i].tags (OSM.m_tagArena);
+      if (t.name() == NULL) continue;
       printf ("%5d %s\n",
-          p.eltIx.size(),
-          (p.tags().name) ? p.tags().name : "");
+          OSM.m_members[i].size(), t.name());
     }
     printf ("\n\n");
   }
@@ -107,6 +466,17 @@ int main (int argc, char **argv)
   unsigned tagW[2] = { 0, 0 };
   for (unsigned i = 0; i < OSM.m_ways.size(); ++i)
     (tagW[(OSM.m_ways[i].hasTag()) ? 1 : 0])++;
+  unsigned valW[6] = { 0, 0, 0, 0, 0, 0 };      // Way ayant ces TagValues
+  for (unsigned i = 0; i < OSM.m_ways.size(); ++i)
+  {
+    const osm::TagValues v = OSM.m_ways[i].tags (OSM.m_tagArena).values();
+    if (v.height)   ++valW[0];
+    if (v.levels)   ++valW[1];
+    if (v.maxspeed) ++valW[2];
+    if (v.lanes)    ++valW[3];
+    if (v.oneway)   ++valW[4];
+    if (v.area)     ++valW[5];
+  }
   unsigned tagR[2] = { 0, 0 };
   for (unsigned i = 0; i < OSM.m_relations.size(); ++i)
     (tagR[(OSM.m_relations[i].hasTag()) ? 1 : 0])++;
@@ -124,16 +494,16 @@ int main (int argc, char **argv)
   printf ("#\n");
   for (unsigned w = 0; w < OSM.m_ways.size(); w++)      // Node references par les Way
   {
-    osm::OSMData::Way &p = OSM.m_ways[w];
-    for (unsigned i = 0; i < p.nodesIx.size(); ++i)
+    const osm::WayNodes p = OSM.wayNodes (w);
+    for (osm::WayNodeIterator i = p.begin(); i != p.end(); ++i)
     {
-      if (p.nodesIx[i] < 0)
+      if (*i < 0)
         ++bad1;
-      else if (p.nodesIx[i] >= (int) OSM.m_nodes.size())
+      else if (*i >= (int) OSM.m_nodes.size())
         ++bad2;
       else
       {
-        ++(refsN[p.nodesIx[i]]);
+        ++(refsN[*i]);
       }
     }
   }
@@ -149,7 +519,7 @@ int main (int argc, char **argv)
       if (opt_reftaged)
         printf ("Node %10I64u has %d refs and %d tags\n",
             (uint64_t) OSM.m_nodes[n].id(), refsN[n],
-            OSM.m_nodes[n].tags().count);
+            OSM.m_nodes[n].tags().size());
     }
   }
 
@@ -161,11 +531,11 @@ int main (int argc, char **argv)
   for (unsigned i = 0; i < OSM.m_nodes.size(); refRN[i++] = 0);
   for (unsigned r = 0; r < OSM.m_relations.size(); r++)      // Node references par les Relation
   {
-    osm::OSMData::Relation &p = OSM.m_relations[r];
-    for (unsigned i = 0; i < p.eltIx.size(); ++i)
+    const osm::Span<typename D::Relation::Member> p = OSM.m_members[r];
+    for (unsigned i = 0; i < p.size(); ++i)
     {
-      int k = p.eltIx[i].ix;
-      switch (p.eltIx[i].elt)
+      int k = p[i].ix;
+      switch (p[i].elt)
       {
         case osm::eltNode :
           if (k < 0) ++bad1; else if (k >= (int) OSM.m_nodes.size()) ++bad2;
@@ -222,16 +592,21 @@ int main (int argc, char **argv)
   printf ("#\n");  //     1234567890 1234567890 1234567890 1234567890 123456 123456
   printf ("#           sz     in-OSM   capacity     no-tag     tagged reftag RNnotg\n");
   printf ("# Node     %3d %10u %10u %10u %10u %6u %6u\n", 
-      sizeof(osm::OSMData::Node),
+      D::NodeTable::rowSize,
       OSM.m_nodes.size(), OSM.m_nodes.capacity(), tagN[0], tagN[1], NWTagged, RNnotag);
   printf ("# Way      %3d %10u %10u %10u %10u\n",
-      sizeof(osm::OSMData::Way),
+      sizeof(typename D::Way),
       OSM.m_ways.size(), OSM.m_ways.capacity(), tagW[0], tagW[1]);
   printf ("# Relation %3d %10u %10u %10u %10u\n",
-      sizeof(osm::OSMData::Relation),
+      sizeof(typename D::Relation),
       OSM.m_relations.size(), OSM.m_relations.capacity(), tagR[0], tagR[1]);
-  printf ("# Tags     %3d\n",
-      sizeof(osm::Tags));
+  printf ("# Tags     %3d %10u %10u bytes\n",
+      sizeof(osm::tagPair), (unsigned) OSM.m_tagArena.pairs.size(),
+      (unsigned) OSM.m_tagArena.memory());
+  printf ("# Way nodes    %10u bytes %10u bytes delta\n",
+      (unsigned) OSM.m_wayNodes.memory(), (unsigned) OSM.m_wayDeltas.memory());
+  printf ("# Way values   height %u levels %u maxspeed %u lanes %u oneway %u area %u\n",
+      valW[0], valW[1], valW[2], valW[3], valW[4], valW[5]);
 
 
   if (opt_manyrefs)
@@ -241,5 +616,101 @@ int main (int argc, char **argv)
       if (refsN[i] >= 10)
         printf ("Node %I64u has %d refs\n", (uint64_t) OSM.m_nodes[i].id(), refsN[i]);
   }
+
+  return 0;
 }
 
+// Charger les memes fichiers dans chaque configuration, et comparer temps
+// et RAM des elements (cf option -L all)
+template<class D>
+static void benchConfig (const char *name, int argc, char **argv)
+{
+  D OSM;
+  configure (OSM);
+  double const dur = load (OSM, argc, argv);
+  size_t const bytes = OSM.m_nodes.memory() +
+                       OSM.m_ways.memory() + OSM.m_relations.memory() +
+                       OSM.m_wayNodes.memory() + OSM.m_wayDeltas.memory() +
+                       OSM.m_members.memory();
+  printf ("# Config %-7s %8.3fs %12u %6u %6u %6u\n", name, dur, (unsigned) bytes,
+      (unsigned) D::NodeTable::rowSize, (unsigned) sizeof(typename D::Way),
+      (unsigned) sizeof(typename D::Relation));
+}
+
+int main (int argc, char **argv)
+{
+  // CLI options
+  int c;
+  const char *opt_config = "full";  // OSMData configuration (cf OSM.h)
+
+  while ((c = getopt(argc, argv, "nwrmtsxpcdMk:K:z:i:bRgN:S:L:W:C:")) > 0)
+    switch (c)
+    {
+      case 'n' : opt_nodes     = true; break;
+      case 'w' : opt_ways      = true; break;
+      case 'r' : opt_relations = true; break;
+      case 'm' : opt_manyrefs  = true; break;
+      case 't' : opt_reftaged  = true; break;
+      case 's' : opt_rnnotag   = true; break;
+      case 'x' : opt_native    = true; break;
+      case 'p' : opt_parallel  = true; break;
+      case 'c' : opt_check     = true; break;
+      case 'd' : opt_decode    = true; break;
+      case 'M' : opt_multi     = true; break;
+      case 'k' : opt_clip      = optarg; break;
+      case 'K' : opt_clip      = optarg; opt_complete = true; break;
+      case 'z' : opt_zoom      = atoi (optarg); break;
+      case 'i' : opt_index     = optarg; break;
+      case 'b' : opt_bench     = true; break;
+      case 'R' : opt_deferred  = true; break;
+      case 'g' : opt_delta     = true; break;
+      case 'N' : opt_store     = optarg; opt_storeKind = osm::storeDense; break;
+      case 'S' : opt_store     = optarg; opt_storeKind = osm::storeSparse; break;
+      case 'L' : opt_config    = optarg; break;
+      case 'W' : opt_snapshot  = optarg; break;
+      case 'C' : opt_change    = optarg; break;
+    }
+  if (opt_decode) return (checkDecoders() == 0) ? 0 : 1;
+  if (optind > argc-1) return -1;
+  if ((opt_index != NULL) && (indexKind (opt_index) < 0)) return -1;
+
+  // Positions des Node dans un fichier
+  if (opt_store != NULL)
+  {
+    store = osm::NewNodeStore (opt_storeKind, strcmp (opt_store, "-") ? opt_store : NULL);
+    if (store == NULL) return -1;
+  }
+
+  // Restriction a une zone.
+  clip.open();          // Par defaut, tout prendre
+  if (opt_clip != NULL)
+  {
+    double b[4];
+    if (sscanf (opt_clip, "%lf,%lf,%lf,%lf", &b[0], &b[1], &b[2], &b[3]) != 4)
+      return -1;
+    clip.min.lat = (osm::latlon_t) floor (b[0] / osm::latlon_lsb + 0.5);
+    clip.min.lon = (osm::latlon_t) floor (b[1] / osm::latlon_lsb + 0.5);
+    clip.max.lat = (osm::latlon_t) floor (b[2] / osm::latlon_lsb + 0.5);
+    clip.max.lon = (osm::latlon_t) floor (b[3] / osm::latlon_lsb + 0.5);
+  }
+
+  // Configuration de OSMData, ou toutes comparees
+  int status = -1;
+  if (! strcmp (opt_config, "full"))
+    status = run<osm::OSMData> (argc, argv);
+  else if (! strcmp (opt_config, "lean"))
+    status = run<osm::BasicOSMData<osm::LeanConfig> > (argc, argv);
+  else if (! strcmp (opt_config, "idless"))
+    status = run<osm::BasicOSMData<osm::IdlessConfig> > (argc, argv);
+  else if (! strcmp (opt_config, "all"))
+  {
+    printf ("# Config            load        bytes   Node    Way    Rel\n");
+    benchConfig<osm::OSMData> ("full", argc, argv);
+    benchConfig<osm::BasicOSMData<osm::LeanConfig> > ("lean", argc, argv);
+    benchConfig<osm::BasicOSMData<osm::IdlessConfig> > ("idless", argc, argv);
+    status = 0;
+  }
+
+  delete store;
+  return status;
+}